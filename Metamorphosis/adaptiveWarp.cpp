@@ -0,0 +1,325 @@
+// --------------------------------------------------------------------------
+// adaptiveWarp.cpp
+//
+// Quadtree evaluator for the field warp.
+//
+
+#include "adaptiveWarp.h"
+#include "morphPlan.h"
+
+#include <math.h>
+#include <stddef.h>
+#include <algorithm>
+
+const int kBlockPixels = kAdaptiveBlock * kAdaptiveBlock;
+
+// Cells are accepted when their test points are within this fraction of the
+// tolerance: between the test points the interpolation error runs up to
+// about 1.2 times the largest error measured at them.
+const float kToleranceMargin = 0.75f;
+
+// Cells are subdivided while a feature segment comes within this fraction
+// of their size (plus a pixel) of them. The field bends sharply around the
+// segments, and most of all around their end points, over about the
+// distance to them, so that a larger cell can hide the bend between its
+// test points.
+const float kFeatureClearance = 0.5f;
+
+// A quadtree cell given by its inclusive corner pixels, relative to the
+// block. Neighboring cells share their edges.
+struct Cell
+{
+    short x0, y0, x1, y1;
+};
+
+/**
+ * The field over one block: exact values where they have been evaluated,
+ * interpolated values elsewhere once Fill() has run. Exact evaluations are
+ * requested point by point and run in batches through the points kernel.
+ */
+class FieldBlock
+{
+public:
+    FieldBlock(const MorphPlan &plan, FieldPointsKernel fieldPoints,
+               int x0, int y0, int width, int height,
+               float *sourceX, float *sourceY, float *targetX, float *targetY)
+        : mPlan(plan), mFieldPoints(fieldPoints)
+        , mX0(x0), mY0(y0), mWidth(width)
+        , mSourceX(sourceX), mSourceY(sourceY), mTargetX(targetX), mTargetY(targetY)
+        , mPending(0), mExactCount(0)
+    {
+        for (int i = 0; i < width * height; i++)
+            mExact[i] = false;
+    }
+
+    // Queues an exact evaluation of pixel (x, y) unless it already has one.
+    void Request(int x, int y)
+    {
+        int index = y * mWidth + x;
+        if (mExact[index])
+            return;
+        mExact[index] = true;
+        mIndex[mPending] = index;
+        mXs[mPending] = (float)(mX0 + x);
+        mYs[mPending] = (float)(mY0 + y);
+        mPending++;
+    }
+
+    // Runs the queued evaluations.
+    void Flush()
+    {
+        if (mPending == 0)
+            return;
+        bool both = mTargetX != NULL;
+        mFieldPoints(mPlan, mXs, mYs, mPending, mOutX[0], mOutY[0],
+                     both ? mOutX[1] : NULL, both ? mOutY[1] : NULL);
+        for (int i = 0; i < mPending; i++) {
+            int index = mIndex[i];
+            mSourceX[index] = mOutX[0][i];
+            mSourceY[index] = mOutY[0][i];
+            if (both) {
+                mTargetX[index] = mOutX[1][i];
+                mTargetY[index] = mOutY[1][i];
+            }
+        }
+        mExactCount += mPending;
+        mPending = 0;
+    }
+
+    // Largest distance between the exact field at (x, y) and its bilinear
+    // interpolation from the corners of cell, over both warps.
+    float Error(const Cell &cell, int x, int y) const
+    {
+        int index = y * mWidth + x;
+        float error = 0;
+        for (int side = 0; side < (mTargetX ? 2 : 1); side++) {
+            const float *fieldX = side ? mTargetX : mSourceX;
+            const float *fieldY = side ? mTargetY : mSourceY;
+            float ex = Interpolate(fieldX, cell, x, y) - fieldX[index];
+            float ey = Interpolate(fieldY, cell, x, y) - fieldY[index];
+            float dist = sqrtf(ex*ex + ey*ey);
+            if (dist > error)
+                error = dist;
+        }
+        return error;
+    }
+
+    // Interpolates every pixel of cell that has no exact value. The values
+    // are kept between the smallest and the largest corner, where bilinear
+    // interpolation lies but its rounding may not; positions near the
+    // image border thus stay inside it when the corners are.
+    void Fill(const Cell &cell)
+    {
+        float *fields[4] = { mSourceX, mSourceY, mTargetX, mTargetY };
+        float invWidth = cell.x1 > cell.x0 ? 1.f / (cell.x1 - cell.x0) : 0.f;
+        float invHeight = cell.y1 > cell.y0 ? 1.f / (cell.y1 - cell.y0) : 0.f;
+        for (int f = 0; f < (mTargetX ? 4 : 2); f++) {
+            float *field = fields[f];
+            float c00 = field[cell.y0 * mWidth + cell.x0];
+            float c10 = field[cell.y0 * mWidth + cell.x1];
+            float c01 = field[cell.y1 * mWidth + cell.x0];
+            float c11 = field[cell.y1 * mWidth + cell.x1];
+            float lowest = std::min(std::min(c00, c10), std::min(c01, c11));
+            float highest = std::max(std::max(c00, c10), std::max(c01, c11));
+            for (int y = cell.y0; y <= cell.y1; y++) {
+                // lerp down the left and right edges, then across the row
+                float fy = (y - cell.y0) * invHeight;
+                float left = c00 + fy * (c01 - c00);
+                float step = (c10 + fy * (c11 - c10) - left) * invWidth;
+                int row = y * mWidth;
+                for (int x = cell.x0; x <= cell.x1; x++) {
+                    if (!mExact[row + x]) {
+                        float value = left + (x - cell.x0) * step;
+                        field[row + x] = std::min(std::max(value, lowest), highest);
+                    }
+                }
+            }
+        }
+    }
+
+    int GetExactCount() const { return mExactCount; }
+
+private:
+    float Interpolate(const float *field, const Cell &cell, int x, int y) const
+    {
+        float fx = cell.x1 > cell.x0 ? (float)(x - cell.x0) / (cell.x1 - cell.x0) : 0.f;
+        float fy = cell.y1 > cell.y0 ? (float)(y - cell.y0) / (cell.y1 - cell.y0) : 0.f;
+        float c00 = field[cell.y0 * mWidth + cell.x0];
+        float c10 = field[cell.y0 * mWidth + cell.x1];
+        float c01 = field[cell.y1 * mWidth + cell.x0];
+        float c11 = field[cell.y1 * mWidth + cell.x1];
+        float left = c00 + fy * (c01 - c00);
+        float right = c10 + fy * (c11 - c10);
+        return left + fx * (right - left);
+    }
+
+    const MorphPlan &mPlan;
+    FieldPointsKernel mFieldPoints;
+    int mX0, mY0, mWidth;
+    float *mSourceX, *mSourceY, *mTargetX, *mTargetY;
+
+    bool mExact[kBlockPixels];
+
+    // evaluations queued for the next Flush()
+    int mPending;
+    int mIndex[kBlockPixels];
+    float mXs[kBlockPixels], mYs[kBlockPixels];
+    float mOutX[2][kBlockPixels], mOutY[2][kBlockPixels];
+
+    int mExactCount;
+};
+
+/**
+ * Whether any of the plan's interpolated segments passes through the cell,
+ * grown on all sides by a pixel plus kFeatureClearance times its size. The
+ * weights have a crease along every segment (the distance switches between
+ * |v| and the endpoint distances) and peak around it, which the test points
+ * can miss, so such cells are always subdivided.
+ */
+static bool NearFeature(const FeatureLines &lines, float x0, float y0, float x1, float y1)
+{
+    float margin = 1 + kFeatureClearance * std::max(x1 - x0, y1 - y0);
+    x0 -= margin; y0 -= margin; x1 += margin; y1 += margin;
+    for (int i = 0; i < lines.count; i++) {
+        // clip P + s * (Q - P), s in [0,1], against the box (Liang-Barsky)
+        float sMin = 0, sMax = 1;
+        const float p[4] = { -lines.dx[i], lines.dx[i], -lines.dy[i], lines.dy[i] };
+        const float q[4] = { lines.px[i] - x0, x1 - lines.px[i],
+                             lines.py[i] - y0, y1 - lines.py[i] };
+        bool inside = true;
+        for (int k = 0; k < 4 && inside; k++) {
+            if (p[k] == 0) {
+                inside = q[k] >= 0;
+            } else {
+                float r = q[k] / p[k];
+                if (p[k] < 0)
+                    sMin = std::max(sMin, r);
+                else
+                    sMax = std::min(sMax, r);
+                inside = sMin <= sMax;
+            }
+        }
+        if (inside)
+            return true;
+    }
+    return false;
+}
+
+// Cells whose pixels are all corners need no interpolation.
+static inline bool IsLeaf(const Cell &cell)
+{
+    return cell.x1 - cell.x0 <= 1 && cell.y1 - cell.y0 <= 1;
+}
+
+// Points of a cell where the interpolation is tested: its center, edge
+// midpoints and quadrant centers.
+const int kTestPoints = 9;
+
+static void GetTestPoints(const Cell &cell, int *xs, int *ys)
+{
+    int mx = (cell.x0 + cell.x1) / 2, my = (cell.y0 + cell.y1) / 2;
+    int qx0 = (cell.x0 + mx) / 2, qx1 = (mx + cell.x1) / 2;
+    int qy0 = (cell.y0 + my) / 2, qy1 = (my + cell.y1) / 2;
+    const int x[kTestPoints] = { mx, mx, mx, cell.x0, cell.x1, qx0, qx1, qx0, qx1 };
+    const int y[kTestPoints] = { my, cell.y0, cell.y1, my, my, qy0, qy0, qy1, qy1 };
+    for (int i = 0; i < kTestPoints; i++) {
+        xs[i] = x[i];
+        ys[i] = y[i];
+    }
+}
+
+static inline Cell MakeCell(int x0, int y0, int x1, int y1)
+{
+    Cell cell;
+    cell.x0 = (short)x0;
+    cell.y0 = (short)y0;
+    cell.x1 = (short)x1;
+    cell.y1 = (short)y1;
+    return cell;
+}
+
+int AdaptiveFieldBlock(const MorphPlan &plan, FieldPointsKernel fieldPoints,
+                       float tolerance, int x0, int y0, int width, int height,
+                       float *sourceX, float *sourceY,
+                       float *targetX, float *targetY)
+{
+    FieldBlock block(plan, fieldPoints, x0, y0, width, height,
+                     sourceX, sourceY, targetX, targetY);
+
+    // cells of the current and the next quadtree level, and the cells that
+    // were accepted for interpolation
+    Cell levels[2][kBlockPixels];
+    Cell accepted[kBlockPixels];
+    int levelCount = 0, acceptedCount = 0;
+    Cell *cells = levels[0], *next = levels[1];
+
+    // root cells and their corners
+    for (int cy = 0; ; cy += kAdaptiveRootCell) {
+        int cy1 = cy + kAdaptiveRootCell < height - 1 ? cy + kAdaptiveRootCell : height - 1;
+        for (int cx = 0; ; cx += kAdaptiveRootCell) {
+            int cx1 = cx + kAdaptiveRootCell < width - 1 ? cx + kAdaptiveRootCell : width - 1;
+            cells[levelCount++] = MakeCell(cx, cy, cx1, cy1);
+            block.Request(cx, cy);
+            block.Request(cx1, cy);
+            block.Request(cx, cy1);
+            block.Request(cx1, cy1);
+            if (cx1 == width - 1)
+                break;
+        }
+        if (cy1 == height - 1)
+            break;
+    }
+    block.Flush();
+
+    while (levelCount > 0) {
+        // exact values at the center, the edge midpoints and the quadrant
+        // centers of every cell; the latter are the centers of its children
+        for (int i = 0; i < levelCount; i++) {
+            const Cell &c = cells[i];
+            if (IsLeaf(c))
+                continue;
+            int testX[kTestPoints], testY[kTestPoints];
+            GetTestPoints(c, testX, testY);
+            for (int k = 0; k < kTestPoints; k++)
+                block.Request(testX[k], testY[k]);
+        }
+        block.Flush();
+
+        // accept cells the corners predict well, split the others
+        int nextCount = 0;
+        for (int i = 0; i < levelCount; i++) {
+            const Cell &c = cells[i];
+            if (IsLeaf(c))
+                continue;
+            int testX[kTestPoints], testY[kTestPoints];
+            GetTestPoints(c, testX, testY);
+            float error = 0;
+            for (int k = 0; k < kTestPoints; k++)
+                error = std::max(error, block.Error(c, testX[k], testY[k]));
+            if (error <= kToleranceMargin * tolerance &&
+                !NearFeature(plan.lines, x0 + c.x0, y0 + c.y0, x0 + c.x1, y0 + c.y1)) {
+                accepted[acceptedCount++] = c;
+                continue;
+            }
+
+            // only split along the dimensions with interior pixels
+            int mx = (c.x0 + c.x1) / 2, my = (c.y0 + c.y1) / 2;
+            bool splitX = c.x1 - c.x0 >= 2, splitY = c.y1 - c.y0 >= 2;
+            int xs[3] = { c.x0, splitX ? mx : c.x1, c.x1 };
+            int ys[3] = { c.y0, splitY ? my : c.y1, c.y1 };
+            for (int j = 0; j < (splitY ? 2 : 1); j++) {
+                for (int k = 0; k < (splitX ? 2 : 1); k++)
+                    next[nextCount++] = MakeCell(xs[k], ys[j], xs[k + 1], ys[j + 1]);
+            }
+        }
+
+        Cell *swap = cells;
+        cells = next;
+        next = swap;
+        levelCount = nextCount;
+    }
+
+    for (int i = 0; i < acceptedCount; i++)
+        block.Fill(accepted[i]);
+    return block.GetExactCount();
+}
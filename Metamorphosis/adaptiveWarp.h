@@ -0,0 +1,42 @@
+// --------------------------------------------------------------------------
+// adaptiveWarp.h
+//
+// Adaptive evaluator for the field warp. The displacement field is smooth
+// over most of the image and only changes quickly near feature lines, so
+// it is evaluated exactly at the corners of quadtree cells and bilinearly
+// interpolated inside them. A cell is subdivided while the interpolation
+// misses the exact field at its center, edge midpoints or quadrant centers
+// by more than a fraction of a tolerance in pixels, and while a feature
+// line comes within half its size of it; the test points become the
+// corners and centers of its children. Interpolated positions stay between
+// those of the corners, so rounding does not carry them out of the image.
+//
+
+#ifndef __ADAPTIVEWARP_H__
+#define __ADAPTIVEWARP_H__
+
+#include "warpSimd.h"
+
+struct MorphPlan;
+
+// Largest block, in pixels per side, evaluated by one AdaptiveFieldBlock()
+// call; its working set lives on the stack.
+const int kAdaptiveBlock = 32;
+
+// Edge length of the coarsest quadtree cells.
+const int kAdaptiveRootCell = 32;
+
+// Default largest tolerated interpolation error, in pixels.
+const float kDefaultTolerance = 0.25f;
+
+// Computes where the width x height pixels starting at (x0, y0) map to
+// under the plan's source lines and, if targetX is not NULL, its target
+// lines. width and height are at most kAdaptiveBlock, and the results are
+// stored row by row with a stride of width. Exact values come from
+// fieldPoints. Returns the number of exactly evaluated pixels.
+int AdaptiveFieldBlock(const MorphPlan &plan, FieldPointsKernel fieldPoints,
+                       float tolerance, int x0, int y0, int width, int height,
+                       float *sourceX, float *sourceY,
+                       float *targetX, float *targetY);
+
+#endif // __ADAPTIVEWARP_H__
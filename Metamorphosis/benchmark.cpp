@@ -0,0 +1,880 @@
+// --------------------------------------------------------------------------
+// benchmark.cpp
+//
+// Throughput benchmarks for the morph engine's building blocks.
+//
+
+#include "benchmark.h"
+#include "incrementalMorph.h"
+#include "STImage.h"
+#include "STTimer.h"
+#include "sampler.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+
+// Samples per sampler measurement, and frames per whole-frame measurement.
+const int kBenchSamples = 1 << 20;
+const int kBenchFrames  = 5;
+
+const SampleFilter kBenchFilters[] = {
+    FILTER_NEAREST, FILTER_BILINEAR, FILTER_BICUBIC, FILTER_LANCZOS3
+};
+const int kBenchFilterCount = sizeof(kBenchFilters) / sizeof(kBenchFilters[0]);
+
+// Feature counts the engines are timed at for the scaling measurement.
+const int kScalingCounts[] = { 125, 250, 500, 1000, 2000, 4000 };
+const int kScalingCountCount = sizeof(kScalingCounts) / sizeof(kScalingCounts[0]);
+
+// Where the amplified difference between the mesh and the field morph is
+// saved, and the amplification.
+const char *const kMeshDiffFile = "meshdiff.png";
+const int kMeshDiffGain = 4;
+
+// Frames of the sequence kept for the incremental measurement, and how far,
+// in pixels, the edit moves one end of a line.
+const int kIncrementalFrames = 11;
+const float kIncrementalNudge = 2.f;
+
+// Saves per encoder measurement, and the scratch files they write.
+const int kBenchSaves = 5;
+const char *const kEncoderFiles[] = { "encoderbench.png", "encoderbench.jpg" };
+const int kEncoderFileCount = sizeof(kEncoderFiles) / sizeof(kEncoderFiles[0]);
+
+// Tile sizes the tiling check renders with besides the default; neither is
+// a multiple of the 32x32 field blocks or the 64-pixel row chunks.
+const int kCheckTileSizes[] = { 48, 100 };
+const int kCheckTileSizeCount = sizeof(kCheckTileSizes) / sizeof(kCheckTileSizes[0]);
+
+// Largest difference between the positions the vector and the scalar
+// kernels map a pixel to (see warpSimd.h), and the weight exponent besides
+// the configured one the check uses; it takes the polynomial powf() path.
+const float kSimdTolerance = 1e-3f;
+const float kSimdCheckExponent = 1.5f;
+
+// Frame times the scanline engine is checked against the direct one at, and
+// the largest difference between the positions the two map a pixel to: a
+// few units in the last place of u and v, where adding up du and dv along
+// a chunk drifted about twice as far. The end frames show one side alone, which
+// both map exactly; in between, positions within rounding of each other
+// may still be sampled into pixels one level apart.
+const float kScanlineCheckTimes[] = { 0.f, 0.5f, 1.f };
+const int kScanlineCheckTimeCount =
+    sizeof(kScanlineCheckTimes) / sizeof(kScanlineCheckTimes[0]);
+const float kScanlineTolerance = 5e-4f;
+
+// Frame times the adaptive engine is checked at, at each exponent of
+// kBvhCheckExponents.
+const float kAdaptiveCheckTimes[] = { 0.f, 0.3f, 0.5f, 1.f };
+const int kAdaptiveCheckTimeCount =
+    sizeof(kAdaptiveCheckTimes) / sizeof(kAdaptiveCheckTimes[0]);
+
+// Every kScalingErrorStride-th block in each direction is checked for the
+// position error of the cluster and bvh engines.
+const int kScalingErrorStride = 4;
+
+// Weight exponents and culling epsilons the bvh error bound is checked at,
+// the synthetic lines it is also checked over, and the slack allowed above
+// the bound for rounding.
+const float kBvhCheckExponents[] = { 0.5f, 1.f, 2.f };
+const int kBvhCheckExponentCount = sizeof(kBvhCheckExponents) / sizeof(kBvhCheckExponents[0]);
+const float kBvhCheckEpsilons[] = { 1e-4f, 1e-3f, 1e-2f };
+const int kBvhCheckEpsilonCount = sizeof(kBvhCheckEpsilons) / sizeof(kBvhCheckEpsilons[0]);
+const int kBvhCheckFeatures = 250;
+const float kBvhCheckSlack = 1e-3f;
+
+/**
+ * Fills xs and ys with reproducible pseudo-random positions inside a
+ * width x height image.
+ */
+static void RandomPositions(int width, int height, std::vector<float> &xs,
+                            std::vector<float> &ys)
+{
+    unsigned int state = 12345;
+    for (size_t i = 0; i < xs.size(); i++) {
+        state = state * 1664525u + 1013904223u;
+        xs[i] = (state >> 8) * (1.f / 16777216.f) * (width - 1);
+        state = state * 1664525u + 1013904223u;
+        ys[i] = (state >> 8) * (1.f / 16777216.f) * (height - 1);
+    }
+}
+
+static void PrintRate(const char *name, float millis, double items, const char *unit)
+{
+    printf("  %-24s %9.2f ms %9.1f M%s/s\n", name, millis,
+           items / (millis * 1000.0), unit);
+}
+
+/**
+ * Prints the outcome of a check and returns 1 if it failed, 0 otherwise.
+ */
+static int ReportCheck(const char *name, bool passed, const char *detail)
+{
+    printf("  %-24s %-6s %s\n", name, passed ? "ok" : "FAILED", detail);
+    return passed ? 0 : 1;
+}
+
+/**
+ * Number of pixels of the width x height block at a, with row stride
+ * strideA, that differ from those at b, with row stride strideB.
+ */
+static int CountDifferences(const STColor4ub *a, int strideA, const STColor4ub *b,
+                            int strideB, int width, int height)
+{
+    int count = 0;
+    for (int y = 0; y < height; y++) {
+        const PackedPixel *rowA = (const PackedPixel *)(a + y * strideA);
+        const PackedPixel *rowB = (const PackedPixel *)(b + y * strideB);
+        for (int x = 0; x < width; x++)
+            count += rowA[x] != rowB[x];
+    }
+    return count;
+}
+
+/**
+ * Sampler policies on their own, single-threaded, over random positions.
+ */
+template<class Sampler>
+static void BenchSampler(const char *name, const PaddedImage &image,
+                         const std::vector<float> &xs, const std::vector<float> &ys,
+                         std::vector<PackedPixel> &out)
+{
+    STTimer timer;
+    timer.Reset();
+    SampleRow<Sampler>(image, &xs[0], &ys[0], (int)xs.size(), &out[0]);
+    PrintRate(name, timer.GetElapsedMillis(), (double)xs.size(), "samples");
+}
+
+static void BenchSamplers(STImage *image, const MorphOptions &options)
+{
+    PaddedImage padded(image);
+    std::vector<float> xs(kBenchSamples), ys(kBenchSamples);
+    std::vector<PackedPixel> out(kBenchSamples);
+    RandomPositions(image->GetWidth(), image->GetHeight(), xs, ys);
+
+    printf("sampler throughput (1 thread, %d samples)\n", kBenchSamples);
+    BenchSampler<NearestSampler>("nearest", padded, xs, ys, out);
+    BenchSampler<BilinearSampler>("bilinear", padded, xs, ys, out);
+    BenchSampler<BicubicSampler>("bicubic", padded, xs, ys, out);
+    BenchSampler<Lanczos3Sampler>("lanczos3", padded, xs, ys, out);
+
+    // the bilinear row kernel the engine actually uses
+    WarpKernels kernels = SelectWarpKernels(options);
+    char name[64];
+    snprintf(name, sizeof(name), "bilinear (%s row)", GetSimdLevelName(kernels.level));
+    STTimer timer;
+    timer.Reset();
+    kernels.sampleRow(padded, &xs[0], &ys[0], kBenchSamples, (STColor4ub *)&out[0]);
+    PrintRate(name, timer.GetElapsedMillis(), (double)kBenchSamples, "samples");
+}
+
+/**
+ * Complete fused morph frames at t = 0.5, once per field evaluator.
+ */
+static void BenchEngines(const MorphPlan &plan, const PaddedImage &sourceImage,
+                         const PaddedImage &targetImage, const MorphOptions &options)
+{
+    const WarpEngine engines[] = {
+        WARP_DIRECT, WARP_SCANLINE, WARP_ADAPTIVE, WARP_BVH, WARP_CLUSTER, WARP_MESH
+    };
+    const int engineCount = sizeof(engines) / sizeof(engines[0]);
+    double pixels = (double)sourceImage.GetWidth() * sourceImage.GetHeight();
+
+    printf("field evaluators (%s filter, adaptive tolerance %g px, bvh epsilon %g, "
+           "cluster theta %g)\n", GetSampleFilterName(options.filter), options.tolerance,
+           options.epsilon, options.theta);
+    for (int i = 0; i < engineCount; i++) {
+        MorphOptions frameOptions = options;
+        frameOptions.engine = engines[i];
+        STTimer timer;
+        timer.Reset();
+        for (int frame = 0; frame < kBenchFrames; frame++)
+            delete FusedMorph(plan, sourceImage, targetImage, frameOptions);
+        float millis = timer.GetElapsedMillis() / kBenchFrames;
+        PrintRate(GetWarpEngineName(engines[i]), millis, pixels, "pixels");
+    }
+}
+
+/**
+ * The mesh warp against the exact field warp on the same frame: their
+ * times, the cost of building the mesh, and how far apart their pixels are.
+ * The difference is saved to kMeshDiffFile, kMeshDiffGain times brighter,
+ * to show where the two warps part.
+ */
+static void BenchMeshDiff(const MorphPlan &plan, const PaddedImage &sourceImage,
+                          const PaddedImage &targetImage, const MorphOptions &options)
+{
+    int width = std::min(sourceImage.GetWidth(), targetImage.GetWidth());
+    int height = std::min(sourceImage.GetHeight(), targetImage.GetHeight());
+    MorphOptions fieldOptions = options;
+    fieldOptions.engine = WARP_DIRECT;
+    MorphOptions meshOptions = options;
+    meshOptions.engine = WARP_MESH;
+
+    STTimer timer;
+    timer.Reset();
+    FeatureMesh mesh;
+    for (int frame = 0; frame < kBenchFrames; frame++)
+        mesh.Build(plan, width, height, SelectWarpKernels(options).fieldPoints);
+    float buildMillis = timer.GetElapsedMillis() / kBenchFrames;
+
+    float millis[2];
+    STImage *results[2] = { 0, 0 };
+    const MorphOptions *frameOptions[2] = { &fieldOptions, &meshOptions };
+    for (int i = 0; i < 2; i++) {
+        timer.Reset();
+        for (int frame = 0; frame < kBenchFrames; frame++) {
+            delete results[i];
+            results[i] = FusedMorph(plan, sourceImage, targetImage, *frameOptions[i]);
+        }
+        millis[i] = timer.GetElapsedMillis() / kBenchFrames;
+    }
+
+    const STImage::Pixel *field = results[0]->GetPixels();
+    const STImage::Pixel *warped = results[1]->GetPixels();
+    STImage diff(width, height);
+    STImage::Pixel *diffPixels = diff.GetPixels();
+    double sum = 0, squares = 0;
+    int largest = 0, visible = 0;
+    for (int i = 0; i < width * height; i++) {
+        int d[3] = { abs(field[i].r - warped[i].r), abs(field[i].g - warped[i].g),
+                     abs(field[i].b - warped[i].b) };
+        int pixelLargest = std::max(d[0], std::max(d[1], d[2]));
+        for (int c = 0; c < 3; c++) {
+            sum += d[c];
+            squares += d[c] * d[c];
+        }
+        largest = std::max(largest, pixelLargest);
+        visible += pixelLargest > 16;
+        diffPixels[i].r = (unsigned char)std::min(255, kMeshDiffGain * d[0]);
+        diffPixels[i].g = (unsigned char)std::min(255, kMeshDiffGain * d[1]);
+        diffPixels[i].b = (unsigned char)std::min(255, kMeshDiffGain * d[2]);
+        diffPixels[i].a = 255;
+    }
+    double samples = 3.0 * width * height;
+    double mse = squares / samples;
+    diff.Save(kMeshDiffFile);
+
+    printf("mesh warp against field warp (%d triangles, %d of %d features as edges)\n",
+           mesh.GetTriangleCount(), mesh.GetConstrainedCount(), plan.GetCount());
+    printf("  %-24s %9.2f ms\n", "mesh build", buildMillis);
+    PrintRate("field (direct)", millis[0], (double)width * height, "pixels");
+    PrintRate("mesh", millis[1], (double)width * height, "pixels");
+    printf("  difference: mean %.2f, max %d, PSNR %.1f dB, %.1f%% of pixels off by "
+           "more than 16; x%d in %s\n", sum / samples, largest,
+           mse > 0 ? 10 * log10(255.0 * 255.0 / mse) : 99.0,
+           100.0 * visible / ((double)width * height), kMeshDiffGain, kMeshDiffFile);
+    delete results[0];
+    delete results[1];
+}
+
+/**
+ * Complete fused morph frames at t = 0.5, once per filter and once per
+ * field evaluator.
+ */
+static void BenchFrames(STImage *sourceImage, const std::vector<Feature> &sourceFeatures,
+                        STImage *targetImage, const std::vector<Feature> &targetFeatures,
+                        float a, float b, float p, const MorphOptions &options)
+{
+    FeatureLines sourceLines(sourceFeatures);
+    FeatureLines targetLines(targetFeatures);
+    MorphPlan plan(sourceLines, targetLines, 0.5f, a, b, p);
+    PaddedImage paddedSource(sourceImage);
+    PaddedImage paddedTarget(targetImage);
+    double pixels = (double)sourceImage->GetWidth() * sourceImage->GetHeight();
+
+    printf("fused morph frame (%d features, %s engine, %d frames per filter)\n",
+           plan.GetCount(), GetWarpEngineName(options.engine), kBenchFrames);
+    for (int i = 0; i < kBenchFilterCount; i++) {
+        MorphOptions frameOptions = options;
+        frameOptions.filter = kBenchFilters[i];
+        STTimer timer;
+        timer.Reset();
+        for (int frame = 0; frame < kBenchFrames; frame++)
+            delete FusedMorph(plan, paddedSource, paddedTarget, frameOptions);
+        float millis = timer.GetElapsedMillis() / kBenchFrames;
+        PrintRate(GetSampleFilterName(kBenchFilters[i]), millis, pixels, "pixels");
+    }
+
+    BenchEngines(plan, paddedSource, paddedTarget, options);
+    BenchMeshDiff(plan, paddedSource, paddedTarget, options);
+}
+
+/**
+ * Fills source and target with count reproducible pseudo-random short lines
+ * in a width x height image; each target line is its source line moved by
+ * up to 10 pixels, with its end points jittered by up to 2 more.
+ */
+static void RandomFeatures(int count, int width, int height,
+                           std::vector<Feature> &source, std::vector<Feature> &target)
+{
+    unsigned int state = 54321;
+    float random[7];
+    source.clear();
+    target.clear();
+    for (int i = 0; i < count; i++) {
+        for (int j = 0; j < 7; j++) {
+            state = state * 1664525u + 1013904223u;
+            random[j] = (state >> 8) * (1.f / 16777216.f);
+        }
+        float x = random[0] * (width - 1), y = random[1] * (height - 1);
+        float angle = random[2] * 6.2831853f, length = 5 + 30 * random[3];
+        STPoint2 p(x, y), q(x + length * cosf(angle), y + length * sinf(angle));
+        float moveX = 20 * random[4] - 10, moveY = 20 * random[5] - 10;
+        float jitter = 4 * random[6] - 2;
+        source.push_back(Feature(p, q));
+        target.push_back(Feature(STPoint2(p.x + moveX, p.y + moveY),
+                                 STPoint2(q.x + moveX + jitter, q.y + moveY - jitter)));
+    }
+}
+
+/**
+ * Largest distance between the positions the cluster engine maps pixels to
+ * and the exact ones, over a regular subset of the blocks.
+ */
+static float ClusterError(const MorphPlan &plan, int width, int height,
+                          const MorphOptions &options)
+{
+    const int kBlock = 32;
+    WarpKernels kernels = SelectWarpKernels(options);
+    FeatureClusters clusters(plan);
+    ClusterQuery query;
+    float sourceX[kBlock * kBlock], sourceY[kBlock * kBlock];
+    float targetX[kBlock * kBlock], targetY[kBlock * kBlock];
+    float exactX[2][kBlock], exactY[2][kBlock];
+
+    float error = 0;
+    for (int by = 0; by < height; by += kScalingErrorStride * kBlock) {
+        for (int bx = 0; bx < width; bx += kScalingErrorStride * kBlock) {
+            int w = std::min(kBlock, width - bx), h = std::min(kBlock, height - by);
+            clusters.EvaluateBlock(kernels.fieldRowWeighted, options.theta, bx, by, w, h,
+                                   sourceX, sourceY, targetX, targetY, query);
+            for (int j = 0; j < h; j++) {
+                kernels.fieldRow(plan, bx, w, by + j, exactX[0], exactY[0],
+                                 exactX[1], exactY[1]);
+                for (int i = 0; i < w; i++) {
+                    int k = j * w + i;
+                    error = std::max(error, hypotf(sourceX[k] - exactX[0][i],
+                                                   sourceY[k] - exactY[0][i]));
+                    error = std::max(error, hypotf(targetX[k] - exactX[1][i],
+                                                   targetY[k] - exactY[1][i]));
+                }
+            }
+        }
+    }
+    return error;
+}
+
+/**
+ * Largest distance between the positions the bvh engine maps pixels to at
+ * epsilon and the exact ones, over a regular subset of the blocks. If excess
+ * is given, it receives the largest amount by which a distance exceeds the
+ * bound of featureBVH.h: epsilon times the largest distance between the
+ * position a skipped feature alone maps the pixel to and the position the
+ * kept ones do.
+ */
+static float BvhError(const MorphPlan &plan, int width, int height, float epsilon,
+                      const MorphOptions &options, float *excess)
+{
+    const int kBlock = 32;
+    WarpKernels kernels = SelectWarpKernels(options);
+    FeatureBVH bvh(plan);
+    BvhQuery query;
+    MorphPlan culled, single;
+    FeatureLines culledSource, culledTarget, singleSource, singleTarget;
+    std::vector<int> skipped;
+    float kept[2][2][kBlock], exact[2][2][kBlock], alone[2][2][kBlock];
+    std::vector<float> bound(kBlock * kBlock);
+
+    float error = 0;
+    if (excess)
+        *excess = -1e30f;
+    for (int by = 0; by < height; by += kScalingErrorStride * kBlock) {
+        for (int bx = 0; bx < width; bx += kScalingErrorStride * kBlock) {
+            int w = std::min(kBlock, width - bx), h = std::min(kBlock, height - by);
+            int count = bvh.Cull(bx, by, bx + w - 1, by + h - 1, epsilon, query);
+            culled.Select(plan, count ? &query.indices[0] : NULL, count,
+                          &culledSource, &culledTarget);
+            skipped.clear();
+            for (int i = 0, k = 0; i < plan.GetCount(); i++) {
+                if (k < count && query.indices[k] == i)
+                    k++;
+                else
+                    skipped.push_back(i);
+            }
+
+            std::fill(bound.begin(), bound.end(), 0.f);
+            for (int j = 0; j < h; j++) {
+                kernels.fieldRow(culled, bx, w, by + j, kept[0][0], kept[0][1],
+                                 kept[1][0], kept[1][1]);
+                kernels.fieldRow(plan, bx, w, by + j, exact[0][0], exact[0][1],
+                                 exact[1][0], exact[1][1]);
+                for (int s = 0; excess && s < (int)skipped.size(); s++) {
+                    single.Select(plan, &skipped[s], 1, &singleSource, &singleTarget);
+                    kernels.fieldRow(single, bx, w, by + j, alone[0][0], alone[0][1],
+                                     alone[1][0], alone[1][1]);
+                    for (int side = 0; side < 2; side++) {
+                        for (int i = 0; i < w; i++) {
+                            float spread = hypotf(alone[side][0][i] - kept[side][0][i],
+                                                  alone[side][1][i] - kept[side][1][i]);
+                            bound[j * w + i] = std::max(bound[j * w + i], spread);
+                        }
+                    }
+                }
+                for (int side = 0; side < 2; side++) {
+                    for (int i = 0; i < w; i++) {
+                        float distance = hypotf(kept[side][0][i] - exact[side][0][i],
+                                                kept[side][1][i] - exact[side][1][i]);
+                        error = std::max(error, distance);
+                        if (excess) {
+                            *excess = std::max(*excess, distance -
+                                               epsilon * bound[j * w + i]);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return error;
+}
+
+/**
+ * Fused morph frames over synthetic feature sets of growing size, with the
+ * exact direct engine, the cluster engine and the mesh engine, and the
+ * largest position errors of the cluster and bvh engines.
+ */
+static void BenchFeatureScaling(const PaddedImage &sourceImage, const PaddedImage &targetImage,
+                                float a, float b, float p, const MorphOptions &options)
+{
+    int width = sourceImage.GetWidth(), height = sourceImage.GetHeight();
+    printf("scaling with feature count (random lines, cluster theta %g, bvh epsilon %g)\n",
+           options.theta, options.epsilon);
+    printf("  %8s %12s %12s %8s %12s %12s %12s\n", "features", "direct", "cluster", "speedup",
+           "max error", "bvh error", "mesh");
+    for (int i = 0; i < kScalingCountCount; i++) {
+        std::vector<Feature> sourceFeatures, targetFeatures;
+        RandomFeatures(kScalingCounts[i], width, height, sourceFeatures, targetFeatures);
+        FeatureLines sourceLines(sourceFeatures);
+        FeatureLines targetLines(targetFeatures);
+        MorphPlan plan(sourceLines, targetLines, 0.5f, a, b, p);
+
+        float millis[3];
+        const WarpEngine engines[3] = { WARP_DIRECT, WARP_CLUSTER, WARP_MESH };
+        for (int e = 0; e < 3; e++) {
+            MorphOptions frameOptions = options;
+            frameOptions.engine = engines[e];
+            STTimer timer;
+            timer.Reset();
+            delete FusedMorph(plan, sourceImage, targetImage, frameOptions);
+            millis[e] = timer.GetElapsedMillis();
+        }
+        printf("  %8d %9.2f ms %9.2f ms %7.1fx %9.3f px %9.3f px %9.2f ms\n",
+               kScalingCounts[i], millis[0], millis[1], millis[0] / millis[1],
+               ClusterError(plan, width, height, options),
+               BvhError(plan, width, height, options.epsilon, options, NULL), millis[2]);
+    }
+}
+
+/**
+ * Saves image in each format with each encoder preset: time per save,
+ * megapixels encoded per second, and the size of the file.
+ */
+static void BenchEncoders(STImage *image)
+{
+    const STImage::SavePreset presets[] = {
+        STImage::SAVE_FASTEST, STImage::SAVE_BALANCED, STImage::SAVE_SMALLEST
+    };
+    const char *const presetNames[] = { "fastest", "balanced", "smallest" };
+    double pixels = (double)image->GetWidth() * image->GetHeight();
+
+    printf("frame encoding (%d saves per preset)\n", kBenchSaves);
+    for (int f = 0; f < kEncoderFileCount; f++) {
+        for (int i = 0; i < 3; i++) {
+            STImage::SaveOptions saveOptions(presets[i]);
+            STTimer timer;
+            timer.Reset();
+            bool saved = true;
+            for (int n = 0; n < kBenchSaves; n++)
+                saved = image->Save(kEncoderFiles[f], saveOptions) == ST_OK && saved;
+            float millis = timer.GetElapsedMillis() / kBenchSaves;
+
+            struct stat status;
+            if (!saved || stat(kEncoderFiles[f], &status) != 0) {
+                printf("  %s could not be saved\n", kEncoderFiles[f]);
+                continue;
+            }
+            char name[64];
+            snprintf(name, sizeof(name), "%s %s", strrchr(kEncoderFiles[f], '.') + 1,
+                     presetNames[i]);
+            printf("  %-24s %9.2f ms %9.1f Mpixels/s %8lld KB\n", name, millis,
+                   pixels / (millis * 1000.0), (long long)status.st_size / 1024);
+        }
+        unlink(kEncoderFiles[f]);
+    }
+}
+
+/**
+ * Checks that threading and tiling do not change the pixels (see
+ * MorphOptions in morphEngine.h): for every engine, frames rendered on the
+ * thread pool, with other tile sizes and region by region are compared
+ * with a serial render in default tiles.
+ */
+static int CheckTiling(const MorphPlan &plan, const PaddedImage &sourceImage,
+                       const PaddedImage &targetImage, const MorphOptions &options)
+{
+    int width = std::min(sourceImage.GetWidth(), targetImage.GetWidth());
+    int height = std::min(sourceImage.GetHeight(), targetImage.GetHeight());
+    PixelRect region(width / 7, height / 5, width * 5 / 7 + 3, height * 4 / 5 + 1);
+    std::vector<STColor4ub> regionPixels((size_t)region.GetWidth() * region.GetHeight());
+    PixelView regionView(&regionPixels[0], region.GetWidth(), region.GetHeight(),
+                         region.GetWidth());
+
+    int failures = 0;
+    for (int e = WARP_DIRECT; e <= WARP_MESH; e++) {
+        MorphOptions serial = options;
+        serial.engine = (WarpEngine)e;
+        serial.pool = NULL;
+        serial.tileSize = kDefaultTileSize;
+        STImage *reference = FusedMorph(plan, sourceImage, targetImage, serial);
+        const STColor4ub *pixels = reference->GetPixels();
+
+        // on the pool, in default and in other tiles
+        int differences = 0;
+        for (int i = -1; i < kCheckTileSizeCount; i++) {
+            MorphOptions tiled = serial;
+            tiled.pool = options.pool;
+            tiled.tileSize = i < 0 ? kDefaultTileSize : kCheckTileSizes[i];
+            STImage *frame = FusedMorph(plan, sourceImage, targetImage, tiled);
+            differences += CountDifferences(frame->GetPixels(), width, pixels, width,
+                                            width, height);
+            delete frame;
+        }
+
+        // one region on the pool
+        MorphOptions pooled = serial;
+        pooled.pool = options.pool;
+        FusedMorph(plan, sourceImage, targetImage, region, regionView, pooled);
+        differences += CountDifferences(&regionPixels[0], region.GetWidth(),
+                                        pixels + region.y0 * width + region.x0, width,
+                                        region.GetWidth(), region.GetHeight());
+        delete reference;
+
+        char detail[64];
+        snprintf(detail, sizeof(detail), "%d pixels differ", differences);
+        failures += ReportCheck(GetWarpEngineName(serial.engine), differences == 0, detail);
+    }
+    return failures;
+}
+
+/**
+ * Largest distance between two sets of count mapped positions.
+ */
+static float PositionError(const std::vector<float> &a, const std::vector<float> &b, int count)
+{
+    float error = 0;
+    for (int side = 0; side < 2; side++) {
+        const float *ax = &a[2 * side * count], *ay = &a[(2 * side + 1) * count];
+        const float *bx = &b[2 * side * count], *by = &b[(2 * side + 1) * count];
+        for (int i = 0; i < count; i++)
+            error = std::max(error, hypotf(ax[i] - bx[i], ay[i] - by[i]));
+    }
+    return error;
+}
+
+/**
+ * Checks the vector kernels of every level the CPU supports against the
+ * scalar ones, as warpSimd.h documents them: mapped positions (row and
+ * point kernels, at b and at kSimdCheckExponent) within kSimdTolerance,
+ * and bit-exact samples of identical positions and bit-exact blends.
+ */
+static int CheckSimdLevels(const FeatureLines &sourceLines, const FeatureLines &targetLines,
+                           float a, float b, float p, STImage *sourceImage,
+                           STImage *targetImage, const PaddedImage &paddedSource)
+{
+    int width = std::min(sourceImage->GetWidth(), targetImage->GetWidth());
+    int height = std::min(sourceImage->GetHeight(), targetImage->GetHeight());
+    const float exponents[2] = { b, kSimdCheckExponent };
+    WarpKernels scalar = GetWarpKernels(SIMD_SCALAR);
+
+    std::vector<float> xs(width), ys(width);
+    std::vector<float> expected(4 * width), actual(4 * width);
+    std::vector<STColor4ub> expectedColors(width), actualColors(width);
+    int failures = 0;
+    for (int level = SIMD_SSE41; level <= GetCPUSimdLevel(); level++) {
+        WarpKernels kernels = GetWarpKernels((SimdLevel)level);
+        float error = 0;
+        int colorDifferences = 0, blendDifferences = 0;
+        for (int e = 0; e < 2; e++) {
+            MorphPlan plan(sourceLines, targetLines, 0.5f, a, exponents[e], p);
+            for (int y = 0; y < height; y++) {
+                float *s = &expected[0], *v = &actual[0];
+                scalar.fieldRow(plan, 0, width, y, s, s + width, s + 2 * width, s + 3 * width);
+                kernels.fieldRow(plan, 0, width, y, v, v + width, v + 2 * width, v + 3 * width);
+                error = std::max(error, PositionError(expected, actual, width));
+
+                // the point kernel, at the pixels of the row shifted by half
+                for (int x = 0; x < width; x++) {
+                    xs[x] = x + 0.5f;
+                    ys[x] = y + 0.5f;
+                }
+                scalar.fieldPoints(plan, &xs[0], &ys[0], width, s, s + width,
+                                   s + 2 * width, s + 3 * width);
+                kernels.fieldPoints(plan, &xs[0], &ys[0], width, v, v + width,
+                                    v + 2 * width, v + 3 * width);
+                error = std::max(error, PositionError(expected, actual, width));
+
+                // samples of the same (scalar) positions
+                scalar.sampleRow(paddedSource, s, s + width, width, &expectedColors[0]);
+                kernels.sampleRow(paddedSource, s, s + width, width, &actualColors[0]);
+                colorDifferences += CountDifferences(&expectedColors[0], width,
+                                                     &actualColors[0], width, width, 1);
+            }
+        }
+        for (int y = 0; y < height; y++) {
+            const STColor4ub *row1 = sourceImage->GetPixels() + y * sourceImage->GetWidth();
+            const STColor4ub *row2 = targetImage->GetPixels() + y * targetImage->GetWidth();
+            scalar.blendRow(row1, row2, 77, width, &expectedColors[0]);
+            kernels.blendRow(row1, row2, 77, width, &actualColors[0]);
+            blendDifferences += CountDifferences(&expectedColors[0], width,
+                                                 &actualColors[0], width, width, 1);
+        }
+
+        char detail[128];
+        snprintf(detail, sizeof(detail), "max position error %.2g px, %d samples and "
+                 "%d blends differ", error, colorDifferences, blendDifferences);
+        failures += ReportCheck(GetSimdLevelName(kernels.level),
+                                error <= kSimdTolerance && colorDifferences == 0 &&
+                                blendDifferences == 0, detail);
+    }
+    return failures;
+}
+
+/**
+ * Largest distance between the positions the adaptive engine maps the
+ * pixels of a width x height output to at options' tolerance and the exact
+ * ones.
+ */
+static float AdaptiveError(const MorphPlan &plan, int width, int height,
+                           const MorphOptions &options)
+{
+    const int kBlock = kAdaptiveBlock;
+    MorphOptions exactOptions = options;
+    exactOptions.engine = WARP_DIRECT;
+    WarpKernels kernels = SelectWarpKernels(exactOptions);
+    float sourceX[kBlock * kBlock], sourceY[kBlock * kBlock];
+    float targetX[kBlock * kBlock], targetY[kBlock * kBlock];
+    float exactX[2][kBlock], exactY[2][kBlock];
+
+    float error = 0;
+    for (int by = 0; by < height; by += kBlock) {
+        for (int bx = 0; bx < width; bx += kBlock) {
+            int w = std::min(kBlock, width - bx), h = std::min(kBlock, height - by);
+            AdaptiveFieldBlock(plan, kernels.fieldPoints, options.tolerance, bx, by, w, h,
+                               sourceX, sourceY, targetX, targetY);
+            for (int j = 0; j < h; j++) {
+                kernels.fieldRow(plan, bx, w, by + j, exactX[0], exactY[0],
+                                 exactX[1], exactY[1]);
+                for (int i = 0; i < w; i++) {
+                    int k = j * w + i;
+                    error = std::max(error, hypotf(sourceX[k] - exactX[0][i],
+                                                   sourceY[k] - exactY[0][i]));
+                    error = std::max(error, hypotf(targetX[k] - exactX[1][i],
+                                                   targetY[k] - exactY[1][i]));
+                }
+            }
+        }
+    }
+    return error;
+}
+
+/**
+ * Checks that the adaptive engine maps every pixel within options'
+ * tolerance of the exact position, at every exponent of kBvhCheckExponents
+ * and time of kAdaptiveCheckTimes.
+ */
+static int CheckAdaptive(const FeatureLines &sourceLines, const FeatureLines &targetLines,
+                         int width, int height, float a, float p,
+                         const MorphOptions &options)
+{
+    int failures = 0;
+    for (int e = 0; e < kBvhCheckExponentCount; e++) {
+        for (int k = 0; k < kAdaptiveCheckTimeCount; k++) {
+            MorphPlan plan(sourceLines, targetLines, kAdaptiveCheckTimes[k], a,
+                           kBvhCheckExponents[e], p);
+            float error = AdaptiveError(plan, width, height, options);
+            char name[64], detail[64];
+            snprintf(name, sizeof(name), "adaptive b=%g t=%g", kBvhCheckExponents[e],
+                     kAdaptiveCheckTimes[k]);
+            snprintf(detail, sizeof(detail), "max position error %.3f px", error);
+            failures += ReportCheck(name, error <= options.tolerance, detail);
+        }
+    }
+    return failures;
+}
+
+/**
+ * Checks the scanline engine against the direct one at kScanlineCheckTimes:
+ * mapped positions within kScanlineTolerance, and identical end frames.
+ */
+static int CheckScanline(const FeatureLines &sourceLines, const FeatureLines &targetLines,
+                         float a, float b, float p, const PaddedImage &sourceImage,
+                         const PaddedImage &targetImage, const MorphOptions &options)
+{
+    int width = std::min(sourceImage.GetWidth(), targetImage.GetWidth());
+    int height = std::min(sourceImage.GetHeight(), targetImage.GetHeight());
+    MorphOptions direct = options, scanline = options;
+    direct.engine = WARP_DIRECT;
+    scanline.engine = WARP_SCANLINE;
+    WarpKernels exact = SelectWarpKernels(direct), kernels = SelectWarpKernels(scanline);
+    std::vector<float> expected(4 * width), actual(4 * width);
+
+    int failures = 0;
+    for (int k = 0; k < kScanlineCheckTimeCount; k++) {
+        float t = kScanlineCheckTimes[k];
+        MorphPlan plan(sourceLines, targetLines, t, a, b, p);
+        float error = 0;
+        for (int y = 0; y < height; y++) {
+            float *s = &expected[0], *v = &actual[0];
+            exact.fieldRow(plan, 0, width, y, s, s + width, s + 2 * width, s + 3 * width);
+            kernels.fieldRow(plan, 0, width, y, v, v + width, v + 2 * width, v + 3 * width);
+            error = std::max(error, PositionError(expected, actual, width));
+        }
+
+        STImage *reference = FusedMorph(plan, sourceImage, targetImage, direct);
+        STImage *result = FusedMorph(plan, sourceImage, targetImage, scanline);
+        int differences = CountDifferences(reference->GetPixels(), width,
+                                           result->GetPixels(), width, width, height);
+        delete reference;
+        delete result;
+
+        char name[64], detail[128];
+        snprintf(name, sizeof(name), "scanline t=%g", t);
+        snprintf(detail, sizeof(detail), "max position error %.2g px, %d pixels differ",
+                 error, differences);
+        bool endFrame = t == 0 || t == 1;
+        failures += ReportCheck(name, error <= kScanlineTolerance &&
+                                (!endFrame || differences == 0), detail);
+    }
+    return failures;
+}
+
+/**
+ * Checks the position error of the bvh engine against the bound featureBVH.h
+ * documents, at every exponent of kBvhCheckExponents and epsilon of
+ * kBvhCheckEpsilons, over the given features and over kBvhCheckFeatures
+ * synthetic lines.
+ */
+static int CheckBvhBound(const std::vector<Feature> &sourceFeatures,
+                         const std::vector<Feature> &targetFeatures, int width, int height,
+                         float a, float p, const MorphOptions &options)
+{
+    std::vector<Feature> randomSource, randomTarget;
+    RandomFeatures(kBvhCheckFeatures, width, height, randomSource, randomTarget);
+    const std::vector<Feature> *sets[2][2] = {
+        { &sourceFeatures, &targetFeatures }, { &randomSource, &randomTarget }
+    };
+    const char *const setNames[2] = { "pair", "random" };
+
+    int failures = 0;
+    for (int set = 0; set < 2; set++) {
+        FeatureLines sourceLines(*sets[set][0]);
+        FeatureLines targetLines(*sets[set][1]);
+        for (int e = 0; e < kBvhCheckExponentCount; e++) {
+            MorphPlan plan(sourceLines, targetLines, 0.5f, a, kBvhCheckExponents[e], p);
+            for (int k = 0; k < kBvhCheckEpsilonCount; k++) {
+                float excess;
+                float error = BvhError(plan, width, height, kBvhCheckEpsilons[k], options,
+                                       &excess);
+                char name[64], detail[128];
+                snprintf(name, sizeof(name), "%s b=%g eps=%g", setNames[set],
+                         kBvhCheckExponents[e], kBvhCheckEpsilons[k]);
+                snprintf(detail, sizeof(detail), "max error %.3g px, %.3g px above the bound",
+                         error, std::max(excess, 0.f));
+                failures += ReportCheck(name, excess <= kBvhCheckSlack, detail);
+            }
+        }
+    }
+    return failures;
+}
+
+/**
+ * Updates a sequence after an edit that moves one end of the middle line,
+ * against rendering the sequence from scratch, at the given b and at b = 2,
+ * whose weights fall off faster.
+ */
+static void BenchIncremental(const PaddedImage &sourceImage, const PaddedImage &targetImage,
+                             const std::vector<Feature> &sourceFeatures,
+                             const std::vector<Feature> &targetFeatures,
+                             float a, float b, float p, const MorphOptions &options)
+{
+    if (targetFeatures.empty())
+        return;
+    std::vector<float> times;
+    for (int i = 0; i < kIncrementalFrames; i++)
+        times.push_back(i / (float)(kIncrementalFrames - 1));
+    std::vector<Feature> edited = targetFeatures;
+    edited[edited.size() / 2].Q.x += kIncrementalNudge;
+
+    printf("incremental update of %d frames after moving a line end by %g px "
+           "(tolerance %g px)\n", kIncrementalFrames, kIncrementalNudge,
+           kDefaultEditTolerance);
+    const float exponents[2] = { b, 2.f };
+    for (int e = 0; e < (b == 2.f ? 1 : 2); e++) {
+        IncrementalMorph sequence(sourceImage, targetImage, times, a, exponents[e], p,
+                                  options);
+        EditReport full = sequence.Update(sourceFeatures, targetFeatures);
+        EditReport edit = sequence.Update(sourceFeatures, edited);
+        printf("  b = %-4g full %9.2f ms  update %9.2f ms  %5.1f%% of tiles  %5.1fx\n",
+               exponents[e], full.millis, edit.millis,
+               100.f * edit.renderedTiles / edit.tiles, full.millis / edit.millis);
+    }
+}
+
+int RunBenchmarks(STImage *sourceImage, const std::vector<Feature> &sourceFeatures,
+                   STImage *targetImage, const std::vector<Feature> &targetFeatures,
+                   float a, float b, float p, const MorphOptions &options)
+{
+    printf("benchmark: %dx%d images, %s kernels\n",
+           sourceImage->GetWidth(), sourceImage->GetHeight(),
+           GetSimdLevelName(SelectWarpKernels(options).level));
+    BenchSamplers(sourceImage, options);
+    BenchFrames(sourceImage, sourceFeatures, targetImage, targetFeatures,
+                a, b, p, options);
+    PaddedImage paddedSource(sourceImage);
+    PaddedImage paddedTarget(targetImage);
+    BenchIncremental(paddedSource, paddedTarget, sourceFeatures, targetFeatures,
+                     a, b, p, options);
+    BenchFeatureScaling(paddedSource, paddedTarget, a, b, p, options);
+    BenchEncoders(sourceImage);
+
+    FeatureLines sourceLines(sourceFeatures);
+    FeatureLines targetLines(targetFeatures);
+    MorphPlan plan(sourceLines, targetLines, 0.5f, a, b, p);
+    int failures = 0;
+    printf("check: pool, tile sizes and a region against a serial frame\n");
+    failures += CheckTiling(plan, paddedSource, paddedTarget, options);
+    printf("check: vector kernels against the scalar ones (tolerance %g px)\n",
+           kSimdTolerance);
+    failures += CheckSimdLevels(sourceLines, targetLines, a, b, p, sourceImage, targetImage,
+                                paddedSource);
+    printf("check: scanline engine against the direct one (tolerance %g px)\n",
+           kScanlineTolerance);
+    failures += CheckScanline(sourceLines, targetLines, a, b, p, paddedSource, paddedTarget,
+                              options);
+    printf("check: adaptive positions against the exact ones (tolerance %g px)\n",
+           options.tolerance);
+    failures += CheckAdaptive(sourceLines, targetLines, paddedSource.GetWidth(),
+                              paddedSource.GetHeight(), a, p, options);
+    printf("check: bvh positions against the exact ones and the error bound\n");
+    failures += CheckBvhBound(sourceFeatures, targetFeatures, paddedSource.GetWidth(),
+                              paddedSource.GetHeight(), a, p, options);
+    printf("%d checks failed\n", failures);
+    fflush(stdout);
+    return failures;
+}
@@ -0,0 +1,28 @@
+// --------------------------------------------------------------------------
+// benchmark.h
+//
+// Throughput benchmarks for the morph engine's building blocks, and checks
+// of the guarantees the engine documents. The suite is run by starting the
+// morph program with -benchmark, and prints one line per measured kernel
+// and per check.
+//
+
+#ifndef __BENCHMARK_H__
+#define __BENCHMARK_H__
+
+#include "feature.h"
+#include "morphEngine.h"
+
+#include <vector>
+
+class STImage;
+
+// Times the engine on the given image pair and features and prints the
+// results to stdout. options supplies the thread pool and kernel settings
+// for the whole-frame measurements; its filter is varied by the suite.
+// Returns the number of checks that failed.
+int RunBenchmarks(STImage *sourceImage, const std::vector<Feature> &sourceFeatures,
+                   STImage *targetImage, const std::vector<Feature> &targetFeatures,
+                   float a, float b, float p, const MorphOptions &options);
+
+#endif // __BENCHMARK_H__
@@ -0,0 +1,282 @@
+// --------------------------------------------------------------------------
+// clusterWarp.cpp
+//
+// Cluster hierarchy and far-field evaluation for the field warp.
+//
+
+#include "clusterWarp.h"
+#include "weightPolicy.h"
+
+#include <math.h>
+#include <stddef.h>
+#include <algorithm>
+
+// Longest block row; rows are evaluated with their scratch on the stack.
+const int kMaxBlockRow = 256;
+
+// Orders line indices by their midpoint along one axis.
+struct ClusterMidpointLess
+{
+    const float *mMid;
+
+    explicit ClusterMidpointLess(const float *mid) : mMid(mid) { }
+    bool operator()(int i, int j) const { return mMid[i] < mMid[j]; }
+};
+
+FeatureClusters::FeatureClusters(const MorphPlan &plan)
+    : mPlan(0)
+{
+    Build(plan);
+}
+
+void FeatureClusters::Build(const MorphPlan &plan)
+{
+    mPlan = &plan;
+    const FeatureLines &lines = plan.lines;
+    int n = plan.GetCount();
+
+    mOrder.resize(n);
+    mScale.resize(n);
+    mMidX.resize(n);
+    mMidY.resize(n);
+    for (int i = 0; i < n; i++) {
+        mOrder[i] = i;
+        mScale[i] = plan.b == 1.f ? plan.lengthPowP[i] : powf(plan.lengthPowP[i], plan.b);
+        mMidX[i] = 0.5f * (lines.px[i] + lines.qx[i]);
+        mMidY[i] = 0.5f * (lines.py[i] + lines.qy[i]);
+    }
+
+    mClusters.clear();
+    if (n == 0)
+        return;
+    mClusters.reserve(2 * n);
+    mClusters.push_back(Cluster());
+    BuildCluster(0, 0, n);
+}
+
+/**
+ * Adds the displacement of line i at (cx, cy) and its Jacobian, scaled by
+ * scale, to sums. Line i maps x to P' + u (Q' - P') + v n' with u and v
+ * affine in x, i.e. to M x + c for a 2x2 matrix M; the displacement is
+ * M x + c - x.
+ */
+static void AddLineMoments(const MorphPlan &plan, const FeatureLines &mapped, int i,
+                           double cx, double cy, double scale, double sums[6])
+{
+    const FeatureLines &lines = plan.lines;
+    double ux = lines.dx[i] * plan.invLengthSq[i], uy = lines.dy[i] * plan.invLengthSq[i];
+    double m00 = mapped.dx[i] * ux + mapped.nx[i] * lines.nx[i];
+    double m01 = mapped.dx[i] * uy + mapped.nx[i] * lines.ny[i];
+    double m10 = mapped.dy[i] * ux + mapped.ny[i] * lines.nx[i];
+    double m11 = mapped.dy[i] * uy + mapped.ny[i] * lines.ny[i];
+
+    double rx = cx - lines.px[i], ry = cy - lines.py[i];
+    sums[0] += scale * (mapped.px[i] + m00 * rx + m01 * ry - cx);
+    sums[1] += scale * (mapped.py[i] + m10 * rx + m11 * ry - cy);
+    sums[2] += scale * (m00 - 1);
+    sums[3] += scale * m01;
+    sums[4] += scale * m10;
+    sums[5] += scale * (m11 - 1);
+}
+
+/**
+ * Fills in cluster index of mClusters for the lines mOrder[first,
+ * first+count), splitting them at the median midpoint along the longer side
+ * of their midpoints' bounds until at most kClusterLeafSize are left.
+ */
+void FeatureClusters::BuildCluster(int index, int first, int count)
+{
+    const FeatureLines &lines = mPlan->lines;
+
+    double weight = 0, cx = 0, cy = 0;
+    float midMinX = HUGE_VALF, midMinY = HUGE_VALF;
+    float midMaxX = -HUGE_VALF, midMaxY = -HUGE_VALF;
+    for (int i = first; i < first + count; i++) {
+        int k = mOrder[i];
+        weight += mScale[k];
+        cx += (double)mScale[k] * mMidX[k];
+        cy += (double)mScale[k] * mMidY[k];
+        midMinX = std::min(midMinX, mMidX[k]); midMaxX = std::max(midMaxX, mMidX[k]);
+        midMinY = std::min(midMinY, mMidY[k]); midMaxY = std::max(midMaxY, mMidY[k]);
+    }
+    if (weight > 0) {
+        cx /= weight;
+        cy /= weight;
+    } else {
+        cx = 0.5 * (midMinX + midMaxX);
+        cy = 0.5 * (midMinY + midMaxY);
+    }
+
+    Cluster cluster;
+    cluster.cx = (float)cx;
+    cluster.cy = (float)cy;
+    cluster.weight = (float)weight;
+    cluster.first = first;
+    cluster.count = count;
+    cluster.left = -1;
+
+    double radiusSq = 0;
+    double source[6] = { 0, 0, 0, 0, 0, 0 }, target[6] = { 0, 0, 0, 0, 0, 0 };
+    for (int i = first; i < first + count; i++) {
+        int k = mOrder[i];
+        double ex = lines.px[k] - cx, ey = lines.py[k] - cy;
+        double fx = lines.qx[k] - cx, fy = lines.qy[k] - cy;
+        radiusSq = std::max(radiusSq, std::max(ex*ex + ey*ey, fx*fx + fy*fy));
+        AddLineMoments(*mPlan, *mPlan->source, k, cx, cy, mScale[k], source);
+        AddLineMoments(*mPlan, *mPlan->target, k, cx, cy, mScale[k], target);
+    }
+    cluster.radius = (float)sqrt(radiusSq);
+    for (int j = 0; j < 6; j++) {
+        cluster.source[j] = (float)source[j];
+        cluster.target[j] = (float)target[j];
+    }
+
+    if (count > kClusterLeafSize) {
+        bool splitX = midMaxX - midMinX >= midMaxY - midMinY;
+        int half = count / 2;
+        std::nth_element(mOrder.begin() + first, mOrder.begin() + first + half,
+                         mOrder.begin() + first + count,
+                         ClusterMidpointLess(splitX ? &mMidX[0] : &mMidY[0]));
+
+        // the children take two adjacent slots before either is filled in
+        cluster.left = (int)mClusters.size();
+        mClusters.push_back(Cluster());
+        mClusters.push_back(Cluster());
+        BuildCluster(cluster.left, first, half);
+        BuildCluster(cluster.left + 1, first + half, count - half);
+    }
+
+    mClusters[index] = cluster;
+}
+
+/**
+ * Adds the weights and weighted displacements of the far clusters to the
+ * sums of count pixels starting at (x0, y).
+ */
+template <bool kBothSides, class Weight>
+void FeatureClusters::AddFarField(const std::vector<int> &far, int x0, int y, int count,
+                                  float *sourceX, float *sourceY,
+                                  float *targetX, float *targetY,
+                                  float *weightSums) const
+{
+    const float a = mPlan->a, b = mPlan->b;
+    for (size_t k = 0; k < far.size(); k++) {
+        const Cluster &cluster = mClusters[far[k]];
+        const float *s = cluster.source, *t = cluster.target;
+        float ry = y - cluster.cy;
+        for (int j = 0; j < count; j++) {
+            float rx = (x0 + j) - cluster.cx;
+            float g = Weight::Weight(1.f / (a + sqrtf(rx*rx + ry*ry)), b);
+            sourceX[j] += g * (s[0] + s[2] * rx + s[3] * ry);
+            sourceY[j] += g * (s[1] + s[4] * rx + s[5] * ry);
+            if (kBothSides) {
+                targetX[j] += g * (t[0] + t[2] * rx + t[3] * ry);
+                targetY[j] += g * (t[1] + t[4] * rx + t[5] * ry);
+            }
+            weightSums[j] += g * cluster.weight;
+        }
+    }
+}
+
+int FeatureClusters::EvaluateBlock(FieldRowWeightedKernel fieldRow, float theta,
+                                   int x0, int y0, int width, int height,
+                                   float *sourceX, float *sourceY,
+                                   float *targetX, float *targetY,
+                                   ClusterQuery &query) const
+{
+    // split the lines into clusters far enough from the block to be used
+    // as a whole, and lines to be evaluated exactly
+    query.mNear.clear();
+    query.mFar.clear();
+    query.mStack.clear();
+    if (!mClusters.empty())
+        query.mStack.push_back(0);
+    float x1 = (float)(x0 + width - 1), y1 = (float)(y0 + height - 1);
+    while (!query.mStack.empty()) {
+        int index = query.mStack.back();
+        const Cluster &cluster = mClusters[index];
+        query.mStack.pop_back();
+
+        float dx = std::max(0.f, std::max(x0 - cluster.cx, cluster.cx - x1));
+        float dy = std::max(0.f, std::max(y0 - cluster.cy, cluster.cy - y1));
+        if (theta > 0 && cluster.radius <= theta * sqrtf(dx*dx + dy*dy)) {
+            query.mFar.push_back(index);
+        } else if (cluster.left < 0) {
+            for (int i = cluster.first; i < cluster.first + cluster.count; i++)
+                query.mNear.push_back(mOrder[i]);
+        } else {
+            query.mStack.push_back(cluster.left + 1);
+            query.mStack.push_back(cluster.left);
+        }
+    }
+    std::sort(query.mNear.begin(), query.mNear.end());
+
+    int nearCount = (int)query.mNear.size();
+    query.mNearPlan.Select(*mPlan, nearCount ? &query.mNear[0] : NULL, nearCount,
+                           &query.mSource, &query.mTarget);
+
+    WeightKind kind = GetWeightKind(mPlan->b);
+    for (int j = 0; j < height; j++) {
+        int y = y0 + j;
+        float *sx = sourceX + j * width, *sy = sourceY + j * width;
+        float *tx = targetX ? targetX + j * width : NULL;
+        float *ty = targetY ? targetY + j * width : NULL;
+        float weightSums[kMaxBlockRow];
+        fieldRow(query.mNearPlan, x0, width, y, sx, sy, tx, ty, weightSums);
+        if (query.mFar.empty())
+            continue;
+
+        // back from mapped positions to weighted displacement sums, add the
+        // far field and normalize again
+        for (int i = 0; i < width; i++) {
+            float x = (float)(x0 + i);
+            sx[i] = (sx[i] - x) * weightSums[i];
+            sy[i] = (sy[i] - y) * weightSums[i];
+            if (tx) {
+                tx[i] = (tx[i] - x) * weightSums[i];
+                ty[i] = (ty[i] - y) * weightSums[i];
+            }
+        }
+        if (tx) {
+            switch (kind) {
+                case WEIGHT_LINEAR:
+                    AddFarField<true, WeightPolicy<WEIGHT_LINEAR> >(
+                        query.mFar, x0, y, width, sx, sy, tx, ty, weightSums);
+                    break;
+                case WEIGHT_SQUARE:
+                    AddFarField<true, WeightPolicy<WEIGHT_SQUARE> >(
+                        query.mFar, x0, y, width, sx, sy, tx, ty, weightSums);
+                    break;
+                default:
+                    AddFarField<true, WeightPolicy<WEIGHT_POW> >(
+                        query.mFar, x0, y, width, sx, sy, tx, ty, weightSums);
+                    break;
+            }
+        } else {
+            switch (kind) {
+                case WEIGHT_LINEAR:
+                    AddFarField<false, WeightPolicy<WEIGHT_LINEAR> >(
+                        query.mFar, x0, y, width, sx, sy, NULL, NULL, weightSums);
+                    break;
+                case WEIGHT_SQUARE:
+                    AddFarField<false, WeightPolicy<WEIGHT_SQUARE> >(
+                        query.mFar, x0, y, width, sx, sy, NULL, NULL, weightSums);
+                    break;
+                default:
+                    AddFarField<false, WeightPolicy<WEIGHT_POW> >(
+                        query.mFar, x0, y, width, sx, sy, NULL, NULL, weightSums);
+                    break;
+            }
+        }
+        for (int i = 0; i < width; i++) {
+            float x = (float)(x0 + i);
+            sx[i] = x + sx[i] / weightSums[i];
+            sy[i] = y + sy[i] / weightSums[i];
+            if (tx) {
+                tx[i] = x + tx[i] / weightSums[i];
+                ty[i] = y + ty[i] / weightSums[i];
+            }
+        }
+    }
+    return (int)query.mFar.size();
+}
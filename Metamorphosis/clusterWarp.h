@@ -0,0 +1,104 @@
+// --------------------------------------------------------------------------
+// clusterWarp.h
+//
+// Far-field evaluator for the field warp with large feature sets, in the
+// spirit of a multipole method. The interpolated lines of a frame are
+// grouped into a hierarchy of clusters. Seen from far enough away, all lines
+// of a cluster are at about the same distance, so their weights share one
+// factor (a + dist)^-b, and each line's displacement is affine in the pixel
+// position. A cluster then contributes one aggregate weight and one affine
+// displacement per side, however many lines it holds:
+//
+//     sum_i w_i D_i(x)  ~  (a + |x - c|)^-b * (D_c + J_c (x - c))
+//     sum_i w_i         ~  (a + |x - c|)^-b * S_c
+//
+// with S_c = sum_i |PQ_i|^(p b) and D_c, J_c the correspondingly weighted
+// sums of the lines' displacements at the cluster center c and of their
+// Jacobians. Lines of clusters that are too close to a block of output are
+// evaluated exactly by the row kernels, and the two parts are merged.
+//
+// Accuracy: a cluster of radius r is used as a whole for a block when
+// r <= theta * d, d being the distance from the block to its center. Every
+// line of it is then within (1 +- theta) d, so the weight of a far line is
+// off by at most a factor (1 - theta)^-b, and by much less on average. With
+// theta = 0 every line is evaluated exactly and the result is that of the
+// direct kernel.
+//
+
+#ifndef __CLUSTERWARP_H__
+#define __CLUSTERWARP_H__
+
+#include "morphPlan.h"
+#include "warpSimd.h"
+
+#include <vector>
+
+// Default opening criterion: largest cluster radius over distance.
+const float kDefaultClusterTheta = 0.25f;
+
+// Most lines in a leaf cluster.
+const int kClusterLeafSize = 4;
+
+// Scratch space for FeatureClusters::EvaluateBlock(). Reusing one across
+// calls keeps its buffers allocated.
+class ClusterQuery
+{
+private:
+    friend class FeatureClusters;
+    std::vector<int> mStack;    // clusters still to be opened
+    std::vector<int> mNear;     // lines evaluated exactly
+    std::vector<int> mFar;      // clusters evaluated as a whole
+    FeatureLines mSource, mTarget;
+    MorphPlan mNearPlan;
+};
+
+class FeatureClusters
+{
+public:
+    FeatureClusters() : mPlan(0) { }
+    explicit FeatureClusters(const MorphPlan &plan);
+
+    // (Re)build the clusters from the interpolated lines of plan, which
+    // must outlive them.
+    void Build(const MorphPlan &plan);
+
+    // Computes where the width x height pixels starting at (x0, y0) map to
+    // under the plan's source lines and, if targetX is not NULL, its target
+    // lines, storing them row by row with a stride of width; width is at
+    // most 256. The near lines are evaluated with fieldRow. Returns the
+    // number of clusters used as a whole.
+    int EvaluateBlock(FieldRowWeightedKernel fieldRow, float theta,
+                      int x0, int y0, int width, int height,
+                      float *sourceX, float *sourceY, float *targetX, float *targetY,
+                      ClusterQuery &query) const;
+
+    int GetClusterCount() const { return (int)mClusters.size(); }
+
+private:
+    // Aggregate of the lines mOrder[first, first+count).
+    struct Cluster
+    {
+        float cx, cy;               // center, weighted by |PQ|^(p b)
+        float radius;               // farthest line endpoint from the center
+        float weight;               // S: sum of |PQ|^(p b)
+        float source[6];            // D_c.x, D_c.y, J_c row by row, source side
+        float target[6];            // same for the target side
+        int first, count;
+        int left;                   // children left, left+1; -1 for leaves
+    };
+
+    void BuildCluster(int index, int first, int count);
+
+    template <bool kBothSides, class Weight>
+    void AddFarField(const std::vector<int> &far, int x0, int y, int count,
+                     float *sourceX, float *sourceY, float *targetX, float *targetY,
+                     float *weightSums) const;
+
+    const MorphPlan *mPlan;
+    std::vector<Cluster> mClusters;
+    std::vector<int> mOrder;
+    std::vector<float> mScale;              // |PQ|^(p b) per line
+    std::vector<float> mMidX, mMidY;        // line midpoints, for splitting
+};
+
+#endif // __CLUSTERWARP_H__
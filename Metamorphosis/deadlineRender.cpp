@@ -0,0 +1,180 @@
+// --------------------------------------------------------------------------
+// deadlineRender.cpp
+//
+// Quality ladder and cost bookkeeping of deadline-bounded rendering.
+//
+
+#include "deadlineRender.h"
+#include "progressiveMorph.h"
+#include "STImage.h"
+#include "STTimer.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+// Weight of the latest frame in the per-pixel cost of a level.
+const float kCostSmoothing = 0.5f;
+
+// A coarse grid level evaluates about three times the points of the one
+// before it; the factor also covers sampling four times the pixels.
+const float kCoarseLevelGrowth = 4.f;
+
+const char *GetRenderQualityName(RenderQuality quality)
+{
+    switch (quality) {
+        case QUALITY_FULL:    return "full";
+        case QUALITY_NEAREST: return "nearest";
+        case QUALITY_CULLED:  return "culled";
+        case QUALITY_COARSE:  return "coarse";
+        default:              break;
+    }
+    return "unknown";
+}
+
+/**
+ * Options of a full resolution quality level, derived from the caller's.
+ */
+static MorphOptions GetQualityOptions(RenderQuality quality, const MorphOptions &options)
+{
+    MorphOptions result = options;
+    if (quality == QUALITY_NEAREST || quality == QUALITY_CULLED)
+        result.filter = FILTER_NEAREST;
+    if (quality == QUALITY_CULLED) {
+        result.engine = WARP_CLUSTER;
+        result.theta = std::max(options.theta, kDeadlineTheta);
+    }
+    return result;
+}
+
+/**
+ * Fills result with the pixels of a level image scaled up by replication.
+ */
+static void ReplicateLevel(const STImage *level, int scale, STImage *result)
+{
+    const PackedPixel *levelPixels = (const PackedPixel *)level->GetPixels();
+    PackedPixel *pixels = (PackedPixel *)result->GetPixels();
+    int width = result->GetWidth(), height = result->GetHeight();
+    int levelWidth = level->GetWidth();
+    for (int y = 0; y < height; y++) {
+        const PackedPixel *levelRow = levelPixels + (y / scale) * levelWidth;
+        PackedPixel *row = pixels + y * width;
+        for (int x = 0; x < width; x++)
+            row[x] = levelRow[x / scale];
+    }
+}
+
+/**
+ * Whether the coarse grid levels, which evaluate the field exactly with the
+ * options' kernels and sample bilinearly, cost at least as much per pixel as
+ * a full resolution level with the given options, so that their cost is a
+ * safe guess for it.
+ */
+static bool CoarseCostBounds(const MorphOptions &options)
+{
+    return options.filter <= FILTER_BILINEAR && options.engine != WARP_SCANLINE;
+}
+
+DeadlineRenderer::DeadlineRenderer()
+{
+    for (int i = 0; i < QUALITY_COARSE; i++) {
+        mMillisPerPixel[i] = -1.f;
+        mMeasured[i] = false;
+        mPassedOver[i] = 0;
+        mProbeFrames[i] = kDeadlineProbeFrames;
+    }
+}
+
+float DeadlineRenderer::GetExpectedMillis(RenderQuality quality, int width, int height) const
+{
+    if (quality >= QUALITY_COARSE || mMillisPerPixel[quality] < 0)
+        return -1.f;
+    return mMillisPerPixel[quality] * (float)((double)width * height);
+}
+
+void DeadlineRenderer::Record(RenderQuality quality, float millis, double pixels, bool probe,
+                              float budgetMillis)
+{
+    // a probed level has not been used for a while, so its old cost is
+    // dropped rather than smoothed
+    float cost = (float)(millis / std::max(pixels, 1.0));
+    float &current = mMillisPerPixel[quality];
+    current = mMeasured[quality] && !probe ? current + kCostSmoothing * (cost - current) : cost;
+    mMeasured[quality] = true;
+
+    mPassedOver[quality] = 0;
+    if (millis <= budgetMillis)
+        mProbeFrames[quality] = kDeadlineProbeFrames;
+    else
+        mProbeFrames[quality] = std::min(2 * mProbeFrames[quality], kDeadlineMaxProbeFrames);
+}
+
+DeadlineReport DeadlineRenderer::Render(const MorphPlan &plan, const PaddedImage &sourceImage,
+                                        const PaddedImage &targetImage, STImage *result,
+                                        const MorphOptions &options, float budgetMillis)
+{
+    STTimer timer;
+    timer.Reset();
+    int width = result->GetWidth(), height = result->GetHeight();
+    double pixels = (double)width * height;
+    DeadlineReport report;
+
+    // the best full resolution level expected to fit, or the one above it
+    // once that has been passed over long enough to be probed
+    int picked = QUALITY_COARSE;
+    for (int i = QUALITY_FULL; i < QUALITY_COARSE; i++) {
+        float expected = GetExpectedMillis((RenderQuality)i, width, height);
+        if (expected >= 0 && expected <= kDeadlineMargin * budgetMillis) {
+            picked = i;
+            break;
+        }
+    }
+    bool probe = picked > QUALITY_FULL && mPassedOver[picked - 1] >= mProbeFrames[picked - 1];
+    if (probe)
+        picked--;
+    for (int i = QUALITY_FULL; i < picked; i++)
+        mPassedOver[i] = std::min(mPassedOver[i] + 1, kDeadlineMaxProbeFrames);
+
+    if (picked < QUALITY_COARSE) {
+        RenderQuality quality = (RenderQuality)picked;
+        FusedMorph(plan, sourceImage, targetImage, result, GetQualityOptions(quality, options));
+        report.quality = quality;
+        report.millis = timer.GetElapsedMillis();
+        Record(quality, report.millis, pixels, probe, budgetMillis);
+        return report;
+    }
+
+    if (width != std::min(sourceImage.GetWidth(), targetImage.GetWidth()) ||
+        height != std::min(sourceImage.GetHeight(), targetImage.GetHeight()))
+        throw std::runtime_error("DeadlineRenderer result has the wrong size");
+
+    // refine the coarse grid while the next level is expected to fit; the
+    // full resolution level is left to the levels above
+    ProgressiveMorph preview(plan, sourceImage, targetImage, options);
+    STImage *level = preview.RenderNextLevel();
+    float levelMillis = timer.GetElapsedMillis();
+    while (preview.GetScale() > 2) {
+        float elapsed = timer.GetElapsedMillis();
+        if (elapsed + kCoarseLevelGrowth * levelMillis > kDeadlineMargin * budgetMillis)
+            break;
+        level = preview.RenderNextLevel();
+        levelMillis = timer.GetElapsedMillis() - elapsed;
+    }
+    ReplicateLevel(level, preview.GetScale(), result);
+
+    report.quality = QUALITY_COARSE;
+    report.scale = preview.GetScale();
+    report.millis = timer.GetElapsedMillis();
+
+    // until the full resolution levels have been measured, guess their cost
+    // per pixel from that of the finest coarse level where that is no
+    // underestimate; the others are left to be probed. A fresh guess needs
+    // no probe.
+    float guess = (float)(levelMillis / ((double)level->GetWidth() * level->GetHeight()));
+    for (int i = QUALITY_FULL; i < QUALITY_COARSE; i++) {
+        if (!mMeasured[i] && CoarseCostBounds(GetQualityOptions((RenderQuality)i, options))) {
+            mMillisPerPixel[i] = guess;
+            mPassedOver[i] = 0;
+        }
+    }
+    return report;
+}
@@ -0,0 +1,113 @@
+// --------------------------------------------------------------------------
+// deadlineRender.h
+//
+// Renders morph frames within a time budget. The frame is rendered at the
+// best of a ladder of quality levels that is expected to fit the budget:
+//
+//     QUALITY_FULL        the caller's options
+//     QUALITY_NEAREST     nearest neighbor sampling instead of the filter
+//     QUALITY_CULLED      the same, with distant features merged into
+//                         clusters (WARP_CLUSTER at kDeadlineTheta)
+//     QUALITY_COARSE      the field evaluated on a coarser grid (see
+//                         progressiveMorph.h) and the pixels replicated
+//
+// Expectations come from the times of earlier frames, kept per level as a
+// cost per output pixel. Before a level has been used, its cost is guessed
+// from that of the finest coarse grid level rendered so far, but only for
+// levels that filter and evaluate the field no more expensively than the
+// coarse grid does (bilinearly, exactly); a level with a costlier filter or
+// engine stays unknown until it is probed. When no full resolution level
+// fits, the coarse grid is refined level by level for as long as the next
+// one is expected to finish in time, so even a budget that is much too
+// small yields a frame, at the coarsest grid. The first frame has nothing to
+// go by and always takes the coarse path.
+//
+// A level is only measured when it is used, so one slow frame could keep it
+// out for good. Once the level just above the one a frame is expected at
+// has been passed over for kDeadlineProbeFrames frames, that frame probes it
+// instead, and the probe's time replaces the stale cost; a level whose cost
+// the coarse path has just guessed is not probed. Each frame at a level that
+// overruns the budget doubles the wait before the level's next probe, up to
+// kDeadlineMaxProbeFrames, so a level that really is too slow costs one late
+// frame in that many.
+//
+
+#ifndef __DEADLINERENDER_H__
+#define __DEADLINERENDER_H__
+
+#include "morphEngine.h"
+
+class STImage;
+
+enum RenderQuality
+{
+    QUALITY_FULL,
+    QUALITY_NEAREST,
+    QUALITY_CULLED,
+    QUALITY_COARSE,
+    QUALITY_COUNT
+};
+
+// Printable name of a quality level ("full", "nearest", ...).
+const char *GetRenderQualityName(RenderQuality quality);
+
+// Cluster opening criterion of QUALITY_CULLED, coarser than the default.
+const float kDeadlineTheta = 0.5f;
+
+// Fraction of the budget a level is expected to take at most to be picked,
+// leaving room for the variation between frames.
+const float kDeadlineMargin = 0.85f;
+
+// Frames a level is passed over before it is probed again, at first and at
+// most (see above).
+const int kDeadlineProbeFrames = 16;
+const int kDeadlineMaxProbeFrames = 256;
+
+// What a deadline render achieved.
+struct DeadlineReport
+{
+    RenderQuality quality;  // level the frame was rendered at
+    int scale;              // QUALITY_COARSE grid spacing; 1 otherwise
+    float millis;           // time the frame took
+
+    DeadlineReport() : quality(QUALITY_FULL), scale(1), millis(0) { }
+};
+
+class DeadlineRenderer
+{
+public:
+    DeadlineRenderer();
+
+    //
+    // Renders the morph described by plan into result, which must have the
+    // size of the smaller input, at the best quality level expected to take
+    // at most budgetMillis. Threading, kernels, engine and filter of
+    // QUALITY_FULL come from options. Throws std::runtime_error like
+    // FusedMorph() for a result of the wrong size.
+    //
+    DeadlineReport Render(const MorphPlan &plan, const PaddedImage &sourceImage,
+                          const PaddedImage &targetImage, STImage *result,
+                          const MorphOptions &options, float budgetMillis);
+
+    //
+    // Expected time, in milliseconds, of a frame of the given size at a full
+    // resolution quality level, or a negative value while nothing is known.
+    //
+    float GetExpectedMillis(RenderQuality quality, int width, int height) const;
+
+private:
+    void Record(RenderQuality quality, float millis, double pixels, bool probe,
+                float budgetMillis);
+
+    // cost of the full resolution levels; guessed from the coarse levels
+    // until a frame has been rendered at the level
+    float mMillisPerPixel[QUALITY_COARSE];
+    bool mMeasured[QUALITY_COARSE];
+
+    // frames rendered below each level since it was last used, and how many
+    // of them it waits before it is probed
+    int mPassedOver[QUALITY_COARSE];
+    int mProbeFrames[QUALITY_COARSE];
+};
+
+#endif // __DEADLINERENDER_H__
@@ -0,0 +1,167 @@
+// --------------------------------------------------------------------------
+// displacementField.cpp
+//
+// Fixed point encoding and the file mapping of displacement fields.
+//
+
+#include "displacementField.h"
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+
+static const char kFieldMagic[4] = { 'M', 'F', 'L', 'D' };
+static const uint32_t kFieldByteOrder = 0x01020304;
+static const int32_t kFieldVersion = 1;
+
+DisplacementField::DisplacementField()
+    : mWidth(0), mHeight(0), mT(0), mFractionBits(0)
+    , mValues(NULL), mMapping(NULL), mMappingSize(0)
+{
+}
+
+DisplacementField::~DisplacementField()
+{
+    Unmap();
+}
+
+void DisplacementField::Unmap()
+{
+    if (mMapping)
+        munmap(mMapping, mMappingSize);
+    mMapping = NULL;
+    mMappingSize = 0;
+}
+
+void DisplacementField::Encode(int width, int height, float t,
+                               const std::vector<float> &positions)
+{
+    Unmap();
+    mWidth = width;
+    mHeight = height;
+    mT = t;
+
+    // the largest displacement decides the fraction bits
+    float largest = 0;
+    for (int y = 0; y < height; y++) {
+        const float *row = &positions[(size_t)y * 4 * width];
+        for (int side = 0; side < 4; side += 2) {
+            const float *xs = row + side * width, *ys = row + (side + 1) * width;
+            for (int x = 0; x < width; x++) {
+                largest = std::max(largest, fabsf(xs[x] - x));
+                largest = std::max(largest, fabsf(ys[x] - y));
+            }
+        }
+    }
+    mFractionBits = kMaxFieldFractionBits;
+    while (mFractionBits > 0 && largest * (1 << mFractionBits) > 32767)
+        mFractionBits--;
+
+    float scale = (float)(1 << mFractionBits);
+    mData.resize((size_t)4 * width * height);
+    for (int y = 0; y < height; y++) {
+        const float *row = &positions[(size_t)y * 4 * width];
+        int16_t *out = &mData[(size_t)y * 4 * width];
+        for (int c = 0; c < 4; c++) {
+            // x and y coordinates alternate
+            for (int x = 0; x < width; x++) {
+                float d = (row[c * width + x] - (float)((c & 1) ? y : x)) * scale;
+                d = std::min(std::max(d, -32767.f), 32767.f);
+                out[c * width + x] = (int16_t)lrintf(d);
+            }
+        }
+    }
+    mValues = mData.empty() ? NULL : &mData[0];
+}
+
+bool DisplacementField::Load(const std::string &filename)
+{
+    Unmap();
+    mData.clear();
+    mValues = NULL;
+    mWidth = mHeight = 0;
+
+    int file = open(filename.c_str(), O_RDONLY);
+    if (file < 0)
+        return false;
+    struct stat status;
+    void *mapping = MAP_FAILED;
+    if (fstat(file, &status) == 0 && (size_t)status.st_size >= sizeof(Header))
+        mapping = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, file, 0);
+    close(file);
+    if (mapping == MAP_FAILED)
+        return false;
+
+    const Header *header = (const Header *)mapping;
+    size_t size = status.st_size;
+    if (memcmp(header->magic, kFieldMagic, 4) != 0 || header->byteOrder != kFieldByteOrder ||
+        header->version != kFieldVersion || header->width < 0 || header->height < 0 ||
+        header->fractionBits < 0 || header->fractionBits > kMaxFieldFractionBits ||
+        size != sizeof(Header) + (size_t)4 * header->width * header->height * sizeof(int16_t)) {
+        munmap(mapping, size);
+        return false;
+    }
+
+    mMapping = mapping;
+    mMappingSize = size;
+    mWidth = header->width;
+    mHeight = header->height;
+    mT = header->t;
+    mFractionBits = header->fractionBits;
+    mValues = (const int16_t *)(header + 1);
+    return true;
+}
+
+bool DisplacementField::Save(const std::string &filename) const
+{
+    Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kFieldMagic, 4);
+    header.byteOrder = kFieldByteOrder;
+    header.version = kFieldVersion;
+    header.width = mWidth;
+    header.height = mHeight;
+    header.fractionBits = mFractionBits;
+    header.t = mT;
+
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%d.tmp", (int)getpid());
+    std::string temporary = filename + suffix;
+    FILE *file = fopen(temporary.c_str(), "wb");
+    if (!file)
+        return false;
+    size_t count = (size_t)4 * mWidth * mHeight;
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              (count == 0 || fwrite(mValues, sizeof(int16_t), count, file) == count);
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(temporary.c_str(), filename.c_str()) != 0) {
+        unlink(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+void DisplacementField::Decode(int x, int y, int count, float *sourceX, float *sourceY,
+                               float *targetX, float *targetY) const
+{
+    const int16_t *row = GetRow(y) + x;
+    float step = 1.f / (1 << mFractionBits);
+    float fy = (float)y;
+    for (int i = 0; i < count; i++) {
+        float fx = (float)(x + i);
+        sourceX[i] = fx + row[i] * step;
+        sourceY[i] = fy + row[mWidth + i] * step;
+    }
+    if (!targetX)
+        return;
+    for (int i = 0; i < count; i++) {
+        float fx = (float)(x + i);
+        targetX[i] = fx + row[2 * mWidth + i] * step;
+        targetY[i] = fy + row[3 * mWidth + i] * step;
+    }
+}
@@ -0,0 +1,102 @@
+// --------------------------------------------------------------------------
+// displacementField.h
+//
+// The mapped positions of a field morph frame, stored on their own. They
+// depend only on the features, t, a, b, p and the engine, not on any
+// pixels, so a batch that morphs many image pairs through one feature
+// template can compute each frame's field once (see ComputeField() in
+// morphEngine.h), keep it on disk, and only run the sampling pass for
+// every pair.
+//
+// Each output pixel (x, y) has a source-side position (x + sx, y + sy) and
+// a target-side position (x + tx, y + ty). The displacements are stored as
+// 16-bit fixed point with the most fraction bits (up to
+// kMaxFieldFractionBits) that fit the largest one of the frame; at the
+// displacements of typical morphs that is 1/128 of a pixel or finer. Row y
+// holds the sx, sy, tx and ty of its pixels one after the other.
+//
+// The file format is a 32-byte header followed by the rows, in the byte
+// order of the machine that wrote it, so that a loaded field is simply a
+// read-only mapping of the file.
+//
+
+#ifndef __DISPLACEMENTFIELD_H__
+#define __DISPLACEMENTFIELD_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Finest fixed point step of the displacements, 1 / 2^kMaxFieldFractionBits
+// pixels.
+const int kMaxFieldFractionBits = 8;
+
+class DisplacementField
+{
+public:
+    DisplacementField();
+
+    // Unmaps the file, if the field was loaded.
+    ~DisplacementField();
+
+    //
+    // Encodes the positions of a width x height frame at parameter t,
+    // given per row as width source x, source y, target x and target y
+    // coordinates one after the other.
+    //
+    void Encode(int width, int height, float t, const std::vector<float> &positions);
+
+    //
+    // Maps the field saved in filename. Returns false, leaving the field
+    // empty, if the file is missing or is not a field written on a machine
+    // of the same byte order.
+    //
+    bool Load(const std::string &filename);
+
+    //
+    // Writes the field to filename, atomically: the file is written under
+    // a temporary name and renamed. Returns false on any error.
+    //
+    bool Save(const std::string &filename) const;
+
+    int GetWidth() const { return mWidth; }
+    int GetHeight() const { return mHeight; }
+    float GetT() const { return mT; }
+    int GetFractionBits() const { return mFractionBits; }
+
+    //
+    // Positions of the count pixels starting at (x, y). targetX and
+    // targetY may be NULL to decode the source side only.
+    //
+    void Decode(int x, int y, int count, float *sourceX, float *sourceY,
+                float *targetX, float *targetY) const;
+
+private:
+    struct Header
+    {
+        char magic[4];          // "MFLD"
+        uint32_t byteOrder;     // kFieldByteOrder as written
+        int32_t version;
+        int32_t width, height;
+        int32_t fractionBits;
+        float t;
+        int32_t reserved;
+    };
+
+    void Unmap();
+    const int16_t *GetRow(int y) const { return mValues + (size_t)y * 4 * mWidth; }
+
+    int mWidth, mHeight;
+    float mT;
+    int mFractionBits;
+    const int16_t *mValues;         // mData, or the rows of the mapping
+    std::vector<int16_t> mData;     // an encoded field
+    void *mMapping;                 // a loaded field
+    size_t mMappingSize;
+
+    // not copyable
+    DisplacementField(const DisplacementField &);
+    DisplacementField &operator=(const DisplacementField &);
+};
+
+#endif // __DISPLACEMENTFIELD_H__
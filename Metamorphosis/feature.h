@@ -0,0 +1,24 @@
+// --------------------------------------------------------------------------
+// feature.h
+//
+// Defines the Feature type shared by morph.cpp and the morph engines.
+//
+
+#ifndef __FEATURE_H__
+#define __FEATURE_H__
+
+#include "STPoint2.h"
+
+// --------------------------------------------------------------------------
+// Structure to contain an image feature for a morph. A feature is a directed
+// line segment from P to Q, with coordinates in pixel units relative to the
+// lower-left corner of the image.
+// --------------------------------------------------------------------------
+
+struct Feature
+{
+    STPoint2 P, Q;
+    Feature(const STPoint2 &p, const STPoint2 &q) : P(p), Q(q) { }
+};
+
+#endif // __FEATURE_H__
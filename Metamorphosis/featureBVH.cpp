@@ -0,0 +1,205 @@
+// --------------------------------------------------------------------------
+// featureBVH.cpp
+//
+// Construction and culling queries of the feature line hierarchy.
+//
+
+#include "featureBVH.h"
+#include "morphPlan.h"
+
+#include <math.h>
+#include <algorithm>
+
+/**
+ * Weight of a line with the given |PQ|^p at distance dist. Only ever larger
+ * for smaller distances or larger |PQ|^p, as long as b is not negative.
+ */
+static inline float BoundWeight(float lengthPowP, float dist, float a, float b)
+{
+    float base = lengthPowP / (a + dist);
+    if (b == 1.f) return base;
+    if (b == 2.f) return base * base;
+    return powf(base, b);
+}
+
+/**
+ * Shortest distance between the boxes [x0,x1] x [y0,y1] and
+ * [minX,maxX] x [minY,maxY].
+ */
+static inline float BoxDistance(float x0, float y0, float x1, float y1,
+                                float minX, float minY, float maxX, float maxY)
+{
+    float dx = std::max(0.f, std::max(minX - x1, x0 - maxX));
+    float dy = std::max(0.f, std::max(minY - y1, y0 - maxY));
+    return sqrtf(dx*dx + dy*dy);
+}
+
+// Orders line indices by their midpoint along one axis.
+struct MidpointLess
+{
+    const float *mMid;
+
+    explicit MidpointLess(const float *mid) : mMid(mid) { }
+    bool operator()(int i, int j) const { return mMid[i] < mMid[j]; }
+};
+
+FeatureBVH::FeatureBVH(const MorphPlan &plan)
+    : mPlan(0)
+{
+    Build(plan);
+}
+
+void FeatureBVH::Build(const MorphPlan &plan)
+{
+    mPlan = &plan;
+    int n = plan.GetCount();
+    mOrder.resize(n);
+    for (int i = 0; i < n; i++)
+        mOrder[i] = i;
+
+    const FeatureLines &lines = plan.lines;
+    mMidX.resize(n);
+    mMidY.resize(n);
+    for (int i = 0; i < n; i++) {
+        mMidX[i] = 0.5f * (lines.px[i] + lines.qx[i]);
+        mMidY[i] = 0.5f * (lines.py[i] + lines.qy[i]);
+    }
+
+    mNodes.clear();
+    if (n == 0)
+        return;
+    mNodes.reserve(2 * n);
+    mNodes.push_back(Node());
+    BuildNode(0, 0, n);
+}
+
+/**
+ * Fills in node index of mNodes for the lines
+ * mOrder[first, first+count), splitting them at the median midpoint along
+ * the longer side of their midpoints' bounds until at most kBvhLeafSize are
+ * left.
+ */
+void FeatureBVH::BuildNode(int index, int first, int count)
+{
+    const FeatureLines &lines = mPlan->lines;
+
+    Node node;
+    node.minX = node.minY = HUGE_VALF;
+    node.maxX = node.maxY = -HUGE_VALF;
+    node.maxLengthPowP = 0;
+    node.first = first;
+    node.count = count;
+    node.left = -1;
+
+    float midMinX = HUGE_VALF, midMinY = HUGE_VALF;
+    float midMaxX = -HUGE_VALF, midMaxY = -HUGE_VALF;
+    for (int i = first; i < first + count; i++) {
+        int k = mOrder[i];
+        node.minX = std::min(node.minX, std::min(lines.px[k], lines.qx[k]));
+        node.minY = std::min(node.minY, std::min(lines.py[k], lines.qy[k]));
+        node.maxX = std::max(node.maxX, std::max(lines.px[k], lines.qx[k]));
+        node.maxY = std::max(node.maxY, std::max(lines.py[k], lines.qy[k]));
+        node.maxLengthPowP = std::max(node.maxLengthPowP, mPlan->lengthPowP[k]);
+
+        midMinX = std::min(midMinX, mMidX[k]); midMaxX = std::max(midMaxX, mMidX[k]);
+        midMinY = std::min(midMinY, mMidY[k]); midMaxY = std::max(midMaxY, mMidY[k]);
+    }
+
+    if (count > kBvhLeafSize) {
+        bool splitX = midMaxX - midMinX >= midMaxY - midMinY;
+        int half = count / 2;
+        std::nth_element(mOrder.begin() + first, mOrder.begin() + first + half,
+                         mOrder.begin() + first + count,
+                         MidpointLess(splitX ? &mMidX[0] : &mMidY[0]));
+
+        // the children take two adjacent slots before either is filled in
+        node.left = (int)mNodes.size();
+        mNodes.push_back(Node());
+        mNodes.push_back(Node());
+        BuildNode(node.left, first, half);
+        BuildNode(node.left + 1, first + half, count - half);
+    }
+
+    mNodes[index] = node;
+}
+
+/**
+ * Upper bound on the summed weight of the lines below node at any pixel of
+ * the box [x0,x1] x [y0,y1].
+ */
+float FeatureBVH::NodeBound(const Node &node, float x0, float y0, float x1, float y1) const
+{
+    float dist = BoxDistance(x0, y0, x1, y1, node.minX, node.minY, node.maxX, node.maxY);
+    return node.count * BoundWeight(node.maxLengthPowP, dist, mPlan->a, mPlan->b);
+}
+
+int FeatureBVH::Cull(int x0, int y0, int x1, int y1, float epsilon, BvhQuery &query) const
+{
+    std::vector<int> &kept = query.indices;
+    std::vector<std::pair<float, int> > &queue = query.mQueue;
+    kept.clear();
+    queue.clear();
+    if (mNodes.empty())
+        return 0;
+
+    const FeatureLines &lines = mPlan->lines;
+    const float a = mPlan->a, b = mPlan->b;
+    const float bx0 = (float)x0, by0 = (float)y0, bx1 = (float)x1, by1 = (float)y1;
+    const float cornerX[4] = { bx0, bx1, bx0, bx1 };
+    const float cornerY[4] = { by0, by0, by1, by1 };
+
+    // a negative b makes weights grow with distance, and the bounds invalid
+    bool cull = epsilon > 0 && b >= 0;
+    float total = 0;        // lower bound on the weight of the kept lines
+    float skipped = 0;      // upper bound on the weight of the skipped lines
+
+    queue.push_back(std::make_pair(NodeBound(mNodes[0], bx0, by0, bx1, by1), 0));
+    while (!queue.empty()) {
+        std::pop_heap(queue.begin(), queue.end());
+        float bound = queue.back().first;
+        const Node &node = mNodes[queue.back().second];
+        queue.pop_back();
+
+        if (cull && skipped + bound <= epsilon * total) {
+            skipped += bound;
+            continue;
+        }
+
+        if (node.left >= 0) {
+            for (int c = node.left; c <= node.left + 1; c++) {
+                queue.push_back(std::make_pair(NodeBound(mNodes[c], bx0, by0, bx1, by1), c));
+                std::push_heap(queue.begin(), queue.end());
+            }
+            continue;
+        }
+
+        for (int i = node.first; i < node.first + node.count; i++) {
+            int k = mOrder[i];
+            float nearest = BoxDistance(bx0, by0, bx1, by1,
+                                        std::min(lines.px[k], lines.qx[k]),
+                                        std::min(lines.py[k], lines.qy[k]),
+                                        std::max(lines.px[k], lines.qx[k]),
+                                        std::max(lines.py[k], lines.qy[k]));
+            float upper = BoundWeight(mPlan->lengthPowP[k], nearest, a, b);
+            if (cull && skipped + upper <= epsilon * total) {
+                skipped += upper;
+                continue;
+            }
+
+            // the distance to a segment is convex, so it peaks at a corner of
+            // the block, and is at most the distance to the nearer endpoint
+            float farthest = 0;
+            for (int c = 0; c < 4; c++) {
+                float ex = cornerX[c] - lines.px[k], ey = cornerY[c] - lines.py[k];
+                float fx = cornerX[c] - lines.qx[k], fy = cornerY[c] - lines.qy[k];
+                float dist = sqrtf(std::min(ex*ex + ey*ey, fx*fx + fy*fy));
+                farthest = std::max(farthest, dist);
+            }
+            total += BoundWeight(mPlan->lengthPowP[k], farthest, a, b);
+            kept.push_back(k);
+        }
+    }
+
+    std::sort(kept.begin(), kept.end());
+    return (int)kept.size();
+}
@@ -0,0 +1,83 @@
+// --------------------------------------------------------------------------
+// featureBVH.h
+//
+// Bounding volume hierarchy over the interpolated feature lines of a frame,
+// used to cull the features whose weight is negligible over a block of
+// output pixels. The weight (|PQ|^p / (a + dist))^b only falls with the
+// distance, so a box around a group of lines bounds the weight of every line
+// in it at every pixel of the block: the group's largest |PQ|^p over a plus
+// the gap between the block and the box. Groups are visited largest bound
+// first while a lower bound on the total weight at the block accumulates; a
+// group is skipped when its bound, added to everything skipped before it,
+// stays within epsilon times that lower bound.
+//
+// Error bound: at every pixel of a block the skipped features carry at most
+// epsilon of the total weight, so a mapped position moves by at most epsilon
+// times the largest difference between a skipped feature's displacement and
+// the weighted mean of the kept ones; e.g. 0.1 pixel for epsilon = 1e-3 and
+// displacements that differ by 100 pixels. With epsilon = 0 nothing is
+// skipped and the result is that of the direct kernel.
+//
+
+#ifndef __FEATUREBVH_H__
+#define __FEATUREBVH_H__
+
+#include <utility>
+#include <vector>
+
+struct MorphPlan;
+
+// Default fraction of the total weight the culled features may carry.
+const float kDefaultCullEpsilon = 1e-3f;
+
+// Most features in a leaf of the hierarchy.
+const int kBvhLeafSize = 4;
+
+// Scratch space for FeatureBVH::Cull(). Reusing one query across calls
+// keeps its buffers allocated.
+class BvhQuery
+{
+public:
+    std::vector<int> indices;   // features kept by the last Cull(), ascending
+
+private:
+    friend class FeatureBVH;
+    std::vector<std::pair<float, int> > mQueue;     // (weight bound, node)
+};
+
+class FeatureBVH
+{
+public:
+    FeatureBVH() : mPlan(0) { }
+    explicit FeatureBVH(const MorphPlan &plan);
+
+    // (Re)build the hierarchy over the interpolated lines of plan, which
+    // must outlive it.
+    void Build(const MorphPlan &plan);
+
+    // Collects in query.indices the features whose weight can exceed the
+    // epsilon bound anywhere in the pixels [x0,x1] x [y0,y1] (inclusive)
+    // and returns their number.
+    int Cull(int x0, int y0, int x1, int y1, float epsilon, BvhQuery &query) const;
+
+    int GetNodeCount() const { return (int)mNodes.size(); }
+
+private:
+    struct Node
+    {
+        float minX, minY, maxX, maxY;   // bounds of the lines below
+        float maxLengthPowP;            // largest |PQ|^p below
+        int first, count;               // lines mOrder[first, first+count)
+        int left;                       // children left, left+1; -1 for leaves
+    };
+
+    void BuildNode(int index, int first, int count);
+    float NodeBound(const Node &node, float x0, float y0, float x1, float y1) const;
+
+    const MorphPlan *mPlan;
+    std::vector<Node> mNodes;
+    std::vector<int> mOrder;
+    std::vector<float> mMidX, mMidY;    // line midpoints, for splitting
+};
+
+#endif // __FEATUREBVH_H__
@@ -0,0 +1,356 @@
+// --------------------------------------------------------------------------
+// frameCache.cpp
+//
+// Frame keys and the least recently used bookkeeping of the frame cache.
+//
+
+#include "frameCache.h"
+#include "morphEngine.h"
+#include "STImage.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+#include <algorithm>
+#include <stdexcept>
+
+// the low half is 64-bit FNV-1a; the high half multiplies by the golden
+// ratio and rotates, so the two halves do not collide together
+static const uint64_t kFnvOffset = 14695981039346656037ULL;
+static const uint64_t kFnvPrime = 1099511628211ULL;
+static const uint64_t kGoldenRatio = 0x9E3779B97F4A7C15ULL;
+
+static const int kCopyBufferSize = 64 * 1024;
+
+FrameKey::FrameKey()
+    : mLow(kFnvOffset), mHigh(kGoldenRatio)
+{
+}
+
+void FrameKey::Add(const void *data, size_t bytes)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    uint64_t low = mLow, high = mHigh;
+    for (size_t i = 0; i < bytes; i++) {
+        low = (low ^ p[i]) * kFnvPrime;
+        high = (high + p[i] + 1) * kGoldenRatio;
+        high = (high << 23) | (high >> 41);
+    }
+    mLow = low;
+    mHigh = high;
+}
+
+std::string FrameKey::GetString() const
+{
+    char text[33];
+    snprintf(text, sizeof(text), "%016llx%016llx",
+             (unsigned long long)mHigh, (unsigned long long)mLow);
+    return text;
+}
+
+static void AddImage(FrameKey &key, const STImage *image)
+{
+    key.Add(image->GetWidth());
+    key.Add(image->GetHeight());
+    key.Add(image->GetPixels(),
+            sizeof(STImage::Pixel) * image->GetWidth() * image->GetHeight());
+}
+
+static void AddFeatures(FrameKey &key, const std::vector<Feature> &features)
+{
+    key.Add((int)features.size());
+    for (size_t i = 0; i < features.size(); i++) {
+        key.Add(features[i].P.x);
+        key.Add(features[i].P.y);
+        key.Add(features[i].Q.x);
+        key.Add(features[i].Q.y);
+    }
+}
+
+FrameKey GetFieldKey(const std::vector<Feature> &sourceFeatures,
+                     const std::vector<Feature> &targetFeatures, int width, int height,
+                     float a, float b, float p, const MorphOptions &options)
+{
+    FrameKey key;
+    key.Add(kMorphEngineVersion);
+    key.Add(width);
+    key.Add(height);
+    AddFeatures(key, sourceFeatures);
+    AddFeatures(key, targetFeatures);
+    key.Add(a);
+    key.Add(b);
+    key.Add(p);
+
+    // the vector kernels round slightly differently, so the level in use
+    // counts too; each engine's own parameter only counts for that engine
+    key.Add((int)options.engine);
+    key.Add((int)SelectWarpKernels(options).level);
+    if (options.engine == WARP_ADAPTIVE)
+        key.Add(options.tolerance);
+    else if (options.engine == WARP_BVH)
+        key.Add(options.epsilon);
+    else if (options.engine == WARP_CLUSTER)
+        key.Add(options.theta);
+    return key;
+}
+
+FrameKey GetMorphKey(const STImage *sourceImage, const std::vector<Feature> &sourceFeatures,
+                     const STImage *targetImage, const std::vector<Feature> &targetFeatures,
+                     float a, float b, float p, const MorphOptions &options)
+{
+    FrameKey key = GetFieldKey(sourceFeatures, targetFeatures,
+                               std::min(sourceImage->GetWidth(), targetImage->GetWidth()),
+                               std::min(sourceImage->GetHeight(), targetImage->GetHeight()),
+                               a, b, p, options);
+    AddImage(key, sourceImage);
+    AddImage(key, targetImage);
+    key.Add((int)options.filter);
+    return key;
+}
+
+/**
+ * Copies the file from to the file to. Returns false on any error.
+ */
+static bool CopyFile(const std::string &from, const std::string &to)
+{
+    FILE *in = fopen(from.c_str(), "rb");
+    if (!in)
+        return false;
+    FILE *out = fopen(to.c_str(), "wb");
+    if (!out) {
+        fclose(in);
+        return false;
+    }
+
+    std::vector<char> buffer(kCopyBufferSize);
+    bool ok = true;
+    size_t count;
+    while (ok && (count = fread(&buffer[0], 1, buffer.size(), in)) > 0)
+        ok = fwrite(&buffer[0], 1, count, out) == count;
+    ok = ok && !ferror(in);
+    fclose(in);
+    return fclose(out) == 0 && ok;
+}
+
+/**
+ * Whether name is that of a cache entry: 32 hex digits and ".png".
+ */
+static bool IsEntryName(const std::string &name)
+{
+    if (name.size() != 36 || name.compare(32, 4, ".png") != 0)
+        return false;
+    for (int i = 0; i < 32; i++) {
+        if (!isxdigit((unsigned char)name[i]))
+            return false;
+    }
+    return true;
+}
+
+FrameCache::FrameCache(const std::string &directory, long long maxBytes, int maxEntries)
+    : mDirectory(directory)
+    , mMaxBytes(maxBytes)
+    , mMaxEntries(maxEntries)
+    , mClock(0)
+    , mBytes(0)
+    , mHits(0)
+    , mMisses(0)
+    , mEvictions(0)
+{
+    if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "FrameCache::FrameCache() - Could not create \"%s\".\n",
+                directory.c_str());
+        throw std::runtime_error("Error creating FrameCache");
+    }
+    pthread_mutex_init(&mLock, NULL);
+    Load();
+    Trim();
+}
+
+FrameCache::~FrameCache()
+{
+    pthread_mutex_destroy(&mLock);
+}
+
+std::string FrameCache::GetPath(const std::string &key) const
+{
+    return mDirectory + "/" + key + ".png";
+}
+
+/**
+ * Indexes the entries already in the directory, ordered by modification
+ * time, i.e. by when they were last stored or hit.
+ */
+void FrameCache::Load()
+{
+    DIR *dir = opendir(mDirectory.c_str());
+    if (!dir) {
+        fprintf(stderr, "FrameCache::Load() - Could not read \"%s\".\n", mDirectory.c_str());
+        throw std::runtime_error("Error reading FrameCache");
+    }
+
+    std::vector<std::pair<time_t, std::string> > found;
+    struct dirent *item;
+    while ((item = readdir(dir)) != NULL) {
+        std::string name = item->d_name;
+        struct stat status;
+        if (IsEntryName(name) && stat((mDirectory + "/" + name).c_str(), &status) == 0) {
+            found.push_back(std::make_pair(status.st_mtime, name.substr(0, 32)));
+            mEntries[name.substr(0, 32)].bytes = status.st_size;
+        }
+    }
+    closedir(dir);
+
+    std::sort(found.begin(), found.end());
+    for (size_t i = 0; i < found.size(); i++) {
+        EntryMap::iterator entry = mEntries.find(found[i].second);
+        entry->second.lastUse = mClock;
+        mOrder[mClock++] = entry->first;
+        mBytes += entry->second.bytes;
+    }
+}
+
+/**
+ * Makes entry the most recently used one. Called with the lock held.
+ */
+void FrameCache::Touch(EntryMap::iterator entry)
+{
+    mOrder.erase(entry->second.lastUse);
+    entry->second.lastUse = mClock;
+    mOrder[mClock++] = entry->first;
+}
+
+/**
+ * Deletes entry from the index and from disk. Called with the lock held.
+ */
+void FrameCache::Remove(EntryMap::iterator entry)
+{
+    unlink(GetPath(entry->first).c_str());
+    mBytes -= entry->second.bytes;
+    mOrder.erase(entry->second.lastUse);
+    mEntries.erase(entry);
+}
+
+/**
+ * Evicts least recently used entries until the cache is within its limits.
+ * Called with the lock held, or before other threads can use the cache.
+ */
+void FrameCache::Trim()
+{
+    while (!mOrder.empty() &&
+           (mBytes > mMaxBytes || (int)mEntries.size() > mMaxEntries)) {
+        Remove(mEntries.find(mOrder.begin()->second));
+        mEvictions++;
+    }
+}
+
+bool FrameCache::Fetch(const std::string &key, const std::string &filename)
+{
+    pthread_mutex_lock(&mLock);
+    EntryMap::iterator entry = mEntries.find(key);
+    bool found = entry != mEntries.end();
+    if (found)
+        Touch(entry);
+    else
+        mMisses++;
+    pthread_mutex_unlock(&mLock);
+    if (!found)
+        return false;
+
+    // copy outside of the lock; an entry that is gone or unreadable, e.g.
+    // evicted by another process sharing the directory, is a miss
+    std::string path = GetPath(key);
+    bool copied = CopyFile(path, filename);
+    if (copied)
+        utime(path.c_str(), NULL);
+
+    pthread_mutex_lock(&mLock);
+    if (copied) {
+        mHits++;
+    } else {
+        mMisses++;
+        entry = mEntries.find(key);
+        if (entry != mEntries.end())
+            Remove(entry);
+    }
+    pthread_mutex_unlock(&mLock);
+    return copied;
+}
+
+bool FrameCache::Store(const std::string &key, const std::string &filename)
+{
+    // copy to a temporary name first, so that an interrupted copy never
+    // leaves a truncated entry behind
+    pthread_mutex_lock(&mLock);
+    char suffix[48];
+    snprintf(suffix, sizeof(suffix), ".%d.%lu.tmp", (int)getpid(), mClock++);
+    pthread_mutex_unlock(&mLock);
+    std::string path = GetPath(key);
+    std::string temporary = path + suffix;
+
+    struct stat status;
+    if (!CopyFile(filename, temporary) || stat(temporary.c_str(), &status) != 0 ||
+        status.st_size > mMaxBytes || rename(temporary.c_str(), path.c_str()) != 0) {
+        unlink(temporary.c_str());
+        return false;
+    }
+
+    pthread_mutex_lock(&mLock);
+    EntryMap::iterator entry = mEntries.find(key);
+    if (entry != mEntries.end()) {
+        mBytes -= entry->second.bytes;
+    } else {
+        // a tick not in mOrder yet, which Touch() replaces with its own
+        entry = mEntries.insert(std::make_pair(key, Entry())).first;
+        entry->second.lastUse = mClock;
+    }
+    entry->second.bytes = status.st_size;
+    mBytes += status.st_size;
+    Touch(entry);
+    Trim();
+    pthread_mutex_unlock(&mLock);
+    return true;
+}
+
+int FrameCache::GetEntryCount() const
+{
+    pthread_mutex_lock(&mLock);
+    int count = (int)mEntries.size();
+    pthread_mutex_unlock(&mLock);
+    return count;
+}
+
+long long FrameCache::GetByteCount() const
+{
+    pthread_mutex_lock(&mLock);
+    long long bytes = mBytes;
+    pthread_mutex_unlock(&mLock);
+    return bytes;
+}
+
+int FrameCache::GetHitCount() const
+{
+    pthread_mutex_lock(&mLock);
+    int hits = mHits;
+    pthread_mutex_unlock(&mLock);
+    return hits;
+}
+
+int FrameCache::GetMissCount() const
+{
+    pthread_mutex_lock(&mLock);
+    int misses = mMisses;
+    pthread_mutex_unlock(&mLock);
+    return misses;
+}
+
+int FrameCache::GetEvictionCount() const
+{
+    pthread_mutex_lock(&mLock);
+    int evictions = mEvictions;
+    pthread_mutex_unlock(&mLock);
+    return evictions;
+}
@@ -0,0 +1,143 @@
+// --------------------------------------------------------------------------
+// frameCache.h
+//
+// Content-addressed on-disk cache of encoded morph frames. A frame is
+// identified by a hash of everything that determines its pixels: the
+// source and target pixels, both feature sets, t, a, b and p, the engine
+// settings that affect the output, and kMorphEngineVersion. Re-running a
+// sequence with, say, a different frame count only renders the frames
+// whose key is not cached yet; the others are copied from the cache, which
+// also skips their PNG encoding. Frames are stored as soon as they are
+// written, so an interrupted run resumes where it stopped.
+//
+// Entries are plain files named after their key in the cache directory.
+// The cache is bounded in bytes and in entries; past either limit the
+// least recently used entries are deleted. Recency survives between runs
+// through the entries' modification times, which a hit refreshes.
+//
+
+#ifndef __FRAMECACHE_H__
+#define __FRAMECACHE_H__
+
+#include "feature.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+class STImage;
+struct MorphOptions;
+
+// Default cache directory and limits.
+const char *const kFrameCacheDirectory = "framecache";
+const long long kDefaultCacheBytes = 256 << 20;
+const int kDefaultCacheEntries = 4096;
+
+// 128-bit hash of a sequence of values, built up with Add(). Not
+// cryptographic: it only needs to tell apart inputs that differ by
+// accident. Copying a key copies its state, so a common prefix can be
+// hashed once and extended per frame.
+class FrameKey
+{
+public:
+    FrameKey();
+
+    void Add(const void *data, size_t bytes);
+    void Add(int value) { Add(&value, sizeof(value)); }
+    void Add(float value) { Add(&value, sizeof(value)); }
+
+    // The 32 hex digits the cache files are named by.
+    std::string GetString() const;
+
+private:
+    uint64_t mLow, mHigh;
+};
+
+// Key of the part of a morph's displacement fields (see
+// displacementField.h) shared by all frames of a sequence: the output
+// size, the features, a, b and p, the settings of options that change the
+// field for its engine (not the threading, the tile size or the filter),
+// and kMorphEngineVersion. Add t for the key of a frame's field.
+FrameKey GetFieldKey(const std::vector<Feature> &sourceFeatures,
+                     const std::vector<Feature> &targetFeatures, int width, int height,
+                     float a, float b, float p, const MorphOptions &options);
+
+// Key of the part of a morph shared by all frames of a sequence: that of
+// its fields, plus the images' sizes and pixels and the filter. Add t for
+// the key of a frame.
+FrameKey GetMorphKey(const STImage *sourceImage, const std::vector<Feature> &sourceFeatures,
+                     const STImage *targetImage, const std::vector<Feature> &targetFeatures,
+                     float a, float b, float p, const MorphOptions &options);
+
+class FrameCache
+{
+public:
+    //
+    // Opens the cache in directory, creating the directory if needed, and
+    // trims it to at most maxBytes and maxEntries. Throws
+    // std::runtime_error if the directory cannot be created or read.
+    //
+    explicit FrameCache(const std::string &directory,
+                        long long maxBytes = kDefaultCacheBytes,
+                        int maxEntries = kDefaultCacheEntries);
+
+    ~FrameCache();
+
+    //
+    // Copies the entry of key to filename and marks it as recently used.
+    // Returns false, leaving filename alone, on a miss. May be called from
+    // any thread.
+    //
+    bool Fetch(const std::string &key, const std::string &filename);
+
+    //
+    // Adds a copy of the file filename as the entry of key, then evicts
+    // least recently used entries beyond the limits. Returns false if the
+    // file could not be copied or alone exceeds the byte limit. May be
+    // called from any thread.
+    //
+    bool Store(const std::string &key, const std::string &filename);
+
+    int GetEntryCount() const;
+    long long GetByteCount() const;
+
+    //
+    // Number of Fetch() calls that hit and missed, and of entries evicted.
+    //
+    int GetHitCount() const;
+    int GetMissCount() const;
+    int GetEvictionCount() const;
+
+private:
+    struct Entry
+    {
+        long long bytes;
+        unsigned long lastUse;  // position in mOrder
+    };
+    typedef std::map<std::string, Entry> EntryMap;
+
+    std::string GetPath(const std::string &key) const;
+    void Load();
+    void Touch(EntryMap::iterator entry);
+    void Remove(EntryMap::iterator entry);
+    void Trim();
+
+    std::string mDirectory;
+    long long mMaxBytes;
+    int mMaxEntries;
+
+    EntryMap mEntries;
+    std::map<unsigned long, std::string> mOrder;    // keys, least recent first
+    unsigned long mClock;
+    long long mBytes;
+    int mHits, mMisses, mEvictions;
+    mutable pthread_mutex_t mLock;
+
+    // not copyable
+    FrameCache(const FrameCache &);
+    FrameCache &operator=(const FrameCache &);
+};
+
+#endif // __FRAMECACHE_H__
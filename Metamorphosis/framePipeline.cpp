@@ -0,0 +1,104 @@
+// --------------------------------------------------------------------------
+// framePipeline.cpp
+//
+// Encoder threads for rendered frame sequences.
+//
+
+#include "framePipeline.h"
+#include "frameCache.h"
+#include "imagePool.h"
+#include "STImage.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <stdexcept>
+
+/**
+ * Each encoder holds one frame while it writes it, so the queue gets the
+ * rest of the in-flight budget (at least one slot).
+ */
+static int GetQueueCapacity(int numEncoders, int maxInFlight)
+{
+    numEncoders = std::max(numEncoders, 1);
+    return std::max(maxInFlight, numEncoders + 1) - numEncoders;
+}
+
+FramePipeline::FramePipeline(int numEncoders, int maxInFlight, ImagePool *pool,
+                             FrameCache *cache, const STImage::SaveOptions &saveOptions)
+    : mQueue(GetQueueCapacity(numEncoders, maxInFlight))
+    , mPool(pool)
+    , mCache(cache)
+    , mSaveOptions(saveOptions)
+    , mFinished(false)
+    , mFailures(0)
+{
+    pthread_mutex_init(&mLock, NULL);
+
+    mThreads.resize(std::max(numEncoders, 1));
+    for (size_t i = 0; i < mThreads.size(); i++) {
+        if (pthread_create(&mThreads[i], NULL, EncoderMain, this) != 0) {
+            fprintf(stderr, "FramePipeline::FramePipeline() - Could not start encoder %d.\n", (int)i);
+            throw std::runtime_error("Error creating FramePipeline");
+        }
+    }
+}
+
+FramePipeline::~FramePipeline()
+{
+    Finish();
+    pthread_mutex_destroy(&mLock);
+}
+
+void FramePipeline::Submit(STImage *image, const std::string &filename,
+                           const std::string &key)
+{
+    Frame frame;
+    frame.image = image;
+    frame.filename = filename;
+    frame.key = key;
+    if (!mQueue.Push(frame)) {
+        fprintf(stderr, "FramePipeline::Submit() - Pipeline already finished, dropping %s.\n",
+                filename.c_str());
+        Recycle(image);
+    }
+}
+
+int FramePipeline::Finish()
+{
+    if (!mFinished) {
+        mFinished = true;
+        mQueue.Close();
+        for (size_t i = 0; i < mThreads.size(); i++)
+            pthread_join(mThreads[i], NULL);
+    }
+    return mFailures;
+}
+
+void *FramePipeline::EncoderMain(void *arg)
+{
+    ((FramePipeline *)arg)->EncoderLoop();
+    return NULL;
+}
+
+void FramePipeline::EncoderLoop()
+{
+    Frame frame;
+    while (mQueue.Pop(frame)) {
+        if (frame.image->Save(frame.filename, mSaveOptions) != ST_OK) {
+            pthread_mutex_lock(&mLock);
+            mFailures++;
+            pthread_mutex_unlock(&mLock);
+        } else if (mCache && !frame.key.empty()) {
+            mCache->Store(frame.key, frame.filename);
+        }
+        Recycle(frame.image);
+    }
+}
+
+void FramePipeline::Recycle(STImage *image)
+{
+    if (mPool)
+        mPool->Release(image);
+    else
+        delete image;
+}
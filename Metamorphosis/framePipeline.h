@@ -0,0 +1,179 @@
+// --------------------------------------------------------------------------
+// framePipeline.h
+//
+// Overlaps rendering and encoding of a frame sequence. The renderer hands
+// each finished frame to a FramePipeline, which encodes and writes it on
+// its own threads while the next frame is being warped. Frames pass through
+// a bounded queue, so a renderer that outpaces the encoders blocks instead
+// of piling up frames in memory.
+//
+
+#ifndef __FRAMEPIPELINE_H__
+#define __FRAMEPIPELINE_H__
+
+#include "STImage.h"
+
+#include <pthread.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+class FrameCache;
+class ImagePool;
+class STImage;
+
+// A FIFO of at most capacity items shared between threads. Push() blocks
+// while the queue is full and Pop() while it is empty, until Close().
+template<class T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue(int capacity)
+        : mCapacity(capacity > 0 ? capacity : 1), mClosed(false)
+    {
+        pthread_mutex_init(&mLock, NULL);
+        pthread_cond_init(&mNotFull, NULL);
+        pthread_cond_init(&mNotEmpty, NULL);
+    }
+
+    ~BoundedQueue()
+    {
+        pthread_cond_destroy(&mNotEmpty);
+        pthread_cond_destroy(&mNotFull);
+        pthread_mutex_destroy(&mLock);
+    }
+
+    //
+    // Appends item, waiting for room first. Returns false (and drops
+    // nothing) if the queue has been closed.
+    //
+    bool Push(const T &item)
+    {
+        pthread_mutex_lock(&mLock);
+        while ((int)mItems.size() >= mCapacity && !mClosed)
+            pthread_cond_wait(&mNotFull, &mLock);
+        bool accepted = !mClosed;
+        if (accepted) {
+            mItems.push_back(item);
+            pthread_cond_signal(&mNotEmpty);
+        }
+        pthread_mutex_unlock(&mLock);
+        return accepted;
+    }
+
+    //
+    // Removes the oldest item into item, waiting for one first. Returns
+    // false once the queue is closed and drained.
+    //
+    bool Pop(T &item)
+    {
+        pthread_mutex_lock(&mLock);
+        while (mItems.empty() && !mClosed)
+            pthread_cond_wait(&mNotEmpty, &mLock);
+        bool popped = !mItems.empty();
+        if (popped) {
+            item = mItems.front();
+            mItems.pop_front();
+            pthread_cond_signal(&mNotFull);
+        }
+        pthread_mutex_unlock(&mLock);
+        return popped;
+    }
+
+    //
+    // Refuses further items and wakes all waiting threads. Items already
+    // queued can still be popped.
+    //
+    void Close()
+    {
+        pthread_mutex_lock(&mLock);
+        mClosed = true;
+        pthread_cond_broadcast(&mNotFull);
+        pthread_cond_broadcast(&mNotEmpty);
+        pthread_mutex_unlock(&mLock);
+    }
+
+private:
+    int mCapacity;
+    bool mClosed;
+    std::deque<T> mItems;
+    pthread_mutex_t mLock;
+    pthread_cond_t mNotFull;
+    pthread_cond_t mNotEmpty;
+
+    // not copyable
+    BoundedQueue(const BoundedQueue &);
+    BoundedQueue &operator=(const BoundedQueue &);
+};
+
+// Default number of encoder threads and cap on frames waiting for or being
+// encoded.
+const int kDefaultEncoders = 2;
+const int kDefaultMaxInFlight = 4;
+
+class FramePipeline
+{
+public:
+    //
+    // Start numEncoders threads (at least one) that save submitted frames.
+    // At most maxInFlight frames are queued or being encoded at any time;
+    // Submit() blocks beyond that. maxInFlight is raised to numEncoders + 1
+    // if it is smaller. Written frames are released to pool, or deleted if
+    // pool is NULL. Frames submitted with a key are also stored in cache,
+    // if there is one, once they are written. Every frame is saved with
+    // saveOptions, e.g. STImage::SAVE_FASTEST when encoding dominates.
+    //
+    explicit FramePipeline(int numEncoders = kDefaultEncoders,
+                           int maxInFlight = kDefaultMaxInFlight,
+                           ImagePool *pool = NULL, FrameCache *cache = NULL,
+                           const STImage::SaveOptions &saveOptions = STImage::SaveOptions());
+
+    //
+    // Finishes writing all submitted frames.
+    //
+    ~FramePipeline();
+
+    //
+    // Queues image to be saved to filename and takes ownership of it; the
+    // image is released (or deleted) once written. A non-empty key is the
+    // frame's key in the cache (see frameCache.h).
+    //
+    void Submit(STImage *image, const std::string &filename,
+                const std::string &key = std::string());
+
+    //
+    // Waits until every submitted frame is written and stops the encoders.
+    // Returns the number of frames that could not be saved.
+    //
+    int Finish();
+
+private:
+    struct Frame
+    {
+        STImage *image;
+        std::string filename;
+        std::string key;
+    };
+
+    static void *EncoderMain(void *arg);
+    void EncoderLoop();
+    void Recycle(STImage *image);
+
+    // Frames handed over by Submit(). Together with the one frame each
+    // encoder holds, this bounds the frames in flight.
+    BoundedQueue<Frame> mQueue;
+    std::vector<pthread_t> mThreads;
+    ImagePool *mPool;
+    FrameCache *mCache;
+    STImage::SaveOptions mSaveOptions;
+    bool mFinished;
+
+    pthread_mutex_t mLock;
+    int mFailures;
+
+    // not copyable
+    FramePipeline(const FramePipeline &);
+    FramePipeline &operator=(const FramePipeline &);
+};
+
+#endif // __FRAMEPIPELINE_H__
@@ -0,0 +1,77 @@
+// --------------------------------------------------------------------------
+// imagePool.cpp
+//
+// Size-keyed free lists of STImages.
+//
+
+#include "imagePool.h"
+#include "STImage.h"
+
+ImagePool::ImagePool(int maxIdle)
+    : mMaxIdle(maxIdle)
+    , mHits(0)
+    , mMisses(0)
+{
+    pthread_mutex_init(&mLock, NULL);
+}
+
+ImagePool::~ImagePool()
+{
+    for (IdleMap::iterator it = mIdle.begin(); it != mIdle.end(); ++it) {
+        for (size_t i = 0; i < it->second.size(); i++)
+            delete it->second[i];
+    }
+    pthread_mutex_destroy(&mLock);
+}
+
+STImage *ImagePool::Acquire(int width, int height)
+{
+    STImage *image = NULL;
+    pthread_mutex_lock(&mLock);
+    std::vector<STImage *> &idle = mIdle[Size(width, height)];
+    if (!idle.empty()) {
+        image = idle.back();
+        idle.pop_back();
+        mHits++;
+    } else {
+        mMisses++;
+    }
+    pthread_mutex_unlock(&mLock);
+
+    // allocate outside of the lock
+    if (!image)
+        image = new STImage(width, height);
+    return image;
+}
+
+void ImagePool::Release(STImage *image)
+{
+    if (!image)
+        return;
+
+    pthread_mutex_lock(&mLock);
+    std::vector<STImage *> &idle = mIdle[Size(image->GetWidth(), image->GetHeight())];
+    bool keep = (int)idle.size() < mMaxIdle;
+    if (keep)
+        idle.push_back(image);
+    pthread_mutex_unlock(&mLock);
+
+    if (!keep)
+        delete image;
+}
+
+int ImagePool::GetHitCount() const
+{
+    pthread_mutex_lock(&mLock);
+    int hits = mHits;
+    pthread_mutex_unlock(&mLock);
+    return hits;
+}
+
+int ImagePool::GetMissCount() const
+{
+    pthread_mutex_lock(&mLock);
+    int misses = mMisses;
+    pthread_mutex_unlock(&mLock);
+    return misses;
+}
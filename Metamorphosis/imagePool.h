@@ -0,0 +1,70 @@
+// --------------------------------------------------------------------------
+// imagePool.h
+//
+// Recycles frame-sized STImages. Rendering a sequence needs one image per
+// frame in flight, all of the same size; returning finished frames to a
+// pool lets the frame loop run in constant memory without allocating image
+// buffers once the pool has warmed up.
+//
+
+#ifndef __IMAGEPOOL_H__
+#define __IMAGEPOOL_H__
+
+#include <pthread.h>
+#include <map>
+#include <utility>
+#include <vector>
+
+class STImage;
+
+// Default number of idle images kept per size.
+const int kDefaultPooledImages = 8;
+
+class ImagePool
+{
+public:
+    //
+    // Create an empty pool that keeps up to maxIdle released images of
+    // each size.
+    //
+    explicit ImagePool(int maxIdle = kDefaultPooledImages);
+
+    //
+    // Deletes all idle images. Images still acquired are not affected and
+    // must be deleted by their owners.
+    //
+    ~ImagePool();
+
+    //
+    // An image of the given size, recycled if one has been released
+    // (a hit) or newly allocated (a miss). Its pixels are undefined.
+    //
+    STImage *Acquire(int width, int height);
+
+    //
+    // Returns image to the pool, or deletes it if maxIdle images of its
+    // size are already idle. May be called from any thread.
+    //
+    void Release(STImage *image);
+
+    //
+    // Number of Acquire() calls served from the pool and by allocation.
+    //
+    int GetHitCount() const;
+    int GetMissCount() const;
+
+private:
+    typedef std::pair<int, int> Size;
+    typedef std::map<Size, std::vector<STImage *> > IdleMap;
+
+    int mMaxIdle;
+    IdleMap mIdle;
+    int mHits, mMisses;
+    mutable pthread_mutex_t mLock;
+
+    // not copyable
+    ImagePool(const ImagePool &);
+    ImagePool &operator=(const ImagePool &);
+};
+
+#endif // __IMAGEPOOL_H__
@@ -0,0 +1,216 @@
+// --------------------------------------------------------------------------
+// incrementalMorph.cpp
+//
+// Edit bounds and tile bookkeeping of incremental sequence rendering.
+//
+
+#include "incrementalMorph.h"
+#include "STImage.h"
+#include "STTimer.h"
+
+#include <math.h>
+#include <algorithm>
+
+static inline bool SameFeature(const Feature &f, const Feature &g)
+{
+    return f.P.x == g.P.x && f.P.y == g.P.y && f.Q.x == g.Q.x && f.Q.y == g.Q.y;
+}
+
+IncrementalMorph::IncrementalMorph(const PaddedImage &sourceImage,
+                                   const PaddedImage &targetImage,
+                                   const std::vector<float> &times, float a, float b, float p,
+                                   const MorphOptions &options, float tolerance)
+    : mSourceImage(sourceImage), mTargetImage(targetImage), mTimes(times)
+    , mA(a), mB(b), mP(p), mOptions(options), mTolerance(tolerance)
+    , mRendered(false), mKernels(SelectWarpKernels(options))
+{
+    mWidth = std::min(sourceImage.GetWidth(), targetImage.GetWidth());
+    mHeight = std::min(sourceImage.GetHeight(), targetImage.GetHeight());
+    mTileSize = options.tileSize > 0 ? options.tileSize : kDefaultTileSize;
+    mTilesX = (mWidth + mTileSize - 1) / mTileSize;
+    mTilesY = (mHeight + mTileSize - 1) / mTileSize;
+
+    mFrames.resize(times.size());
+    for (size_t i = 0; i < times.size(); i++)
+        mFrames[i] = new STImage(mWidth, mHeight);
+    mChanged.assign(times.size(), 0);
+    mDrift.assign(times.size(), std::vector<float>(mTilesX * mTilesY, 0.f));
+
+    // probes every kEditProbeSpacing pixels, and along the last row and
+    // column
+    mProbesX = (mWidth - 1 + kEditProbeSpacing - 1) / kEditProbeSpacing + 1;
+    mProbesY = (mHeight - 1 + kEditProbeSpacing - 1) / kEditProbeSpacing + 1;
+    for (int j = 0; j < mProbesY; j++) {
+        for (int i = 0; i < mProbesX; i++) {
+            mProbeX.push_back((float)std::min(i * kEditProbeSpacing, mWidth - 1));
+            mProbeY.push_back((float)std::min(j * kEditProbeSpacing, mHeight - 1));
+        }
+    }
+}
+
+IncrementalMorph::~IncrementalMorph()
+{
+    for (size_t i = 0; i < mFrames.size(); i++)
+        delete mFrames[i];
+}
+
+EditReport IncrementalMorph::Update(const std::vector<Feature> &sourceFeatures,
+                                    const std::vector<Feature> &targetFeatures)
+{
+    STTimer timer;
+    timer.Reset();
+    EditReport report;
+    int tileCount = mTilesX * mTilesY;
+    report.tiles = GetFrameCount() * tileCount;
+
+    // lines are compared by index, an added or removed line counting once
+    size_t count = std::max(sourceFeatures.size(), mSourceFeatures.size());
+    for (size_t i = 0; i < count; i++) {
+        if (i >= sourceFeatures.size() || i >= mSourceFeatures.size() ||
+            !SameFeature(sourceFeatures[i], mSourceFeatures[i]) ||
+            i >= targetFeatures.size() || i >= mTargetFeatures.size() ||
+            !SameFeature(targetFeatures[i], mTargetFeatures[i]))
+            report.changedLines++;
+    }
+    bool full = !mRendered || mOptions.engine == WARP_MESH;
+    report.full = full;
+    std::fill(mChanged.begin(), mChanged.end(), 0);
+    if (!full && report.changedLines == 0) {
+        report.millis = timer.GetElapsedMillis();
+        return report;
+    }
+
+    FeatureLines sourceLines(sourceFeatures);
+    FeatureLines targetLines(targetFeatures);
+    std::vector<char> dirty(tileCount);
+    for (int f = 0; f < GetFrameCount(); f++) {
+        MorphPlan plan(sourceLines, targetLines, mTimes[f], mA, mB, mP);
+        std::vector<float> &drift = mDrift[f];
+        if (full) {
+            FusedMorph(plan, mSourceImage, mTargetImage, mFrames[f], mOptions);
+            std::fill(drift.begin(), drift.end(), 0.f);
+            report.renderedTiles += tileCount;
+            report.changedFrames++;
+            mChanged[f] = 1;
+            continue;
+        }
+
+        MorphPlan oldPlan(mSourceLines, mTargetLines, mTimes[f], mA, mB, mP);
+        Probe(oldPlan, plan);
+        int rendered = 0;
+        for (int ty = 0; ty < mTilesY; ty++) {
+            for (int tx = 0; tx < mTilesX; tx++) {
+                int j = ty * mTilesX + tx;
+                float moved = drift[j] + TileMovement(tx, ty, mTimes[f]);
+                if (moved <= mTolerance) {
+                    drift[j] = moved;
+                    dirty[j] = 0;
+                } else {
+                    drift[j] = 0;
+                    dirty[j] = 1;
+                    rendered++;
+                }
+            }
+        }
+        if (rendered) {
+            RenderTiles(f, plan, dirty);
+            report.renderedTiles += rendered;
+            report.changedFrames++;
+            mChanged[f] = 1;
+        }
+    }
+
+    mSourceFeatures = sourceFeatures;
+    mTargetFeatures = targetFeatures;
+    mSourceLines.Build(sourceFeatures);
+    mTargetLines.Build(targetFeatures);
+    mRendered = true;
+    report.millis = timer.GetElapsedMillis();
+    return report;
+}
+
+/**
+ * Evaluates both fields at the probes and keeps in mMoves how far the edit
+ * from oldPlan to newPlan moves each of the probes' mapped positions.
+ */
+void IncrementalMorph::Probe(const MorphPlan &oldPlan, const MorphPlan &newPlan)
+{
+    int count = (int)mProbeX.size();
+    mBefore.resize(4 * count);
+    mAfter.resize(4 * count);
+    mMoves.resize(4 * count);
+    mKernels.fieldPoints(oldPlan, &mProbeX[0], &mProbeY[0], count, &mBefore[0],
+                         &mBefore[count], &mBefore[2 * count], &mBefore[3 * count]);
+    mKernels.fieldPoints(newPlan, &mProbeX[0], &mProbeY[0], count, &mAfter[0],
+                         &mAfter[count], &mAfter[2 * count], &mAfter[3 * count]);
+    for (int i = 0; i < 4 * count; i++)
+        mMoves[i] = mAfter[i] - mBefore[i];
+}
+
+/**
+ * Estimated largest movement of a mapped position within tile (tx, ty): the
+ * largest movement of a probe in or on the border of the tile, plus the
+ * largest difference between the movements of neighboring probes there.
+ * Only the sides a frame at t blends with a nonzero weight count.
+ */
+float IncrementalMorph::TileMovement(int tx, int ty, float t) const
+{
+    int x0 = tx * mTileSize, y0 = ty * mTileSize;
+    int x1 = std::min(x0 + mTileSize, mWidth - 1), y1 = std::min(y0 + mTileSize, mHeight - 1);
+    int i0 = x0 / kEditProbeSpacing, j0 = y0 / kEditProbeSpacing;
+    int i1 = std::min((x1 + kEditProbeSpacing - 1) / kEditProbeSpacing, mProbesX - 1);
+    int j1 = std::min((y1 + kEditProbeSpacing - 1) / kEditProbeSpacing, mProbesY - 1);
+
+    int count = (int)mProbeX.size();
+    const float weights[2] = { 1.f - t, t };
+    float largest = 0, variation = 0;
+    for (int j = j0; j <= j1; j++) {
+        for (int i = i0; i <= i1; i++) {
+            int k = j * mProbesX + i;
+            for (int side = 0; side < 2; side++) {
+                if (weights[side] <= 0)
+                    continue;
+                const float *moveX = &mMoves[2 * side * count];
+                const float *moveY = &mMoves[(2 * side + 1) * count];
+                largest = std::max(largest, hypotf(moveX[k], moveY[k]));
+                if (i < i1) {
+                    variation = std::max(variation, hypotf(moveX[k + 1] - moveX[k],
+                                                           moveY[k + 1] - moveY[k]));
+                }
+                if (j < j1) {
+                    variation = std::max(variation,
+                                         hypotf(moveX[k + mProbesX] - moveX[k],
+                                                moveY[k + mProbesX] - moveY[k]));
+                }
+            }
+        }
+    }
+    return largest + variation;
+}
+
+/**
+ * Renders the dirty tiles of frame with plan, a run of neighboring tiles of
+ * a tile row at a time.
+ */
+void IncrementalMorph::RenderTiles(int frame, const MorphPlan &plan,
+                                   const std::vector<char> &dirty)
+{
+    STImage::Pixel *pixels = mFrames[frame]->GetPixels();
+    for (int ty = 0; ty < mTilesY; ty++) {
+        for (int tx = 0; tx < mTilesX; tx++) {
+            if (!dirty[ty * mTilesX + tx])
+                continue;
+            int end = tx;
+            while (end + 1 < mTilesX && dirty[ty * mTilesX + end + 1])
+                end++;
+
+            PixelRect region(tx * mTileSize, ty * mTileSize,
+                             std::min((end + 1) * mTileSize, mWidth),
+                             std::min((ty + 1) * mTileSize, mHeight));
+            PixelView view(pixels + region.y0 * mWidth + region.x0,
+                           region.GetWidth(), region.GetHeight(), mWidth);
+            FusedMorph(plan, mSourceImage, mTargetImage, region, view, mOptions);
+            tx = end;
+        }
+    }
+}
@@ -0,0 +1,131 @@
+// --------------------------------------------------------------------------
+// incrementalMorph.h
+//
+// Keeps the frames of a morph sequence in memory and brings them up to date
+// after feature lines are edited, re-rendering only the output tiles an edit
+// can visibly change.
+//
+// Under the Beier & Neely weights every line pulls on every pixel, but an
+// edit moves the mapped positions far less where the edited line is
+// outweighed by the others. Where that movement stays below a tolerance,
+// in pixels, the frame is kept as it is. The movement is measured rather
+// than bounded analytically: worst-case bounds on the weights and on the
+// single-line mappings are orders of magnitude above the actual movement
+// away from the edited line. For every frame, the fields before and after
+// the edit are evaluated on a grid of probes kEditProbeSpacing apart that
+// includes the tile borders, and a tile is re-rendered when the largest
+// movement of its probes, plus the largest difference between neighboring
+// probes (what the movement can reasonably add in between), plus what the
+// edits since the tile was last rendered added up to, exceeds the
+// tolerance. The first and last frames show one side only (t = 0 or 1), so
+// there the movement of the other side is left out. Kept tiles thus drift
+// from a fresh render by about the tolerance at most, not by the sum of the
+// edits.
+//
+// Re-rendered tiles go through the region form of FusedMorph(), so they are
+// identical to the same tiles of a full render. The probes measure the
+// exact field; the adaptive, bvh and cluster engines may in addition differ
+// by their own approximation error in kept tiles. The mesh engine
+// triangulates all the lines together, so with it every edit re-renders all
+// frames.
+//
+
+#ifndef __INCREMENTALMORPH_H__
+#define __INCREMENTALMORPH_H__
+
+#include "morphEngine.h"
+
+#include <vector>
+
+class STImage;
+
+// Default largest movement of a mapped position, in pixels, that kept
+// tiles may accumulate over edits.
+const float kDefaultEditTolerance = 0.25f;
+
+// Distance, in pixels, between the probes of the field that measure how
+// far an edit moves the mapped positions.
+const int kEditProbeSpacing = 16;
+
+// What an Update() did.
+struct EditReport
+{
+    bool full;              // everything was rendered
+    int changedLines;       // lines edited, added or removed since the last update
+    int tiles;              // tiles in all the frames
+    int renderedTiles;      // tiles rendered
+    int changedFrames;      // frames with at least one rendered tile
+    float millis;           // time the update took
+
+    EditReport()
+        : full(false), changedLines(0), tiles(0), renderedTiles(0)
+        , changedFrames(0), millis(0) { }
+};
+
+class IncrementalMorph
+{
+public:
+    //
+    // Prepares a sequence of frames of the morph between two padded images,
+    // one at each of times, with weight parameters a, b and p. Rendering
+    // uses options throughout; its tile size is also the granularity of
+    // re-rendering. The images must outlive the sequence.
+    //
+    IncrementalMorph(const PaddedImage &sourceImage, const PaddedImage &targetImage,
+                     const std::vector<float> &times, float a, float b, float p,
+                     const MorphOptions &options = MorphOptions(),
+                     float tolerance = kDefaultEditTolerance);
+
+    ~IncrementalMorph();
+
+    //
+    // Brings every frame up to date with the given features. The first
+    // update renders everything; later ones re-render only the tiles where
+    // the change from the features of the previous update moves the mapped
+    // positions by more than the tolerance. Lines may be edited, added or
+    // removed.
+    //
+    EditReport Update(const std::vector<Feature> &sourceFeatures,
+                      const std::vector<Feature> &targetFeatures);
+
+    int GetFrameCount() const { return (int)mTimes.size(); }
+
+    // Frame i, owned by the sequence and valid until it is destroyed.
+    STImage *GetFrame(int i) const { return mFrames[i]; }
+
+    // Whether the last update rendered any tile of frame i.
+    bool IsFrameChanged(int i) const { return mChanged[i] != 0; }
+
+private:
+    IncrementalMorph(const IncrementalMorph &);
+    IncrementalMorph &operator=(const IncrementalMorph &);
+
+    void Probe(const MorphPlan &oldPlan, const MorphPlan &newPlan);
+    float TileMovement(int tx, int ty, float t) const;
+    void RenderTiles(int frame, const MorphPlan &plan, const std::vector<char> &dirty);
+
+    const PaddedImage &mSourceImage;
+    const PaddedImage &mTargetImage;
+    std::vector<float> mTimes;
+    float mA, mB, mP;
+    MorphOptions mOptions;
+    float mTolerance;
+    int mWidth, mHeight;
+    int mTileSize, mTilesX, mTilesY;
+
+    bool mRendered;
+    std::vector<Feature> mSourceFeatures, mTargetFeatures;  // as last rendered
+    FeatureLines mSourceLines, mTargetLines;
+    std::vector<STImage *> mFrames;
+    std::vector<char> mChanged;                 // per frame, by the last update
+    std::vector<std::vector<float> > mDrift;    // per frame and tile, in pixels
+
+    // probes of the field: positions, and how far the last edit moved them
+    WarpKernels mKernels;
+    std::vector<float> mProbeX, mProbeY;
+    int mProbesX, mProbesY;
+    std::vector<float> mMoves;          // source x, y and target x, y moves
+    std::vector<float> mBefore, mAfter; // scratch of Probe()
+};
+
+#endif // __INCREMENTALMORPH_H__
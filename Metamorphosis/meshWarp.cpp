@@ -0,0 +1,243 @@
+// --------------------------------------------------------------------------
+// meshWarp.cpp
+//
+// Construction and scan conversion of the feature mesh.
+//
+
+#include "meshWarp.h"
+
+#include <math.h>
+#include <algorithm>
+
+// Twice the area, in square pixels, below which a triangle is treated as
+// flat and only translated.
+const double kMeshFlatArea = 1e-9;
+
+// Span tagged with its row, before the spans are grouped by row.
+struct RowSpan
+{
+    int y;
+    FeatureMesh::Span span;
+
+    bool operator<(const RowSpan &other) const
+    {
+        return y < other.y || (y == other.y && span.x0 < other.span.x0);
+    }
+};
+
+// Mesh vertex, ordered top to bottom, then left to right.
+struct MeshPoint
+{
+    double x, y;
+
+    bool operator<(const MeshPoint &other) const
+    {
+        return y < other.y || (y == other.y && x < other.x);
+    }
+};
+
+/**
+ * Where the edge from p to q, p < q, crosses row y, which lies between
+ * them. Computed from the end points in this order only, so that both
+ * triangles along an edge get the same result.
+ */
+static inline double EdgeX(const MeshPoint &p, const MeshPoint &q, double y)
+{
+    if (y == p.y)
+        return p.x;
+    if (y == q.y)
+        return q.x;
+    return p.x + (y - p.y) * (q.x - p.x) / (q.y - p.y);
+}
+
+/**
+ * Inserts a mesh point mapped to the given source and target positions and
+ * returns its vertex. A point on an existing vertex keeps that vertex's
+ * mapping.
+ */
+int FeatureMesh::AddVertex(double x, double y, float sourceX, float sourceY,
+                           float targetX, float targetY)
+{
+    int vertex = mTriangulation.Insert(x, y);
+    if (vertex == (int)mSourceX.size()) {
+        mSourceX.push_back(sourceX);
+        mSourceY.push_back(sourceY);
+        mTargetX.push_back(targetX);
+        mTargetY.push_back(targetY);
+    }
+    return vertex;
+}
+
+void FeatureMesh::Build(const MorphPlan &plan, int width, int height,
+                        FieldPointsKernel fieldPoints)
+{
+    mWidth = width;
+    mHeight = height;
+    mConstrained = 0;
+    mSourceX.clear();
+    mSourceY.clear();
+    mTargetX.clear();
+    mTargetY.clear();
+
+    const FeatureLines &lines = plan.lines;
+    const FeatureLines &source = *plan.source;
+    const FeatureLines &target = *plan.target;
+    int n = plan.GetCount();
+
+    float minX = 0, minY = 0, maxX = (float)(width - 1), maxY = (float)(height - 1);
+    for (int i = 0; i < n; i++) {
+        minX = std::min(minX, std::min(lines.px[i], lines.qx[i]));
+        minY = std::min(minY, std::min(lines.py[i], lines.qy[i]));
+        maxX = std::max(maxX, std::max(lines.px[i], lines.qx[i]));
+        maxY = std::max(maxY, std::max(lines.py[i], lines.qy[i]));
+    }
+    minX -= kMeshMargin;
+    minY -= kMeshMargin;
+    maxX += kMeshMargin;
+    maxY += kMeshMargin;
+
+    // the box corners, then the points along the image border, all mapped
+    // by the field
+    std::vector<float> xs, ys;
+    const float cornerX[4] = { minX, maxX, maxX, minX };
+    const float cornerY[4] = { minY, minY, maxY, maxY };
+    for (int i = 0; i < 4; i++) {
+        xs.push_back(cornerX[i]);
+        ys.push_back(cornerY[i]);
+    }
+    for (int x = 0; x < width; x += kMeshBorderSpacing) {
+        float borderX = (float)std::min(x, width - 1);
+        xs.push_back(borderX); ys.push_back(0.f);
+        xs.push_back(borderX); ys.push_back((float)(height - 1));
+    }
+    for (int y = 0; y < height; y += kMeshBorderSpacing) {
+        float borderY = (float)std::min(y, height - 1);
+        xs.push_back(0.f); ys.push_back(borderY);
+        xs.push_back((float)(width - 1)); ys.push_back(borderY);
+    }
+    xs.push_back((float)(width - 1)); ys.push_back((float)(height - 1));
+    int count = (int)xs.size();
+    std::vector<float> mapped(4 * count);
+    fieldPoints(plan, &xs[0], &ys[0], count, &mapped[0], &mapped[count],
+                &mapped[2 * count], &mapped[3 * count]);
+
+    mTriangulation.Reset(minX, minY, maxX, maxY);
+    for (int i = 0; i < 4; i++) {
+        mSourceX.push_back(mapped[i]);
+        mSourceY.push_back(mapped[count + i]);
+        mTargetX.push_back(mapped[2 * count + i]);
+        mTargetY.push_back(mapped[3 * count + i]);
+    }
+
+    // feature endpoints go first, so that they keep their exact mapping
+    std::vector<int> ends(2 * n);
+    for (int i = 0; i < n; i++) {
+        ends[2 * i] = AddVertex(lines.px[i], lines.py[i], source.px[i], source.py[i],
+                                target.px[i], target.py[i]);
+        ends[2 * i + 1] = AddVertex(lines.qx[i], lines.qy[i], source.qx[i], source.qy[i],
+                                    target.qx[i], target.qy[i]);
+    }
+    for (int i = 4; i < count; i++) {
+        AddVertex(xs[i], ys[i], mapped[i], mapped[count + i],
+                  mapped[2 * count + i], mapped[3 * count + i]);
+    }
+
+    for (int i = 0; i < n; i++) {
+        if (ends[2 * i] >= 0 && ends[2 * i + 1] >= 0 &&
+            mTriangulation.Constrain(ends[2 * i], ends[2 * i + 1]))
+            mConstrained++;
+    }
+    mTriangulation.RestoreDelaunay();
+
+    BuildMaps();
+    BuildSpans();
+}
+
+/**
+ * Solves for the affine map of every triangle from its output corners to
+ * its mapped corners on both sides.
+ */
+void FeatureMesh::BuildMaps()
+{
+    const std::vector<Triangulation::Triangle> &triangles = mTriangulation.GetTriangles();
+    mMaps.resize(triangles.size());
+
+    for (size_t t = 0; t < triangles.size(); t++) {
+        const int *v = triangles[t].v;
+        double x0 = mTriangulation.GetX(v[0]), y0 = mTriangulation.GetY(v[0]);
+        double ex = mTriangulation.GetX(v[1]) - x0, ey = mTriangulation.GetY(v[1]) - y0;
+        double fx = mTriangulation.GetX(v[2]) - x0, fy = mTriangulation.GetY(v[2]) - y0;
+        double det = ex * fy - fx * ey;
+
+        const std::vector<float> *values[4] = { &mSourceX, &mSourceY, &mTargetX, &mTargetY };
+        float *coefficients[4] = { mMaps[t].sx, mMaps[t].sy, mMaps[t].tx, mMaps[t].ty };
+        for (int k = 0; k < 4; k++) {
+            const std::vector<float> &value = *values[k];
+            if (fabs(det) <= kMeshFlatArea) {
+                // a flat triangle moves by the mean displacement of its corners
+                bool isX = k % 2 == 0;
+                double shift = 0;
+                for (int c = 0; c < 3; c++) {
+                    shift += value[v[c]] - (isX ? mTriangulation.GetX(v[c])
+                                                : mTriangulation.GetY(v[c]));
+                }
+                coefficients[k][0] = isX ? 1.f : 0.f;
+                coefficients[k][1] = isX ? 0.f : 1.f;
+                coefficients[k][2] = (float)(shift / 3);
+                continue;
+            }
+            double m0 = value[v[0]], dm1 = value[v[1]] - m0, dm2 = value[v[2]] - m0;
+            double a = (dm1 * fy - dm2 * ey) / det;
+            double b = (dm2 * ex - dm1 * fx) / det;
+            coefficients[k][0] = (float)a;
+            coefficients[k][1] = (float)b;
+            coefficients[k][2] = (float)(m0 - a * x0 - b * y0);
+        }
+    }
+}
+
+/**
+ * Scan converts every triangle into spans of pixel centers: rows y with
+ * top <= y < bottom, and in each row the pixels x with left <= x < right.
+ */
+void FeatureMesh::BuildSpans()
+{
+    const std::vector<Triangulation::Triangle> &triangles = mTriangulation.GetTriangles();
+    std::vector<RowSpan> spans;
+
+    for (size_t t = 0; t < triangles.size(); t++) {
+        MeshPoint p[3];
+        for (int c = 0; c < 3; c++) {
+            p[c].x = mTriangulation.GetX(triangles[t].v[c]);
+            p[c].y = mTriangulation.GetY(triangles[t].v[c]);
+        }
+        std::sort(p, p + 3);
+
+        int top = std::max(0, (int)ceil(p[0].y));
+        int bottom = std::min(mHeight, (int)ceil(p[2].y));
+        for (int y = top; y < bottom; y++) {
+            double longX = EdgeX(p[0], p[2], y);
+            double shortX = y < p[1].y ? EdgeX(p[0], p[1], y) : EdgeX(p[1], p[2], y);
+            int left = std::max(0, (int)ceil(std::min(longX, shortX)));
+            int right = std::min(mWidth, (int)ceil(std::max(longX, shortX)));
+            if (left >= right)
+                continue;
+            RowSpan span;
+            span.y = y;
+            span.span.x0 = left;
+            span.span.x1 = right;
+            span.span.triangle = (int)t;
+            spans.push_back(span);
+        }
+    }
+    std::sort(spans.begin(), spans.end());
+
+    mSpans.resize(spans.size());
+    mRowStart.assign(mHeight + 1, 0);
+    for (size_t i = 0; i < spans.size(); i++) {
+        mSpans[i] = spans[i].span;
+        mRowStart[spans[i].y + 1]++;
+    }
+    for (int y = 0; y < mHeight; y++)
+        mRowStart[y + 1] += mRowStart[y];
+}
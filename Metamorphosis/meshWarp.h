@@ -0,0 +1,101 @@
+// --------------------------------------------------------------------------
+// meshWarp.h
+//
+// Piecewise-affine warp over a triangle mesh, the fast alternative to the
+// field warp. The endpoints of the interpolated feature lines are
+// triangulated with the lines themselves as constrained edges (see
+// triangulation.h), and every triangle is mapped affinely onto the triangle
+// the same endpoints form among the source lines, and among the target
+// lines. A pixel then costs one affine map per side whatever the number of
+// features, against one evaluation of every feature for the field warp.
+//
+// The mesh is closed by points along the image border, every
+// kMeshBorderSpacing pixels, and the corners of a box around everything;
+// those move with the exact field, so the two warps agree along the border.
+// Inside, the mesh matches the field at the feature endpoints and
+// interpolates linearly in between, so it follows the features themselves
+// exactly but spreads their influence differently. Lines that cross an
+// earlier line, or run through another endpoint, are left out as edges;
+// their endpoints still are vertices.
+//
+// Triangles are rasterized scanline by scanline into spans of pixels. Both
+// sides of a shared edge compute its crossing with a row from the same
+// end points, so the spans of a row tile it exactly, and pixel centers on
+// an edge go to the triangle on its right (on its lower side for
+// horizontal edges).
+//
+
+#ifndef __MESHWARP_H__
+#define __MESHWARP_H__
+
+#include "morphPlan.h"
+#include "triangulation.h"
+#include "warpSimd.h"
+
+#include <vector>
+
+// Distance, in pixels, between the mesh points along the image border.
+const int kMeshBorderSpacing = 64;
+
+// Room left between the image, or the farthest endpoint, and the box that
+// holds the mesh.
+const int kMeshMargin = 16;
+
+class FeatureMesh
+{
+public:
+    // Run of pixels [x0, x1) in one row, all inside the same triangle.
+    struct Span
+    {
+        int x0, x1;
+        int triangle;
+    };
+
+    // Affine maps of a triangle from output positions to the source and
+    // target images: sourceX = sx[0] x + sx[1] y + sx[2], and so on.
+    struct AffineMaps
+    {
+        float sx[3], sy[3], tx[3], ty[3];
+    };
+
+    FeatureMesh() : mWidth(0), mHeight(0), mConstrained(0) { }
+
+    //
+    // (Re)builds the mesh of a width x height output for the interpolated
+    // lines of plan. fieldPoints maps the border points with the exact
+    // field (see warpSimd.h).
+    //
+    void Build(const MorphPlan &plan, int width, int height, FieldPointsKernel fieldPoints);
+
+    //
+    // Spans of output row y, left to right; they cover the row exactly.
+    //
+    const Span *GetRowSpans(int y) const
+    {
+        return mSpans.empty() ? 0 : &mSpans[0] + mRowStart[y];
+    }
+    int GetRowSpanCount(int y) const { return mRowStart[y + 1] - mRowStart[y]; }
+
+    const AffineMaps &GetMaps(int triangle) const { return mMaps[triangle]; }
+
+    int GetTriangleCount() const { return (int)mMaps.size(); }
+
+    // Number of feature lines that are edges of the mesh.
+    int GetConstrainedCount() const { return mConstrained; }
+
+private:
+    int AddVertex(double x, double y, float sourceX, float sourceY,
+                  float targetX, float targetY);
+    void BuildMaps();
+    void BuildSpans();
+
+    int mWidth, mHeight;
+    int mConstrained;
+    Triangulation mTriangulation;
+    std::vector<float> mSourceX, mSourceY, mTargetX, mTargetY;     // per vertex
+    std::vector<AffineMaps> mMaps;                                 // per triangle
+    std::vector<Span> mSpans;
+    std::vector<int> mRowStart;     // first span of each row, and the end
+};
+
+#endif // __MESHWARP_H__
@@ -8,6 +8,19 @@
 #include "st.h"
 #include "stglut.h"
 #include "parseConfig.h"
+#include "feature.h"
+#include "morphEngine.h"
+#include "benchmark.h"
+#include "deadlineRender.h"
+#include "displacementField.h"
+#include "frameCache.h"
+#include "framePipeline.h"
+#include "imagePool.h"
+#include "incrementalMorph.h"
+#include "progressiveMorph.h"
+#include "sampler.h"
+#include "threadPool.h"
+#include "tileTuner.h"
 
 #include <iostream>
 #include <iomanip>
@@ -15,18 +28,8 @@
 #include <string>
 #include <vector>
 #include <algorithm>
-
-// --------------------------------------------------------------------------
-// Structure to contain an image feature for a morph. A feature is a directed
-// line segment from P to Q, with coordinates in pixel units relative to the
-// lower-left corner of the image.
-// --------------------------------------------------------------------------
-
-struct Feature
-{
-    STPoint2 P, Q;
-    Feature(const STPoint2 &p, const STPoint2 &q) : P(p), Q(q) { }
-};
+#include <sys/stat.h>
+#include <unistd.h>
 
 // --------------------------------------------------------------------------
 // Constants, a few global variables, and function prototypes
@@ -35,76 +38,45 @@ struct Feature
 const int kWindowWidth  = 512;
 const int kWindowHeight = 512;
 const int kFrames       = 30;   // number of frames to generate
+const int kThreads      = 0;    // render threads (0 = one per CPU)
+const int kEncoders     = 2;    // threads writing finished frames to disk
+const int kFramesInFlight = 4;  // finished frames allowed to wait for disk
 
 STImage *gDisplayedImage = 0;   // an image to display (for testing/debugging)
+int gDisplayZoom = 1;           // pixel replication when drawing the image
+
+ProgressiveMorph *gPreview = 0; // morph previewed level by level, if any
 
 std::vector<Feature> gSourceFeatures;   // feature set on source image
 std::vector<Feature> gTargetFeatures;   // corresponding features on target
 
+MorphOptions gMorphOptions;     // threading, tiling and filter used by the morph
+
+float gFrameBudget = 0;         // per-frame time limit in ms (0 = none)
+DeadlineRenderer gDeadlineRenderer;     // frame costs seen so far
+
+FrameCache *gFrameCache = 0;    // frames rendered by earlier runs, if caching
+std::string gFieldDirectory;    // where displacement fields are kept, if anywhere
+STImage::SaveOptions gSaveOptions;      // encoder settings of the frames
+
 // Copies an image into the global image for display
 void DisplayImage(STImage *image);
 
+// Adds a feature read from a line editor file to the feature sets
+void AddFeatureCallback(STPoint2 p, STPoint2 q, ImageChoice image);
+
 // --------------------------------------------------------------------------
 // CS148 TODO: Implement the functions below to compute the morph
 // --------------------------------------------------------------------------
 
 
-float Lerp(float c1, float c2, float t) {
-    return c1 + t * (c2 - c1);
-}
-
-STColor4ub colorLerp(STColor4ub c1, STColor4ub c2, float t) {
-    float r = Lerp(c1.r, c2.r, t);
-    float g = Lerp(c1.g, c2.g, t);
-    float b = Lerp(c1.b, c2.b, t);
-    STColor4ub result(r,g,b);
-    return result;
-}
-
-STColor4ub biLerp(STPoint2& X_prime, STImage *image) {
-    
-    STPoint2 v0(floorf(X_prime.x), floorf(X_prime.y));
-    STPoint2 v1(ceilf(X_prime.x), floorf(X_prime.y));
-    STPoint2 v2(floorf(X_prime.x), ceilf(X_prime.y));
-    STPoint2 v3(ceilf(X_prime.x), ceilf(X_prime.y));
-    STColor4ub v0C, v1C, v2C, v3C; 
-    
-    // Edge cases
-    if (v0.x >= image->GetWidth() || v0.y >= image->GetHeight())  v0C = STColor4ub(0,0,0);
-    else v0C = STColor4ub(image->GetPixel(v0.x, v0.y));
-    if (v1.x >= image->GetWidth() || v1.y >= image->GetHeight())  v1C = STColor4ub(0,0,0);
-    else v1C = STColor4ub(image->GetPixel(v1.x, v1.y));
-    if (v2.x >= image->GetWidth() || v2.y >= image->GetHeight())  v2C = STColor4ub(0,0,0);
-    else v2C = STColor4ub(image->GetPixel(v2.x, v2.y)); 
-    if (v3.x >= image->GetWidth() || v3.y >= image->GetHeight())  v3C = STColor4ub(0,0,0);
-    else v3C = STColor4ub(image->GetPixel(v3.x, v3.y));
-    
-    float s = X_prime.x - v0.x;
-    float t = X_prime.y - v0.y;
-    STColor4ub v01C(colorLerp(v0C, v1C, s));
-    STColor4ub v23C(colorLerp(v2C, v3C, s));
-    STColor4ub v(colorLerp(v01C, v23C, t));
-    return v;
-}
-
 /**
  * Compute a linear blend of the pixel colors in two provided images according
  * to a parameter t.
  */
 STImage *BlendImages(STImage *image1, STImage *image2, float t)
 {
-    int minWidth = std::min(image1->GetWidth(), image2->GetWidth());
-    int minHeight = std::min(image1->GetHeight(), image2->GetHeight());
-    STImage *result = new STImage(minWidth, minHeight);
-    for (int x = 0; x < minWidth; x++) {
-        for (int y = 0; y < minHeight; y++) {
-            STColor4ub p1 = image1->GetPixel(x, y);
-            STColor4ub p2 = image2->GetPixel(x, y);
-            STColor4ub resultPixel(colorLerp(p1, p2, t));
-            result->SetPixel(x, y, resultPixel);
-        }
-    }
-    return result;
+    return BlendImages(image1, image2, t, gMorphOptions);
 }
 
 
@@ -118,58 +90,107 @@ STImage *FieldMorph(STImage *image,
                     const std::vector<Feature> &targetFeatures,
                     float t, float a, float b, float p)
 {
-    STImage *result = new STImage(image->GetWidth(), image->GetHeight());
-    for (int x = 0; x < result->GetWidth(); x++) {
-        for (int y = 0; y < result->GetHeight(); y++) {
-            STPoint2 X(x,y);
-            STVector2 dSum(0,0);
-            float weightSum = 0;
-            for (int i = 0; i < targetFeatures.size(); i++) {
-                float Pi_x = Lerp(sourceFeatures[i].P.x, targetFeatures[i].P.x, t);
-                float Pi_y = Lerp(sourceFeatures[i].P.y, targetFeatures[i].P.y, t);
-                float Qi_x = Lerp(sourceFeatures[i].Q.x, targetFeatures[i].Q.x, t); 
-                float Qi_y = Lerp(sourceFeatures[i].Q.y, targetFeatures[i].Q.y, t); 
-
-                STPoint2 Pi(Pi_x, Pi_y);
-                STPoint2 Qi(Qi_x, Qi_y);
-                STVector2 PiQi(Qi - Pi);
-                STVector2 PiX(X - Pi);
-                STVector2 perpPiQi(-PiQi.y, PiQi.x);
-                float u = STVector2::Dot(PiX, PiQi) / PiQi.LengthSq();
-                float v = STVector2::Dot(PiX, perpPiQi) / PiQi.Length();
-                
-                STPoint2 Pi_prime = sourceFeatures[i].P;
-                STPoint2 Qi_prime = sourceFeatures[i].Q;
-                STVector2 PiQi_prime(Qi_prime - Pi_prime);
-                STVector2 perpPiQi_prime(-PiQi_prime.y, PiQi_prime.x);
-                STPoint2 Xi_prime( Pi_prime + (u * PiQi_prime) + (v * perpPiQi_prime)/PiQi_prime.Length() );
-                
-                STVector2 Di(Xi_prime - X);
-                float dist;
-                if (u < 0) dist = STPoint2::Dist(Pi, X);
-                else if (u > 1) dist = STPoint2::Dist(Qi,X);
-                else dist = abs(v);
-                
-                float weight = powf( (powf(PiQi.Length(),p) / (a + dist)), b);
-                dSum += Di * weight;
-                weightSum += weight;
-            }
-            STPoint2 X_prime = X + dSum / weightSum;
-            if (   X_prime.x < 0 
-                || X_prime.x >= image->GetWidth()
-                || X_prime.y < 0 
-                || X_prime.y >= image->GetHeight()) {
-                // set pixel to be WHITE
-               // result->SetPixel(x, y, STColor4ub(255,255,255,255));
-            } else {
-                STColor4ub X_prime_color = biLerp(X_prime, image);
-                result->SetPixel(x, y, X_prime_color);
-            }
-        }
-    }
+    // All per-feature invariants are hoisted into the plan; the pixel loop
+    // lives in WarpImage()
+    FeatureLines sourceLines(sourceFeatures);
+    FeatureLines targetLines(targetFeatures);
+    MorphPlan plan(sourceLines, targetLines, t, a, b, p);
+    return WarpImage(image, plan, gMorphOptions);
+}
+
+/**
+ * Same as above for only a rectangle of the output, stored into a strided
+ * view of the rectangle's size; the pixels match those of the full image.
+ */
+void FieldMorph(const PaddedImage &image,
+                const std::vector<Feature> &sourceFeatures,
+                const std::vector<Feature> &targetFeatures,
+                float t, float a, float b, float p,
+                const PixelRect &region, const PixelView &view)
+{
+    FeatureLines sourceLines(sourceFeatures);
+    FeatureLines targetLines(targetFeatures);
+    MorphPlan plan(sourceLines, targetLines, t, a, b, p);
+    WarpImage(image, plan, region, view, gMorphOptions);
+}
+
+/**
+ * First half of FieldMorph(): compute where each pixel of a width x height
+ * output maps to, without looking at any pixels (see displacementField.h).
+ * The field can be saved and applied to any image of that size. The caller
+ * owns the returned field.
+ */
+DisplacementField *ComputeDisplacementField(const std::vector<Feature> &sourceFeatures,
+                                            const std::vector<Feature> &targetFeatures,
+                                            float t, float a, float b, float p,
+                                            int width, int height)
+{
+    FeatureLines sourceLines(sourceFeatures);
+    FeatureLines targetLines(targetFeatures);
+    MorphPlan plan(sourceLines, targetLines, t, a, b, p);
+    DisplacementField *field = new DisplacementField;
+    ComputeField(plan, width, height, field, gMorphOptions);
+    return field;
+}
+
+/**
+ * Second half of FieldMorph(): sample image through a field computed as
+ * above or loaded from disk. Matches FieldMorph() up to the fixed point
+ * rounding of the field.
+ */
+STImage *ApplyDisplacementField(STImage *image, const DisplacementField &field)
+{
+    PaddedImage padded(image);
+    return WarpImage(padded, field, gMorphOptions);
+}
+
+/**
+ * Compute a morph from a prebuilt plan (see morphPlan.h), so that callers
+ * rendering many frames can share the per-run feature tables.
+ */
+STImage *MorphImages(STImage *sourceImage, STImage *targetImage, const MorphPlan &plan)
+{
+    return FusedMorph(plan, sourceImage, targetImage, gMorphOptions);
+}
+
+/**
+ * Same as above on images already padded for sampling (see sampler.h).
+ */
+STImage *MorphImages(const PaddedImage &sourceImage, const PaddedImage &targetImage,
+                     const MorphPlan &plan)
+{
+    return FusedMorph(plan, sourceImage, targetImage, gMorphOptions);
+}
+
+/**
+ * Same as above within a time budget: the frame is degraded as far as needed
+ * to take at most budgetMillis (see deadlineRender.h), and quality receives
+ * the level it was rendered at.
+ */
+STImage *MorphImages(const PaddedImage &sourceImage, const PaddedImage &targetImage,
+                     const MorphPlan &plan, float budgetMillis, RenderQuality *quality)
+{
+    int width = std::min(sourceImage.GetWidth(), targetImage.GetWidth());
+    int height = std::min(sourceImage.GetHeight(), targetImage.GetHeight());
+    STImage *result = new STImage(width, height);
+    DeadlineReport report = gDeadlineRenderer.Render(plan, sourceImage, targetImage, result,
+                                                     gMorphOptions, budgetMillis);
+    if (quality)
+        *quality = report.quality;
     return result;
 }
 
+/**
+ * Same as the unbudgeted form above for only a rectangle of the frame, e.g.
+ * a crop or a tile rendered elsewhere, stored into a strided view of the
+ * rectangle's size; the pixels match those of the full frame.
+ */
+void MorphImages(const PaddedImage &sourceImage, const PaddedImage &targetImage,
+                 const MorphPlan &plan, const PixelRect &region, const PixelView &view)
+{
+    FusedMorph(plan, sourceImage, targetImage, region, view, gMorphOptions);
+}
+
 /**
  * Compute a morph between two images by first distorting each toward the
  * other, then combining the results with a blend operation.
@@ -178,41 +199,227 @@ STImage *MorphImages(STImage *sourceImage, const std::vector<Feature> &sourceFea
                      STImage *targetImage, const std::vector<Feature> &targetFeatures,
                      float t, float a, float b, float p)
 {
-    STImage *image1 = FieldMorph(sourceImage, sourceFeatures, targetFeatures, t, a, b, p);
-    STImage *image2 = FieldMorph(targetImage, targetFeatures, sourceFeatures, 1-t, a, b, p);
-    
-    STImage *result = BlendImages(image1, image2, t);
-    return result;
+    // Both warps share the interpolated features, so evaluate them together
+    // (equivalent to blending FieldMorph(source, t) with FieldMorph(target, 1-t))
+    FeatureLines sourceLines(sourceFeatures);
+    FeatureLines targetLines(targetFeatures);
+    MorphPlan plan(sourceLines, targetLines, t, a, b, p);
+    return MorphImages(sourceImage, targetImage, plan);
+}
+
+/**
+ * Values of t of the frames of the morph through time, eased in and out.
+ */
+std::vector<float> GetFrameTimes()
+{
+    std::vector<float> times;
+    float t = 0;
+    for (int i = 0; i <= kFrames; ++i)
+    {
+        times.push_back(powf(t, 2.f)*(3-2*t));
+        t += (1.0/30.0);
+    }
+    return times;
+}
+
+/**
+ * File name frame i of the morph through time is saved under.
+ */
+std::string GetFrameName(int i)
+{
+    std::ostringstream oss;
+    oss << "frame" << std::setw(3) << std::setfill('0') << i << ".png";
+    return oss.str();
 }
 
 /**
  * Compute a morph through time by generating appropriate values of t and
- * repeatedly calling MorphImages(). Saves the image sequence to disk.
+ * repeatedly calling MorphImages(). Saves the image sequence to disk; frames
+ * are encoded on separate threads while the next ones are being warped.
  */
 void GenerateMorphFrames(STImage *sourceImage, const std::vector<Feature> &sourceFeatures,
                          STImage *targetImage, const std::vector<Feature> &targetFeatures,
                          float a, float b, float p)
 {
+    // the source- and target-side feature tables are shared by all frames;
+    // only the interpolated lines are rebuilt per frame
+    FeatureLines sourceLines(sourceFeatures);
+    FeatureLines targetLines(targetFeatures);
+    MorphPlan plan;
+
+    // likewise the input images are padded for sampling only once
+    PaddedImage paddedSource(sourceImage);
+    PaddedImage paddedTarget(targetImage);
+
+    // frames are rendered into recycled images, and PNG encoding overlaps
+    // with rendering the following frames. Written frames go to the cache;
+    // the encoder settings are not part of their keys, as PNG frames decode
+    // to the same pixels whatever the settings.
+    ImagePool framePool;
+    FramePipeline pipeline(kEncoders, kFramesInFlight, &framePool, gFrameCache,
+                           gSaveOptions);
+    int width = std::min(sourceImage->GetWidth(), targetImage->GetWidth());
+    int height = std::min(sourceImage->GetHeight(), targetImage->GetHeight());
+
+    // everything but t is hashed once for the keys of all the frames and
+    // their fields
+    FrameKey morphKey = GetMorphKey(sourceImage, sourceFeatures, targetImage, targetFeatures,
+                                    a, b, p, gMorphOptions);
+    FrameKey fieldKey = GetFieldKey(sourceFeatures, targetFeatures, width, height,
+                                    a, b, p, gMorphOptions);
+    DisplacementField field;
+
     // iterate and generate each required frame
-    float t = 0;
+    std::vector<float> times = GetFrameTimes();
     for (int i = 0; i <= kFrames; ++i)
     {
         std::cout << "Metamorphosizing frame #" << i << "...";
-        float ease_t = powf(t, 2.f)*(3-2*t);
-        STImage *result = MorphImages(sourceImage, sourceFeatures, targetImage, targetFeatures, ease_t, a, b, p);
-        t += (1.0/30.0);
-        // generate a file name to save
-        std::ostringstream oss;
-        oss << "frame" << std::setw(3) << std::setfill('0') << i << ".png";
-
-        // write and deallocate the morphed image
-        if (result) {
-            result->Save(oss.str());
-            delete result;
+        float ease_t = times[i];
+        FrameKey frameKey = morphKey;
+        frameKey.Add(ease_t);
+        // frames sampled through a fixed point field differ slightly from
+        // the exact ones, so they are cached apart
+        bool viaField = gFrameBudget <= 0 && !gFieldDirectory.empty();
+        if (viaField)
+            frameKey.Add(kMaxFieldFractionBits);
+        std::string key = frameKey.GetString();
+        if (gFrameCache && gFrameCache->Fetch(key, GetFrameName(i))) {
+            std::cout << " cached." << std::endl;
+            continue;
+        }
+
+        plan.Build(sourceLines, targetLines, ease_t, a, b, p);
+        STImage *result = framePool.Acquire(width, height);
+        if (gFrameBudget > 0) {
+            DeadlineReport report = gDeadlineRenderer.Render(plan, paddedSource, paddedTarget,
+                                                             result, gMorphOptions, gFrameBudget);
+            std::cout << " " << GetRenderQualityName(report.quality);
+            if (report.quality == QUALITY_COARSE)
+                std::cout << " 1/" << report.scale;
+            std::cout << " in " << report.millis << " ms...";
+
+            // degraded frames are not what the key stands for
+            if (report.quality != QUALITY_FULL)
+                key.clear();
+        } else if (viaField) {
+            // the fields only depend on the features, so the ones saved by
+            // a run on other images leave just the sampling to do
+            FrameKey frameFieldKey = fieldKey;
+            frameFieldKey.Add(ease_t);
+            std::string fieldName = gFieldDirectory + "/" + frameFieldKey.GetString() + ".fld";
+            if (field.Load(fieldName)) {
+                std::cout << " field loaded...";
+            } else {
+                ComputeField(plan, width, height, &field, gMorphOptions);
+                if (!field.Save(fieldName))
+                    std::cout << " " << fieldName << " could not be saved...";
+            }
+            FusedMorph(field, paddedSource, paddedTarget, result, gMorphOptions);
+        } else {
+            FusedMorph(plan, paddedSource, paddedTarget, result, gMorphOptions);
         }
+        // hand the morphed image off to be written, cached and recycled
+        pipeline.Submit(result, GetFrameName(i), key);
 
         std::cout << " done." << std::endl;
     }
+
+    std::cout << "Writing remaining frames...";
+    int failures = pipeline.Finish();
+    if (failures)
+        std::cout << " " << failures << " frames could not be saved.";
+    std::cout << " done." << std::endl;
+    std::cout << "Frame pool: " << framePool.GetHitCount() << " hits, "
+              << framePool.GetMissCount() << " misses" << std::endl;
+    if (gFrameCache) {
+        std::cout << "Frame cache: " << gFrameCache->GetHitCount() << " hits, "
+                  << gFrameCache->GetMissCount() << " misses, "
+                  << gFrameCache->GetEvictionCount() << " evicted; "
+                  << gFrameCache->GetEntryCount() << " frames in "
+                  << gFrameCache->GetByteCount() / 1024 << " KB" << std::endl;
+    }
+}
+
+/**
+ * Modification time of a file, or 0 if it cannot be read.
+ */
+time_t GetModificationTime(const char *fileName)
+{
+    struct stat status;
+    return stat(fileName, &status) == 0 ? status.st_mtime : 0;
+}
+
+/**
+ * Compute the morph through time like GenerateMorphFrames(), then keep the
+ * frames and watch the line editor file: every time it is saved, reload the
+ * features and render again only the tiles of each frame the edit affected
+ * (see incrementalMorph.h), saving the frames that changed. Runs until the
+ * program is interrupted.
+ */
+void WatchMorphFrames(const char *lineEditorFile, STImage *sourceImage, STImage *targetImage,
+                      float a, float b, float p)
+{
+    PaddedImage paddedSource(sourceImage);
+    PaddedImage paddedTarget(targetImage);
+    IncrementalMorph sequence(paddedSource, paddedTarget, GetFrameTimes(), a, b, p,
+                              gMorphOptions);
+    time_t modified = GetModificationTime(lineEditorFile);
+
+    for (;;)
+    {
+        EditReport report = sequence.Update(gSourceFeatures, gTargetFeatures);
+        if (report.changedLines || report.full) {
+            std::cout << "Rendered " << report.renderedTiles << " of " << report.tiles
+                      << " tiles (" << report.changedLines << " lines changed) in "
+                      << report.millis << " ms; saving " << report.changedFrames
+                      << " frames...";
+            for (int i = 0; i < sequence.GetFrameCount(); i++) {
+                if (sequence.IsFrameChanged(i) &&
+                    sequence.GetFrame(i)->Save(GetFrameName(i), gSaveOptions) != ST_OK)
+                    std::cout << " " << GetFrameName(i) << " could not be saved.";
+            }
+            std::cout << " done." << std::endl;
+        }
+
+        // wait for the line editor to save the file again
+        std::cout << "Watching " << lineEditorFile << " for changes..." << std::endl;
+        time_t now = modified;
+        while (now == modified) {
+            sleep(1);
+            now = GetModificationTime(lineEditorFile);
+        }
+        modified = now;
+
+        char sourceName[64], targetName[64];
+        STImage *source, *target;
+        gSourceFeatures.clear();
+        gTargetFeatures.clear();
+        loadLineEditorFile(lineEditorFile, AddFeatureCallback, sourceName, targetName,
+                           &source, &target);
+        delete source;
+        delete target;
+    }
+}
+
+/**
+ * Idle callback function renders the next level of the preview and displays
+ * it scaled up to full size, until the full resolution level is shown
+ */
+void PreviewIdleCallback()
+{
+    STTimer timer;
+    timer.Reset();
+    STImage *level = gPreview ? gPreview->RenderNextLevel() : 0;
+    if (!level) {
+        glutIdleFunc(0);
+        return;
+    }
+    std::cout << "Preview at 1/" << gPreview->GetScale() << " resolution: "
+              << timer.GetElapsedMillis() << " ms" << std::endl;
+
+    DisplayImage(level);
+    gDisplayZoom = gPreview->GetScale();
+    glutPostRedisplay();
 }
 
 // --------------------------------------------------------------------------
@@ -249,8 +456,11 @@ void DisplayCallback()
     glMatrixMode(GL_MODELVIEW);
     glLoadIdentity();
 
-    if (gDisplayedImage)
+    if (gDisplayedImage) {
+        glPixelZoom((float)gDisplayZoom, (float)gDisplayZoom);
         gDisplayedImage->Draw();
+        glPixelZoom(1.f, 1.f);
+    }
 
     glutSwapBuffers();
 }
@@ -315,11 +525,95 @@ int main(int argc, char* argv[])
     glutReshapeFunc(ReshapeCallback);
     glutKeyboardFunc(KeyboardCallback);
 
+    //
+    // pull out the options: -filter <name> picks the sampling filter
+    // (nearest, bilinear, bicubic, lanczos3), -engine <name> the field
+    // evaluator (direct, scanline, adaptive, bvh, cluster, mesh), -tolerance
+    // <pixels> the error allowed to the adaptive evaluator, -epsilon
+    // <fraction> the weight the bvh evaluator may cull, -theta <ratio> the
+    // cluster opening criterion, -budget <ms> the time each frame may take
+    // (frames are degraded to fit), -benchmark runs the benchmark suite
+    // instead of the morph, -preview shows the middle frame coarse to fine
+    // instead of generating the frames, and -watch keeps the frames after
+    // generating them and updates them every time the line editor file is
+    // saved. Generated frames are cached in the directory given by -cache
+    // <dir> (framecache by default) and limited to -cachesize <MB>;
+    // -nocache renders every frame. -fields <dir> keeps the displacement
+    // field of every frame in dir and reuses those of earlier runs with the
+    // same features. -preset <name> trades the size of the frame files for
+    // encoding speed (fastest, balanced, smallest; see STImage.h)
+    //
+    bool runBenchmark = false;
+    bool runPreview = false;
+    bool runWatch = false;
+    bool useCache = true;
+    std::string cacheDirectory = kFrameCacheDirectory;
+    long long cacheBytes = kDefaultCacheBytes;
+    std::vector<char *> args;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-benchmark") {
+            runBenchmark = true;
+        } else if (arg == "-preview") {
+            runPreview = true;
+        } else if (arg == "-watch") {
+            runWatch = true;
+        } else if (arg == "-filter" && i + 1 < argc) {
+            std::string name = argv[++i];
+            for (int f = FILTER_NEAREST; f <= FILTER_LANCZOS3; f++) {
+                if (name == GetSampleFilterName((SampleFilter)f))
+                    gMorphOptions.filter = (SampleFilter)f;
+            }
+        } else if (arg == "-engine" && i + 1 < argc) {
+            std::string name = argv[++i];
+            for (int e = WARP_DIRECT; e <= WARP_MESH; e++) {
+                if (name == GetWarpEngineName((WarpEngine)e))
+                    gMorphOptions.engine = (WarpEngine)e;
+            }
+        } else if (arg == "-tolerance" && i + 1 < argc) {
+            gMorphOptions.tolerance = (float)atof(argv[++i]);
+        } else if (arg == "-epsilon" && i + 1 < argc) {
+            gMorphOptions.epsilon = (float)atof(argv[++i]);
+        } else if (arg == "-theta" && i + 1 < argc) {
+            gMorphOptions.theta = (float)atof(argv[++i]);
+        } else if (arg == "-budget" && i + 1 < argc) {
+            gFrameBudget = (float)atof(argv[++i]);
+        } else if (arg == "-cache" && i + 1 < argc) {
+            cacheDirectory = argv[++i];
+        } else if (arg == "-cachesize" && i + 1 < argc) {
+            cacheBytes = (long long)(atof(argv[++i]) * (1 << 20));
+        } else if (arg == "-nocache") {
+            useCache = false;
+        } else if (arg == "-fields" && i + 1 < argc) {
+            gFieldDirectory = argv[++i];
+            mkdir(gFieldDirectory.c_str(), 0755);
+        } else if (arg == "-preset" && i + 1 < argc) {
+            std::string name = argv[++i];
+            if (name == "fastest")
+                gSaveOptions = STImage::SaveOptions(STImage::SAVE_FASTEST);
+            else if (name == "balanced")
+                gSaveOptions = STImage::SaveOptions(STImage::SAVE_BALANCED);
+            else if (name == "smallest")
+                gSaveOptions = STImage::SaveOptions(STImage::SAVE_SMALLEST);
+        } else {
+            args.push_back(argv[i]);
+        }
+    }
+
     //
     // load the configuration from config.txt, or other file as specified
     //
     std::string configFile = "config.txt";
-    if (argc > 1) configFile = argv[1];
+    if (args.size() > 0) configFile = args[0];
+
+    //
+    // start the render threads once; they are reused for every frame.
+    // An optional second argument overrides the thread count.
+    //
+    int numThreads = kThreads;
+    if (args.size() > 1) numThreads = atoi(args[1]);
+    ThreadPool threadPool(numThreads);
+    gMorphOptions.pool = &threadPool;
 
     char sourceName[64], targetName[64];
     char saveName[64], loadName[64];
@@ -346,9 +640,55 @@ int main(int argc, char* argv[])
     // these weighting parameters (Beier & Nelly 1992) can be changed if desired
     const float a = 0.5f, b = 1.0f, p = 0.2f;
 
+    if (runBenchmark) {
+        int failures = RunBenchmarks(sourceImage, gSourceFeatures, targetImage,
+                                     gTargetFeatures, a, b, p, gMorphOptions);
+        return failures ? 1 : 0;
+    }
+
+    if (runPreview) {
+        // the preview renders from the idle callback, so everything it
+        // refers to lives as long as the program
+        FeatureLines *sourceLines = new FeatureLines(gSourceFeatures);
+        FeatureLines *targetLines = new FeatureLines(gTargetFeatures);
+        MorphPlan *plan = new MorphPlan(*sourceLines, *targetLines, 0.5f, a, b, p);
+        PaddedImage *paddedSource = new PaddedImage(sourceImage);
+        PaddedImage *paddedTarget = new PaddedImage(targetImage);
+        gPreview = new ProgressiveMorph(*plan, *paddedSource, *paddedTarget, gMorphOptions);
+        glutIdleFunc(PreviewIdleCallback);
+        glutMainLoop();
+        return 0;
+    }
+
+    if (runWatch) {
+        WatchMorphFrames(loadName, sourceImage, targetImage, a, b, p);
+        return 0;
+    }
+
+    //
+    // pick the tile size for this machine on a middle frame of the morph.
+    // The result is kept in tilesize.txt; delete that file to tune again.
+    // Only the frame generation below is long enough to be worth it.
+    //
+    {
+        FeatureLines sourceLines(gSourceFeatures);
+        FeatureLines targetLines(gTargetFeatures);
+        MorphPlan plan(sourceLines, targetLines, 0.5f, a, b, p);
+        PaddedImage paddedSource(sourceImage);
+        PaddedImage paddedTarget(targetImage);
+        gMorphOptions.tileSize = GetTunedTileSize(kTileSizeFile, plan, paddedSource,
+                                                  paddedTarget, gMorphOptions);
+        std::cout << "Using " << gMorphOptions.tileSize << "x"
+                  << gMorphOptions.tileSize << " tiles" << std::endl;
+    }
+
+    if (useCache)
+        gFrameCache = new FrameCache(cacheDirectory, cacheBytes);
     GenerateMorphFrames(sourceImage, gSourceFeatures,
                         targetImage, gTargetFeatures,
                         a, b, p);
+    delete gFrameCache;
+    gFrameCache = 0;
 
 
     //
@@ -0,0 +1,936 @@
+// --------------------------------------------------------------------------
+// morphEngine.cpp
+//
+// Pixel-level building blocks for the field morph and the fused morph engine.
+//
+
+#include "morphEngine.h"
+#include "adaptiveWarp.h"
+#include "clusterWarp.h"
+#include "displacementField.h"
+#include "featureBVH.h"
+#include "meshWarp.h"
+#include "STImage.h"
+#include "sampler.h"
+#include "scanlineWarp.h"
+#include "threadPool.h"
+#include "warpSimd.h"
+
+#include <math.h>
+#include <algorithm>
+#include <stdexcept>
+
+float Lerp(float c1, float c2, float t) {
+    return c1 + t * (c2 - c1);
+}
+
+STColor4ub colorLerp(STColor4ub c1, STColor4ub c2, float t) {
+    float r = Lerp(c1.r, c2.r, t);
+    float g = Lerp(c1.g, c2.g, t);
+    float b = Lerp(c1.b, c2.b, t);
+    STColor4ub result(r,g,b);
+    return result;
+}
+
+unsigned int GetBlendWeight(float t)
+{
+    float scaled = t * 256.f + 0.5f;
+    return scaled <= 0 ? 0 : (scaled >= 256 ? 256 : (unsigned int)scaled);
+}
+
+const char *GetWarpEngineName(WarpEngine engine)
+{
+    switch (engine) {
+        case WARP_DIRECT:   return "direct";
+        case WARP_SCANLINE: return "scanline";
+        case WARP_ADAPTIVE: return "adaptive";
+        case WARP_BVH:      return "bvh";
+        case WARP_CLUSTER:  return "cluster";
+        case WARP_MESH:     return "mesh";
+    }
+    return "unknown";
+}
+
+/**
+ * Splits the output into tiles and runs task on each of them that overlaps
+ * the region, spread over the option's thread pool if there is one.
+ */
+class TileDispatch : public ThreadTask
+{
+public:
+    TileDispatch(int width, int height, const PixelRect &region, int tileSize, TileTask &task)
+        : mWidth(width), mHeight(height), mTileSize(tileSize), mTask(task)
+    {
+        mFirstX = region.x0 / tileSize;
+        mFirstY = region.y0 / tileSize;
+        mTilesX = std::max(0, (region.x1 + tileSize - 1) / tileSize - mFirstX);
+        mTilesY = std::max(0, (region.y1 + tileSize - 1) / tileSize - mFirstY);
+    }
+
+    int GetTileCount() const { return mTilesX * mTilesY; }
+
+    void Run(int index)
+    {
+        int x0 = (mFirstX + index % mTilesX) * mTileSize;
+        int y0 = (mFirstY + index / mTilesX) * mTileSize;
+        mTask.RunTile(x0, y0,
+                      std::min(x0 + mTileSize, mWidth),
+                      std::min(y0 + mTileSize, mHeight));
+    }
+
+private:
+    int mWidth, mHeight, mTileSize;
+    int mFirstX, mFirstY;
+    int mTilesX, mTilesY;
+    TileTask &mTask;
+};
+
+void RunTiles(int width, int height, const MorphOptions &options, TileTask &task)
+{
+    RunTiles(width, height, PixelRect(0, 0, width, height), options, task);
+}
+
+void RunTiles(int width, int height, const PixelRect &region, const MorphOptions &options,
+              TileTask &task)
+{
+    if (region.x0 >= region.x1 || region.y0 >= region.y1)
+        return;
+    int tileSize = options.tileSize > 0 ? options.tileSize : kDefaultTileSize;
+    TileDispatch dispatch(width, height, region, tileSize, task);
+    if (options.pool) {
+        options.pool->ParallelFor(dispatch.GetTileCount(), &dispatch);
+    } else {
+        for (int i = 0; i < dispatch.GetTileCount(); i++)
+            dispatch.Run(i);
+    }
+}
+
+WarpKernels SelectWarpKernels(const MorphOptions &options)
+{
+    WarpKernels kernels = GetWarpKernels(options.simd);
+    if (options.engine == WARP_SCANLINE)
+        kernels.fieldRow = FieldRowScanline;
+    return kernels;
+}
+
+// Longest run of a row the warp tasks process at once, so that their
+// scratch buffers fit on the stack and rendering does not touch the heap.
+const int kRowChunk = 256;
+
+// Row chunks start on multiples of kRowChunkAlign, whatever the tiling: the
+// scanline engine restarts its forward differences every 64 pixels of a
+// chunk, and the vector kernels round a pixel by its lane.
+const int kRowChunkAlign = 64;
+
+/**
+ * The largest multiple of step not above value (value >= 0).
+ */
+static int AlignDown(int value, int step)
+{
+    return value - value % step;
+}
+
+/**
+ * End of the row chunk starting at x (a multiple of kRowChunkAlign) that
+ * covers pixels up to x1, in a row of width pixels: kRowChunk pixels at
+ * most, and ending on the grid or at the end of the row.
+ */
+static int GetRowChunkEnd(int x, int x1, int width)
+{
+    int end = AlignDown(x1 + kRowChunkAlign - 1, kRowChunkAlign);
+    return std::min(std::min(x + kRowChunk, end), width);
+}
+
+/**
+ * Samples a row of positions with the sampler policy. Bilinear sampling goes
+ * through the selected row kernel, which has vector versions; the other
+ * filters are inlined straight into the loop.
+ */
+template<class Sampler>
+struct RowSampler
+{
+    static void Run(const WarpKernels &, const PaddedImage &image,
+                    const float *xs, const float *ys, int count, STColor4ub *out)
+    {
+        SampleRow<Sampler>(image, xs, ys, count, (PackedPixel *)out);
+    }
+};
+
+template<>
+struct RowSampler<BilinearSampler>
+{
+    static void Run(const WarpKernels &kernels, const PaddedImage &image,
+                    const float *xs, const float *ys, int count, STColor4ub *out)
+    {
+        kernels.sampleRow(image, xs, ys, count, out);
+    }
+};
+
+// Edge length of the square blocks the adaptive, bvh and cluster engines
+// evaluate the field in, and their pixel count. The blocks lie on a grid
+// over the whole output, so that they are the same whatever the tiling.
+const int kFieldBlock = kAdaptiveBlock;
+const int kFieldBlockPixels = kFieldBlock * kFieldBlock;
+
+/**
+ * Scratch space of BlockField::Evaluate(). One is kept per tile, so its
+ * tables are only allocated once for all the blocks of the tile.
+ */
+struct BlockScratch
+{
+    BvhQuery bvh;
+    ClusterQuery clusters;
+    FeatureLines source, target;
+    MorphPlan culled;
+};
+
+/**
+ * Field evaluation for the engines that work on square blocks of output
+ * instead of rows, including the hierarchy over the frame's lines that the
+ * bvh and cluster engines query. Built once per frame.
+ */
+class BlockField
+{
+public:
+    BlockField(const MorphPlan &plan, const WarpKernels &kernels, const MorphOptions &options)
+        : mPlan(plan), mKernels(kernels), mEngine(options.engine)
+        , mTolerance(options.tolerance), mEpsilon(options.epsilon), mTheta(options.theta)
+    {
+        if (mEngine == WARP_BVH)
+            mBvh.Build(plan);
+        else if (mEngine == WARP_CLUSTER)
+            mClusters.Build(plan);
+    }
+
+    // Whether the engine evaluates blocks; the others go row by row.
+    bool IsEnabled() const
+    {
+        return mEngine == WARP_ADAPTIVE || mEngine == WARP_BVH || mEngine == WARP_CLUSTER;
+    }
+
+    // Computes the mapped positions of the width x height (at most
+    // kFieldBlock square) pixels starting at (x0, y0), row by row with a
+    // stride of width. targetX may be NULL.
+    void Evaluate(BlockScratch &scratch, int x0, int y0, int width, int height,
+                  float *sourceX, float *sourceY, float *targetX, float *targetY) const
+    {
+        if (mEngine == WARP_ADAPTIVE) {
+            AdaptiveFieldBlock(mPlan, mKernels.fieldPoints, mTolerance, x0, y0, width, height,
+                               sourceX, sourceY, targetX, targetY);
+        } else if (mEngine == WARP_CLUSTER) {
+            mClusters.EvaluateBlock(mKernels.fieldRowWeighted, mTheta, x0, y0, width, height,
+                                    sourceX, sourceY, targetX, targetY, scratch.clusters);
+        } else {
+            int count = mBvh.Cull(x0, y0, x0 + width - 1, y0 + height - 1, mEpsilon,
+                                  scratch.bvh);
+            scratch.culled.Select(mPlan, count ? &scratch.bvh.indices[0] : NULL, count,
+                                  &scratch.source, &scratch.target);
+            for (int j = 0; j < height; j++) {
+                int row = j * width;
+                mKernels.fieldRow(scratch.culled, x0, width, y0 + j,
+                                  sourceX + row, sourceY + row,
+                                  targetX ? targetX + row : NULL,
+                                  targetY ? targetY + row : NULL);
+            }
+        }
+    }
+
+private:
+    const MorphPlan &mPlan;
+    const WarpKernels &mKernels;
+    WarpEngine mEngine;
+    float mTolerance;
+    float mEpsilon;
+    float mTheta;
+    FeatureBVH mBvh;
+    FeatureClusters mClusters;
+};
+
+/**
+ * Mapped positions of count pixels starting at (x, y), by the affine maps
+ * of the mesh triangles they fall in. targetX may be NULL.
+ */
+static void MapMeshRow(const FeatureMesh &mesh, int x, int y, int count,
+                       float *sourceX, float *sourceY, float *targetX, float *targetY)
+{
+    const FeatureMesh::Span *spans = mesh.GetRowSpans(y);
+    int spanCount = mesh.GetRowSpanCount(y);
+    int s = 0;
+    while (s < spanCount && spans[s].x1 <= x)
+        s++;
+
+    for (; s < spanCount && spans[s].x0 < x + count; s++) {
+        const FeatureMesh::AffineMaps &maps = mesh.GetMaps(spans[s].triangle);
+        int begin = std::max(x, spans[s].x0) - x;
+        int end = std::min(x + count, spans[s].x1) - x;
+        float sx = maps.sx[1] * y + maps.sx[2], sy = maps.sy[1] * y + maps.sy[2];
+        for (int i = begin; i < end; i++) {
+            float px = (float)(x + i);
+            sourceX[i] = maps.sx[0] * px + sx;
+            sourceY[i] = maps.sy[0] * px + sy;
+        }
+        if (!targetX)
+            continue;
+        float tx = maps.tx[1] * y + maps.tx[2], ty = maps.ty[1] * y + maps.ty[2];
+        for (int i = begin; i < end; i++) {
+            float px = (float)(x + i);
+            targetX[i] = maps.tx[0] * px + tx;
+            targetY[i] = maps.ty[0] * px + ty;
+        }
+    }
+}
+
+/**
+ * Where the warp tasks store their pixels: the output pixels of a region,
+ * kept in a caller's view. Pixels outside the region are computed along
+ * with the tiles they share with it, then dropped.
+ */
+class RegionOutput
+{
+public:
+    RegionOutput(const PixelRect &region, const PixelView &view)
+        : mRegion(region), mView(view) { }
+
+    const PixelRect &GetRegion() const { return mRegion; }
+
+    // The output of the part of the region inside rect, e.g. a tile.
+    RegionOutput Clip(const PixelRect &rect) const
+    {
+        PixelRect region(std::max(rect.x0, mRegion.x0), std::max(rect.y0, mRegion.y0),
+                         std::min(rect.x1, mRegion.x1), std::min(rect.y1, mRegion.y1));
+        if (region.x0 >= region.x1 || region.y0 >= region.y1)
+            return RegionOutput(PixelRect(), PixelView());
+        return RegionOutput(region, PixelView(mView.pixels + (region.y0 - mRegion.y0) * mView.stride +
+                                              (region.x0 - mRegion.x0),
+                                              region.GetWidth(), region.GetHeight(), mView.stride));
+    }
+
+    bool IsEmpty() const { return mRegion.x0 >= mRegion.x1 || mRegion.y0 >= mRegion.y1; }
+
+    // Whether the width x height pixels starting at (x, y) overlap the
+    // region.
+    bool Overlaps(int x, int y, int width, int height) const
+    {
+        return x < mRegion.x1 && x + width > mRegion.x0 &&
+               y < mRegion.y1 && y + height > mRegion.y0;
+    }
+
+    // Where the count pixels starting at output pixel (x, y) are stored if
+    // they all lie in the region; NULL otherwise.
+    STColor4ub *GetRun(int x, int y, int count) const
+    {
+        if (y < mRegion.y0 || y >= mRegion.y1 || x < mRegion.x0 || x + count > mRegion.x1)
+            return NULL;
+        return mView.pixels + (y - mRegion.y0) * mView.stride + (x - mRegion.x0);
+    }
+
+    // Stores those of the count pixels starting at (x, y) that lie in the
+    // region.
+    void Store(int x, int y, int count, const STColor4ub *colors) const
+    {
+        if (y < mRegion.y0 || y >= mRegion.y1)
+            return;
+        int begin = std::max(x, mRegion.x0), end = std::min(x + count, mRegion.x1);
+        PackedPixel *row = (PackedPixel *)(mView.pixels + (y - mRegion.y0) * mView.stride);
+        const PackedPixel *packed = (const PackedPixel *)colors;
+        for (int i = begin; i < end; i++)
+            row[i - mRegion.x0] = packed[i - x];
+    }
+
+private:
+    PixelRect mRegion;
+    PixelView mView;
+};
+
+/**
+ * Checks that region lies within a width x height output and that view
+ * has its size.
+ */
+static void CheckRegion(const PixelRect &region, const PixelView &view, int width, int height)
+{
+    if (region.x0 < 0 || region.y0 < 0 || region.x1 > width || region.y1 > height ||
+        region.x0 > region.x1 || region.y0 > region.y1)
+        throw std::runtime_error("output region is outside the image");
+    if (view.width != region.GetWidth() || view.height != region.GetHeight() ||
+        view.stride < view.width || (!view.pixels && view.width && view.height))
+        throw std::runtime_error("output view does not match the region");
+}
+
+/**
+ * View of all of image's pixels.
+ */
+static PixelView GetImageView(STImage *image)
+{
+    return PixelView(image->GetPixels(), image->GetWidth(), image->GetHeight(),
+                     image->GetWidth());
+}
+
+static void CheckApron(const PaddedImage &image, SampleFilter filter)
+{
+    if (image.GetApron() < GetSampleFilterApron(filter))
+        throw std::runtime_error("PaddedImage apron is too narrow for the sampling filter");
+}
+
+/**
+ * Plan-driven field warp: maps every pixel of the output onto the plan's
+ * source lines and samples image there.
+ */
+template<class Sampler>
+class WarpTask : public TileTask
+{
+public:
+    WarpTask(const MorphPlan &plan, const PaddedImage &image, int width, int height,
+             const RegionOutput &output, const MorphOptions &options)
+        : mPlan(plan), mImage(image), mWidth(width), mHeight(height), mOutput(output)
+        , mKernels(SelectWarpKernels(options)), mField(plan, mKernels, options)
+        , mUseMesh(options.engine == WARP_MESH)
+    {
+        if (mUseMesh)
+            mMesh.Build(plan, width, height, mKernels.fieldPoints);
+    }
+
+    void RunTile(int x0, int y0, int x1, int y1)
+    {
+        // blocks and row chunks that stick out of the tile are evaluated
+        // whole, as for any other tiling, and only stored inside it
+        RegionOutput output = mOutput.Clip(PixelRect(x0, y0, x1, y1));
+        if (output.IsEmpty())
+            return;
+        const PixelRect &region = output.GetRegion();
+        if (mField.IsEnabled()) {
+            BlockScratch scratch;
+            float xs[kFieldBlockPixels], ys[kFieldBlockPixels];
+            for (int by = AlignDown(region.y0, kFieldBlock); by < region.y1; by += kFieldBlock) {
+                for (int bx = AlignDown(region.x0, kFieldBlock); bx < region.x1;
+                     bx += kFieldBlock) {
+                    int w = std::min(kFieldBlock, mWidth - bx);
+                    int h = std::min(kFieldBlock, mHeight - by);
+                    mField.Evaluate(scratch, bx, by, w, h, xs, ys, NULL, NULL);
+                    for (int j = 0; j < h; j++)
+                        SampleRow(output, bx, by + j, w, xs + j*w, ys + j*w);
+                }
+            }
+            return;
+        }
+
+        float xs[kRowChunk], ys[kRowChunk];
+        for (int y = region.y0; y < region.y1; y++) {
+            int end;
+            for (int x = AlignDown(region.x0, kRowChunkAlign); x < region.x1; x = end) {
+                end = GetRowChunkEnd(x, region.x1, mWidth);
+                if (mUseMesh)
+                    MapMeshRow(mMesh, x, y, end - x, xs, ys, NULL, NULL);
+                else
+                    mKernels.fieldRow(mPlan, x, end - x, y, xs, ys, NULL, NULL);
+                SampleRow(output, x, y, end - x, xs, ys);
+            }
+        }
+    }
+
+private:
+    // Samples the image at the mapped positions of count (<= kRowChunk)
+    // output pixels starting at (x, y), if they overlap output.
+    void SampleRow(const RegionOutput &output, int x, int y, int count,
+                   const float *xs, const float *ys)
+    {
+        if (!output.Overlaps(x, y, count, 1))
+            return;
+        STColor4ub *row = output.GetRun(x, y, count);
+        if (row) {
+            RowSampler<Sampler>::Run(mKernels, mImage, xs, ys, count, row);
+        } else {
+            STColor4ub colors[kRowChunk];
+            RowSampler<Sampler>::Run(mKernels, mImage, xs, ys, count, colors);
+            output.Store(x, y, count, colors);
+        }
+    }
+
+    const MorphPlan &mPlan;
+    const PaddedImage &mImage;
+    int mWidth, mHeight;
+    RegionOutput mOutput;
+    WarpKernels mKernels;
+    BlockField mField;
+    bool mUseMesh;
+    FeatureMesh mMesh;
+};
+
+template<class Sampler>
+static void RunWarp(const MorphPlan &plan, const PaddedImage &image, const PixelRect &region,
+                    const PixelView &view, const MorphOptions &options)
+{
+    int width = image.GetWidth(), height = image.GetHeight();
+    WarpTask<Sampler> task(plan, image, width, height, RegionOutput(region, view), options);
+    RunTiles(width, height, region, options, task);
+}
+
+STImage *WarpImage(STImage *image, const MorphPlan &plan, const MorphOptions &options)
+{
+    PaddedImage padded(image);
+    STImage *result = new STImage(image->GetWidth(), image->GetHeight());
+    WarpImage(padded, plan, PixelRect(0, 0, image->GetWidth(), image->GetHeight()),
+              GetImageView(result), options);
+    return result;
+}
+
+void WarpImage(const PaddedImage &image, const MorphPlan &plan, const PixelRect &region,
+               const PixelView &view, const MorphOptions &options)
+{
+    CheckApron(image, options.filter);
+    CheckRegion(region, view, image.GetWidth(), image.GetHeight());
+
+    switch (options.filter) {
+        case FILTER_NEAREST:
+            RunWarp<NearestSampler>(plan, image, region, view, options);
+            break;
+        case FILTER_BICUBIC:
+            RunWarp<BicubicSampler>(plan, image, region, view, options);
+            break;
+        case FILTER_LANCZOS3:
+            RunWarp<Lanczos3Sampler>(plan, image, region, view, options);
+            break;
+        default:
+            RunWarp<BilinearSampler>(plan, image, region, view, options);
+            break;
+    }
+}
+
+/**
+ * Fused morph: one evaluation of each feature per output pixel drives both
+ * the source and the target warp, and the two samples are blended in place.
+ */
+template<class Sampler>
+class FusedMorphTask : public TileTask
+{
+public:
+    FusedMorphTask(const MorphPlan &plan, const PaddedImage &sourceImage,
+                   const PaddedImage &targetImage, int width, int height,
+                   const RegionOutput &output, const MorphOptions &options)
+        : mPlan(plan), mSourceImage(sourceImage), mTargetImage(targetImage)
+        , mWidth(width), mHeight(height), mOutput(output), mKernels(SelectWarpKernels(options))
+        , mWeight(GetBlendWeight(plan.t)), mField(plan, mKernels, options)
+        , mUseMesh(options.engine == WARP_MESH)
+    {
+        if (mUseMesh)
+            mMesh.Build(plan, width, height, mKernels.fieldPoints);
+    }
+
+    void RunTile(int x0, int y0, int x1, int y1)
+    {
+        // same blocks and chunks as for any other tiling (see WarpTask)
+        RegionOutput output = mOutput.Clip(PixelRect(x0, y0, x1, y1));
+        if (output.IsEmpty())
+            return;
+        const PixelRect &region = output.GetRegion();
+        if (mField.IsEnabled()) {
+            BlockScratch scratch;
+            float sourceX[kFieldBlockPixels], sourceY[kFieldBlockPixels];
+            float targetX[kFieldBlockPixels], targetY[kFieldBlockPixels];
+            for (int by = AlignDown(region.y0, kFieldBlock); by < region.y1; by += kFieldBlock) {
+                for (int bx = AlignDown(region.x0, kFieldBlock); bx < region.x1;
+                     bx += kFieldBlock) {
+                    int w = std::min(kFieldBlock, mWidth - bx);
+                    int h = std::min(kFieldBlock, mHeight - by);
+                    mField.Evaluate(scratch, bx, by, w, h, sourceX, sourceY, targetX, targetY);
+                    for (int j = 0; j < h; j++) {
+                        ShadeRow(output, bx, by + j, w, sourceX + j*w, sourceY + j*w,
+                                 targetX + j*w, targetY + j*w);
+                    }
+                }
+            }
+            return;
+        }
+
+        float sourceX[kRowChunk], sourceY[kRowChunk];
+        float targetX[kRowChunk], targetY[kRowChunk];
+        for (int y = region.y0; y < region.y1; y++) {
+            int end;
+            for (int x = AlignDown(region.x0, kRowChunkAlign); x < region.x1; x = end) {
+                end = GetRowChunkEnd(x, region.x1, mWidth);
+                if (mUseMesh)
+                    MapMeshRow(mMesh, x, y, end - x, sourceX, sourceY, targetX, targetY);
+                else
+                    mKernels.fieldRow(mPlan, x, end - x, y, sourceX, sourceY, targetX, targetY);
+                ShadeRow(output, x, y, end - x, sourceX, sourceY, targetX, targetY);
+            }
+        }
+    }
+
+private:
+    // Samples both images at the mapped positions of count (<= kRowChunk)
+    // output pixels starting at (x, y) and blends them into the result, if
+    // they overlap output.
+    void ShadeRow(const RegionOutput &output, int x, int y, int count,
+                  const float *sourceX, const float *sourceY,
+                  const float *targetX, const float *targetY)
+    {
+        if (!output.Overlaps(x, y, count, 1))
+            return;
+        STColor4ub *row = output.GetRun(x, y, count);
+        if (row) {
+            Shade(count, sourceX, sourceY, targetX, targetY, row);
+        } else {
+            STColor4ub colors[kRowChunk];
+            Shade(count, sourceX, sourceY, targetX, targetY, colors);
+            output.Store(x, y, count, colors);
+        }
+    }
+
+    // Blends the samples of count pixels into row.
+    void Shade(int count, const float *sourceX, const float *sourceY,
+               const float *targetX, const float *targetY, STColor4ub *row)
+    {
+        STColor4ub sourceColors[kRowChunk], targetColors[kRowChunk];
+        RowSampler<Sampler>::Run(mKernels, mSourceImage, sourceX, sourceY,
+                                 count, sourceColors);
+        RowSampler<Sampler>::Run(mKernels, mTargetImage, targetX, targetY,
+                                 count, targetColors);
+        mKernels.blendRow(sourceColors, targetColors, mWeight, count, row);
+    }
+
+    const MorphPlan &mPlan;
+    const PaddedImage &mSourceImage;
+    const PaddedImage &mTargetImage;
+    int mWidth, mHeight;
+    RegionOutput mOutput;
+    WarpKernels mKernels;
+    unsigned int mWeight;       // t for the blend row kernel
+    BlockField mField;
+    bool mUseMesh;
+    FeatureMesh mMesh;
+};
+
+template<class Sampler>
+static void RunFusedMorph(const MorphPlan &plan, const PaddedImage &sourceImage,
+                          const PaddedImage &targetImage, const PixelRect &region,
+                          const PixelView &view, const MorphOptions &options)
+{
+    int width = std::min(sourceImage.GetWidth(), targetImage.GetWidth());
+    int height = std::min(sourceImage.GetHeight(), targetImage.GetHeight());
+    FusedMorphTask<Sampler> task(plan, sourceImage, targetImage, width, height,
+                                 RegionOutput(region, view), options);
+    RunTiles(width, height, region, options, task);
+}
+
+STImage *FusedMorph(const MorphPlan &plan, STImage *sourceImage, STImage *targetImage,
+                    const MorphOptions &options)
+{
+    PaddedImage paddedSource(sourceImage);
+    PaddedImage paddedTarget(targetImage);
+    return FusedMorph(plan, paddedSource, paddedTarget, options);
+}
+
+STImage *FusedMorph(const MorphPlan &plan, const PaddedImage &sourceImage,
+                    const PaddedImage &targetImage, const MorphOptions &options)
+{
+    CheckApron(sourceImage, options.filter);
+    CheckApron(targetImage, options.filter);
+    int width = std::min(sourceImage.GetWidth(), targetImage.GetWidth());
+    int height = std::min(sourceImage.GetHeight(), targetImage.GetHeight());
+    STImage *result = new STImage(width, height);
+    FusedMorph(plan, sourceImage, targetImage, result, options);
+    return result;
+}
+
+void FusedMorph(const MorphPlan &plan, const PaddedImage &sourceImage,
+                const PaddedImage &targetImage, STImage *result,
+                const MorphOptions &options)
+{
+    if (result->GetWidth() != std::min(sourceImage.GetWidth(), targetImage.GetWidth()) ||
+        result->GetHeight() != std::min(sourceImage.GetHeight(), targetImage.GetHeight()))
+        throw std::runtime_error("FusedMorph result has the wrong size");
+    FusedMorph(plan, sourceImage, targetImage,
+               PixelRect(0, 0, result->GetWidth(), result->GetHeight()),
+               GetImageView(result), options);
+}
+
+void FusedMorph(const MorphPlan &plan, const PaddedImage &sourceImage,
+                const PaddedImage &targetImage, const PixelRect &region,
+                const PixelView &view, const MorphOptions &options)
+{
+    CheckApron(sourceImage, options.filter);
+    CheckApron(targetImage, options.filter);
+    CheckRegion(region, view, std::min(sourceImage.GetWidth(), targetImage.GetWidth()),
+                std::min(sourceImage.GetHeight(), targetImage.GetHeight()));
+
+    switch (options.filter) {
+        case FILTER_NEAREST:
+            RunFusedMorph<NearestSampler>(plan, sourceImage, targetImage, region, view, options);
+            break;
+        case FILTER_BICUBIC:
+            RunFusedMorph<BicubicSampler>(plan, sourceImage, targetImage, region, view, options);
+            break;
+        case FILTER_LANCZOS3:
+            RunFusedMorph<Lanczos3Sampler>(plan, sourceImage, targetImage, region, view,
+                                           options);
+            break;
+        default:
+            RunFusedMorph<BilinearSampler>(plan, sourceImage, targetImage, region, view,
+                                           options);
+            break;
+    }
+}
+
+/**
+ * Field evaluation on its own: the mapped positions of both sides, stored
+ * per row as the displacement field encodes them. Evaluates the same blocks
+ * and chunks as FusedMorphTask, so the positions are the ones it samples.
+ */
+class ComputeFieldTask : public TileTask
+{
+public:
+    ComputeFieldTask(const MorphPlan &plan, int width, int height,
+                     std::vector<float> &positions, const MorphOptions &options)
+        : mPlan(plan), mWidth(width), mHeight(height), mPositions(positions)
+        , mKernels(SelectWarpKernels(options)), mField(plan, mKernels, options)
+        , mUseMesh(options.engine == WARP_MESH)
+    {
+        if (mUseMesh)
+            mMesh.Build(plan, width, height, mKernels.fieldPoints);
+    }
+
+    void RunTile(int x0, int y0, int x1, int y1)
+    {
+        // same blocks and chunks as for any other tiling (see WarpTask)
+        if (mField.IsEnabled()) {
+            BlockScratch scratch;
+            float sourceX[kFieldBlockPixels], sourceY[kFieldBlockPixels];
+            float targetX[kFieldBlockPixels], targetY[kFieldBlockPixels];
+            for (int by = AlignDown(y0, kFieldBlock); by < y1; by += kFieldBlock) {
+                for (int bx = AlignDown(x0, kFieldBlock); bx < x1; bx += kFieldBlock) {
+                    int w = std::min(kFieldBlock, mWidth - bx);
+                    int h = std::min(kFieldBlock, mHeight - by);
+                    mField.Evaluate(scratch, bx, by, w, h, sourceX, sourceY, targetX, targetY);
+                    for (int y = std::max(y0, by); y < std::min(y1, by + h); y++) {
+                        int j = (y - by) * w;
+                        StoreRow(y, bx, std::max(x0, bx), std::min(x1, bx + w),
+                                 sourceX + j, sourceY + j, targetX + j, targetY + j);
+                    }
+                }
+            }
+            return;
+        }
+
+        float sourceX[kRowChunk], sourceY[kRowChunk];
+        float targetX[kRowChunk], targetY[kRowChunk];
+        for (int y = y0; y < y1; y++) {
+            int end;
+            for (int x = AlignDown(x0, kRowChunkAlign); x < x1; x = end) {
+                end = GetRowChunkEnd(x, x1, mWidth);
+                if (mUseMesh)
+                    MapMeshRow(mMesh, x, y, end - x, sourceX, sourceY, targetX, targetY);
+                else
+                    mKernels.fieldRow(mPlan, x, end - x, y, sourceX, sourceY, targetX, targetY);
+                StoreRow(y, x, std::max(x0, x), std::min(x1, end),
+                         sourceX, sourceY, targetX, targetY);
+            }
+        }
+    }
+
+private:
+    float *GetRow(int y) { return &mPositions[(size_t)y * 4 * mWidth]; }
+
+    // Stores the positions of pixels [begin,end) of row y, out of those of
+    // a run of pixels starting at x.
+    void StoreRow(int y, int x, int begin, int end, const float *sourceX,
+                  const float *sourceY, const float *targetX, const float *targetY)
+    {
+        float *row = GetRow(y);
+        int first = begin - x, last = end - x;
+        std::copy(sourceX + first, sourceX + last, row + begin);
+        std::copy(sourceY + first, sourceY + last, row + mWidth + begin);
+        std::copy(targetX + first, targetX + last, row + 2*mWidth + begin);
+        std::copy(targetY + first, targetY + last, row + 3*mWidth + begin);
+    }
+
+    const MorphPlan &mPlan;
+    int mWidth, mHeight;
+    std::vector<float> &mPositions;
+    WarpKernels mKernels;
+    BlockField mField;
+    bool mUseMesh;
+    FeatureMesh mMesh;
+};
+
+void ComputeField(const MorphPlan &plan, int width, int height, DisplacementField *field,
+                  const MorphOptions &options)
+{
+    std::vector<float> positions((size_t)4 * width * height);
+    ComputeFieldTask task(plan, width, height, positions, options);
+    RunTiles(width, height, options, task);
+    field->Encode(width, height, plan.t, positions);
+}
+
+/**
+ * The sampling pass on its own: decodes the positions of a displacement
+ * field and samples one image there, or both images blended at the
+ * field's t.
+ */
+template<class Sampler>
+class FieldSampleTask : public TileTask
+{
+public:
+    FieldSampleTask(const DisplacementField &field, const PaddedImage &sourceImage,
+                    const PaddedImage *targetImage, STImage *result,
+                    const MorphOptions &options)
+        : mField(field), mSourceImage(sourceImage), mTargetImage(targetImage)
+        , mResult(result), mKernels(SelectWarpKernels(options))
+        , mWeight(GetBlendWeight(field.GetT())) { }
+
+    void RunTile(int x0, int y0, int x1, int y1)
+    {
+        float sourceX[kRowChunk], sourceY[kRowChunk];
+        float targetX[kRowChunk], targetY[kRowChunk];
+        STColor4ub sourceColors[kRowChunk], targetColors[kRowChunk];
+        for (int y = y0; y < y1; y++) {
+            STColor4ub *row = mResult->GetPixels() + y * mResult->GetWidth();
+            for (int x = x0; x < x1; x += kRowChunk) {
+                int count = std::min(kRowChunk, x1 - x);
+                if (!mTargetImage) {
+                    mField.Decode(x, y, count, sourceX, sourceY, NULL, NULL);
+                    RowSampler<Sampler>::Run(mKernels, mSourceImage, sourceX, sourceY,
+                                             count, row + x);
+                    continue;
+                }
+                mField.Decode(x, y, count, sourceX, sourceY, targetX, targetY);
+                RowSampler<Sampler>::Run(mKernels, mSourceImage, sourceX, sourceY,
+                                         count, sourceColors);
+                RowSampler<Sampler>::Run(mKernels, *mTargetImage, targetX, targetY,
+                                         count, targetColors);
+                mKernels.blendRow(sourceColors, targetColors, mWeight, count, row + x);
+            }
+        }
+    }
+
+private:
+    const DisplacementField &mField;
+    const PaddedImage &mSourceImage;
+    const PaddedImage *mTargetImage;
+    STImage *mResult;
+    WarpKernels mKernels;
+    unsigned int mWeight;       // the field's t for the blend row kernel
+};
+
+template<class Sampler>
+static void RunFieldSample(const DisplacementField &field, const PaddedImage &sourceImage,
+                           const PaddedImage *targetImage, STImage *result,
+                           const MorphOptions &options)
+{
+    FieldSampleTask<Sampler> task(field, sourceImage, targetImage, result, options);
+    RunTiles(field.GetWidth(), field.GetHeight(), options, task);
+}
+
+/**
+ * Samples through field into result with the options' filter, after
+ * checking that the images and the result fit the field.
+ */
+static void SampleField(const DisplacementField &field, const PaddedImage &sourceImage,
+                        const PaddedImage *targetImage, STImage *result,
+                        const MorphOptions &options)
+{
+    CheckApron(sourceImage, options.filter);
+    int width = sourceImage.GetWidth(), height = sourceImage.GetHeight();
+    if (targetImage) {
+        CheckApron(*targetImage, options.filter);
+        width = std::min(width, targetImage->GetWidth());
+        height = std::min(height, targetImage->GetHeight());
+    }
+    if (field.GetWidth() != width || field.GetHeight() != height)
+        throw std::runtime_error("displacement field does not match the image size");
+    if (result->GetWidth() != width || result->GetHeight() != height)
+        throw std::runtime_error("field morph result has the wrong size");
+
+    switch (options.filter) {
+        case FILTER_NEAREST:
+            RunFieldSample<NearestSampler>(field, sourceImage, targetImage, result, options);
+            break;
+        case FILTER_BICUBIC:
+            RunFieldSample<BicubicSampler>(field, sourceImage, targetImage, result, options);
+            break;
+        case FILTER_LANCZOS3:
+            RunFieldSample<Lanczos3Sampler>(field, sourceImage, targetImage, result, options);
+            break;
+        default:
+            RunFieldSample<BilinearSampler>(field, sourceImage, targetImage, result, options);
+            break;
+    }
+}
+
+STImage *WarpImage(const PaddedImage &image, const DisplacementField &field,
+                   const MorphOptions &options)
+{
+    CheckApron(image, options.filter);
+    if (field.GetWidth() != image.GetWidth() || field.GetHeight() != image.GetHeight())
+        throw std::runtime_error("displacement field does not match the image size");
+    STImage *result = new STImage(field.GetWidth(), field.GetHeight());
+    SampleField(field, image, NULL, result, options);
+    return result;
+}
+
+void FusedMorph(const DisplacementField &field, const PaddedImage &sourceImage,
+                const PaddedImage &targetImage, STImage *result, const MorphOptions &options)
+{
+    SampleField(field, sourceImage, &targetImage, result, options);
+}
+
+/**
+ * Cross-dissolve of two images, tile by tile, with whole rows handed to the
+ * blend row kernel.
+ */
+class BlendTask : public TileTask
+{
+public:
+    BlendTask(const STImage *image1, const STImage *image2, unsigned int weight,
+              STColor4ub *result, int resultWidth, const WarpKernels &kernels)
+        : mImage1(image1), mImage2(image2), mWeight(weight)
+        , mResult(result), mResultWidth(resultWidth), mKernels(kernels) { }
+
+    void RunTile(int x0, int y0, int x1, int y1)
+    {
+        const STImage::Pixel *pixels1 = mImage1->GetPixels();
+        const STImage::Pixel *pixels2 = mImage2->GetPixels();
+        int width1 = mImage1->GetWidth(), width2 = mImage2->GetWidth();
+        for (int y = y0; y < y1; y++) {
+            mKernels.blendRow(&pixels1[y*width1 + x0], &pixels2[y*width2 + x0],
+                              mWeight, x1 - x0, &mResult[y*mResultWidth + x0]);
+        }
+    }
+
+private:
+    const STImage *mImage1;
+    const STImage *mImage2;
+    unsigned int mWeight;
+    STColor4ub *mResult;
+    int mResultWidth;
+    WarpKernels mKernels;
+};
+
+void BlendImages(const STImage *image1, const STImage *image2, float t,
+                 STColor4ub *result, const MorphOptions &options)
+{
+    int width = std::min(image1->GetWidth(), image2->GetWidth());
+    int height = std::min(image1->GetHeight(), image2->GetHeight());
+
+    BlendTask task(image1, image2, GetBlendWeight(t), result, width,
+                   SelectWarpKernels(options));
+    RunTiles(width, height, options, task);
+}
+
+STImage *BlendImages(STImage *image1, STImage *image2, float t, const MorphOptions &options)
+{
+    int width = std::min(image1->GetWidth(), image2->GetWidth());
+    int height = std::min(image1->GetHeight(), image2->GetHeight());
+    STImage *result = new STImage(width, height);
+    BlendImages(image1, image2, t, result->GetPixels(), options);
+    return result;
+}
+
+STImage *FusedMorph(STImage *sourceImage, const std::vector<Feature> &sourceFeatures,
+                    STImage *targetImage, const std::vector<Feature> &targetFeatures,
+                    float t, float a, float b, float p)
+{
+    FeatureLines sourceLines(sourceFeatures);
+    FeatureLines targetLines(targetFeatures);
+    MorphPlan plan(sourceLines, targetLines, t, a, b, p);
+    return FusedMorph(plan, sourceImage, targetImage, MorphOptions());
+}
@@ -0,0 +1,241 @@
+// --------------------------------------------------------------------------
+// morphEngine.h
+//
+// Pixel-level building blocks for the Beier & Neely field morph, plus a
+// fused engine that computes a complete morph frame in a single pass.
+//
+
+#ifndef __MORPHENGINE_H__
+#define __MORPHENGINE_H__
+
+#include "feature.h"
+#include "adaptiveWarp.h"
+#include "clusterWarp.h"
+#include "featureBVH.h"
+#include "meshWarp.h"
+#include "morphPlan.h"
+#include "sampler.h"
+#include "warpSimd.h"
+#include "STColor4ub.h"
+
+#include <vector>
+
+class DisplacementField;
+class STImage;
+class ThreadPool;
+
+// Default edge length, in pixels, of the square output tiles.
+const int kDefaultTileSize = 64;
+
+// Revision of the pixels the engines render. Bump it with every change that
+// alters the output of any engine, so that frames cached by earlier
+// revisions (see frameCache.h) are no longer served.
+const int kMorphEngineVersion = 4;
+
+// How the displacement field is evaluated for each row of output pixels.
+enum WarpEngine
+{
+    WARP_DIRECT,        // every feature evaluated from scratch per pixel
+    WARP_SCANLINE,      // u and v forward-differenced along the row; scalar
+                        // only, so faster than WARP_DIRECT on scalar hosts
+                        // alone (see scanlineWarp.h)
+    WARP_ADAPTIVE,      // exact on a quadtree, interpolated in between
+    WARP_BVH,           // negligible features culled per block of pixels
+    WARP_CLUSTER,       // clusters of distant features merged into one term
+    WARP_MESH           // piecewise affine over a triangulation of the features
+};
+
+// Printable name of an engine ("direct", "scanline", ...).
+const char *GetWarpEngineName(WarpEngine engine);
+
+// Per-render settings shared by the morph engines. Threading and tiling do
+// not change the result: they produce byte-identical images. The vector
+// kernels match the scalar ones within the tolerance given in warpSimd.h.
+// The filter selects the sampler policy the engine is instantiated with;
+// only FILTER_BILINEAR has vector kernels. The WARP_ADAPTIVE engine
+// approximates the field; its mapped positions stay within tolerance
+// pixels of the exact ones (see adaptiveWarp.h). WARP_BVH leaves out
+// features carrying less than epsilon of the total weight over a block of
+// output, which bounds its error by epsilon times the spread of the
+// features' displacements (see featureBVH.h). WARP_CLUSTER replaces
+// clusters of features whose radius is below theta times their distance by
+// one aggregate term each (see clusterWarp.h). WARP_MESH is a different warp
+// rather than an approximation of the field: it is affine within the
+// triangles between the feature endpoints (see meshWarp.h).
+struct MorphOptions
+{
+    ThreadPool *pool;   // spreads tiles over the pool; NULL runs serially
+    int tileSize;       // output is processed in tileSize x tileSize tiles
+    SimdLevel simd;     // kernel flavor; SIMD_AUTO picks via CPUID
+    WarpEngine engine;  // field evaluator
+    SampleFilter filter;// reconstruction filter for the warped images
+    float tolerance;    // WARP_ADAPTIVE interpolation error, in pixels
+    float epsilon;      // WARP_BVH culled fraction of the total weight
+    float theta;        // WARP_CLUSTER largest cluster radius over distance
+
+    MorphOptions()
+        : pool(0), tileSize(kDefaultTileSize), simd(SIMD_AUTO), engine(WARP_DIRECT)
+        , filter(FILTER_BILINEAR), tolerance(kDefaultTolerance)
+        , epsilon(kDefaultCullEpsilon), theta(kDefaultClusterTheta) { }
+};
+
+// Rectangle of output pixels [x0,x1) x [y0,y1).
+struct PixelRect
+{
+    int x0, y0, x1, y1;
+
+    PixelRect() : x0(0), y0(0), x1(0), y1(0) { }
+    PixelRect(int left, int top, int right, int bottom)
+        : x0(left), y0(top), x1(right), y1(bottom) { }
+
+    int GetWidth() const { return x1 - x0; }
+    int GetHeight() const { return y1 - y0; }
+};
+
+// Caller-owned destination for a width x height block of pixels, e.g. a
+// crop of a larger image: row j starts at pixels + j * stride, with stride
+// counted in pixels and at least width.
+struct PixelView
+{
+    STColor4ub *pixels;
+    int width, height;
+    int stride;
+
+    PixelView() : pixels(0), width(0), height(0), stride(0) { }
+    PixelView(STColor4ub *data, int w, int h, int rowStride)
+        : pixels(data), width(w), height(h), stride(rowStride) { }
+};
+
+// Per-tile work for RunTiles(). RunTile() computes the output pixels in
+// [x0,x1) x [y0,y1) and may be called concurrently for different tiles.
+class TileTask
+{
+public:
+    virtual ~TileTask() { }
+    virtual void RunTile(int x0, int y0, int x1, int y1) = 0;
+};
+
+// Covers a width x height output with tiles and runs task on each of them,
+// in parallel when options has a thread pool.
+void RunTiles(int width, int height, const MorphOptions &options, TileTask &task);
+
+// Runs task on those tiles of the width x height output that overlap
+// region, each with the same bounds as in the call above, so a task that
+// only stores pixels inside region computes them exactly as it would for
+// the whole output.
+void RunTiles(int width, int height, const PixelRect &region, const MorphOptions &options,
+              TileTask &task);
+
+// The row kernels the engines use for the given options. WARP_SCANLINE
+// gets its scalar row kernel whatever options.simd says.
+WarpKernels SelectWarpKernels(const MorphOptions &options);
+
+// Linear interpolation between c1 (t = 0) and c2 (t = 1).
+float Lerp(float c1, float c2, float t);
+
+// Interpolates the RGB channels of two colors. The alpha of the result is
+// always 255.
+STColor4ub colorLerp(STColor4ub c1, STColor4ub c2, float t);
+
+// t as the 8.8 fixed point weight of BlendRowKernel (see warpSimd.h),
+// rounded and clamped to [0,1].
+unsigned int GetBlendWeight(float t);
+
+// Warps image by the field described by plan: each output pixel is mapped
+// from the plan's interpolated lines onto its source lines and sampled
+// there with the options' filter (see sampler.h). Equivalent to
+// FieldMorph() with the features the plan was built from. The caller owns
+// the returned image.
+STImage *WarpImage(STImage *image, const MorphPlan &plan,
+                   const MorphOptions &options = MorphOptions());
+
+// Computes only region of the WarpImage() output into view, which must
+// have the size of region; region must lie within the image. The pixels
+// are identical to those of the full image with the same options. Throws
+// std::runtime_error on a bad region or view, or an apron that is too
+// narrow for the options' filter.
+void WarpImage(const PaddedImage &image, const MorphPlan &plan, const PixelRect &region,
+               const PixelView &view, const MorphOptions &options = MorphOptions());
+
+// Computes the morph of sourceImage toward targetImage at parameter t in a
+// single pass over the output. For every output pixel each feature is
+// evaluated once: the interpolated line, its (u,v) coordinates and its weight
+// are shared between the source warp and the target warp, and the two warped
+// samples are blended straight into the result without intermediate images.
+//
+// The samples are blended as BlendImages() blends, alpha included and with t
+// rounded to a multiple of 1/256, so the result matches
+// BlendImages(FieldMorph(source, ..., t), FieldMorph(target, ..., 1-t), t) up
+// to the float rounding of the warps. It has the size of the smaller of the
+// two input images. The caller owns the returned image.
+STImage *FusedMorph(const MorphPlan &plan, STImage *sourceImage, STImage *targetImage,
+                    const MorphOptions &options = MorphOptions());
+
+// FusedMorph() on images that are already padded for sampling, so that a
+// sequence of frames pads its two inputs only once. Throws
+// std::runtime_error if an apron is too narrow for the options' filter.
+STImage *FusedMorph(const MorphPlan &plan, const PaddedImage &sourceImage,
+                    const PaddedImage &targetImage,
+                    const MorphOptions &options = MorphOptions());
+
+// FusedMorph() into an existing image, e.g. one recycled from an ImagePool
+// (see imagePool.h). result must have the size of the smaller input; throws
+// std::runtime_error otherwise.
+void FusedMorph(const MorphPlan &plan, const PaddedImage &sourceImage,
+                const PaddedImage &targetImage, STImage *result,
+                const MorphOptions &options = MorphOptions());
+
+// Computes only region of the FusedMorph() output into view, e.g. a crop,
+// one tile of a frame split over several machines, or the part of a frame
+// an edit affected. view must have the size of region, and region must lie
+// within the output. The pixels are identical to those of the full frame
+// with the same options, whatever the engine; the tiles region overlaps
+// are evaluated as in the full frame, so a region costs at most the tiles
+// it touches. Throws std::runtime_error on a bad region or view, or an
+// apron that is too narrow for the options' filter.
+void FusedMorph(const MorphPlan &plan, const PaddedImage &sourceImage,
+                const PaddedImage &targetImage, const PixelRect &region,
+                const PixelView &view, const MorphOptions &options = MorphOptions());
+
+// Evaluates only the field of plan over a width x height output, as the
+// options' engine does in FusedMorph(), and stores the mapped positions of
+// both sides in field (see displacementField.h). No pixels are involved,
+// so the field serves any pair of images of that size.
+void ComputeField(const MorphPlan &plan, int width, int height, DisplacementField *field,
+                  const MorphOptions &options = MorphOptions());
+
+// The sampling pass of WarpImage() through a computed or loaded field:
+// samples image, which must have the size of the field, at the source-side
+// positions. The pixels match WarpImage() up to the field's fixed point
+// rounding. The caller owns the returned image. Throws std::runtime_error
+// on a size mismatch or an apron too narrow for the options' filter.
+STImage *WarpImage(const PaddedImage &image, const DisplacementField &field,
+                   const MorphOptions &options = MorphOptions());
+
+// The sampling pass of FusedMorph() through a computed or loaded field,
+// blending at the field's t into result. The field and result must have
+// the size of the smaller input; throws std::runtime_error otherwise.
+void FusedMorph(const DisplacementField &field, const PaddedImage &sourceImage,
+                const PaddedImage &targetImage, STImage *result,
+                const MorphOptions &options = MorphOptions());
+
+// Computes a linear blend of the pixel colors in two images according to
+// parameter t, over the smaller of the two image extents. All four channels
+// are blended, alpha included, with t rounded to a multiple of 1/256 (see
+// BlendRowKernel in warpSimd.h).
+STImage *BlendImages(STImage *image1, STImage *image2, float t,
+                     const MorphOptions &options);
+
+// BlendImages() into a caller-provided buffer of min(width) x min(height)
+// pixels, stored row by row without padding like STImage::GetPixels(). The
+// buffer may be the pixels of image1 or image2 if that image has the
+// smaller width.
+void BlendImages(const STImage *image1, const STImage *image2, float t,
+                 STColor4ub *result, const MorphOptions &options);
+
+// Convenience form of FusedMorph() that builds a one-off plan.
+STImage *FusedMorph(STImage *sourceImage, const std::vector<Feature> &sourceFeatures,
+                    STImage *targetImage, const std::vector<Feature> &targetFeatures,
+                    float t, float a, float b, float p);
+
+#endif // __MORPHENGINE_H__
@@ -0,0 +1,141 @@
+// --------------------------------------------------------------------------
+// morphPlan.cpp
+//
+// Construction of the per-run feature tables and per-frame morph plans.
+//
+
+#include "morphPlan.h"
+#include "morphEngine.h"
+#include "weightPolicy.h"
+
+#include <math.h>
+
+FeatureLines::FeatureLines(const std::vector<Feature> &features)
+    : count(0)
+{
+    Build(features);
+}
+
+void FeatureLines::Resize(int n)
+{
+    count = n;
+    px.resize(n); py.resize(n);
+    qx.resize(n); qy.resize(n);
+    dx.resize(n); dy.resize(n);
+    nx.resize(n); ny.resize(n);
+}
+
+// Derive the direction and unit perpendicular of line i from its endpoints.
+void FeatureLines::Finish(int i)
+{
+    dx[i] = qx[i] - px[i];
+    dy[i] = qy[i] - py[i];
+    float invLength = 1.f / sqrtf(dx[i]*dx[i] + dy[i]*dy[i]);
+    nx[i] = -dy[i] * invLength;
+    ny[i] =  dx[i] * invLength;
+}
+
+void FeatureLines::Build(const std::vector<Feature> &features)
+{
+    Resize((int)features.size());
+    for (int i = 0; i < count; i++) {
+        px[i] = features[i].P.x;
+        py[i] = features[i].P.y;
+        qx[i] = features[i].Q.x;
+        qy[i] = features[i].Q.y;
+        Finish(i);
+    }
+}
+
+void FeatureLines::Build(const FeatureLines &source, const FeatureLines &target, float t)
+{
+    Resize(source.count < target.count ? source.count : target.count);
+    for (int i = 0; i < count; i++) {
+        px[i] = Lerp(source.px[i], target.px[i], t);
+        py[i] = Lerp(source.py[i], target.py[i], t);
+        qx[i] = Lerp(source.qx[i], target.qx[i], t);
+        qy[i] = Lerp(source.qy[i], target.qy[i], t);
+        Finish(i);
+    }
+}
+
+void FeatureLines::Select(const FeatureLines &lines, const int *indices, int n)
+{
+    Resize(n);
+    for (int i = 0; i < n; i++) {
+        int k = indices[i];
+        px[i] = lines.px[k]; py[i] = lines.py[k];
+        qx[i] = lines.qx[k]; qy[i] = lines.qy[k];
+        dx[i] = lines.dx[k]; dy[i] = lines.dy[k];
+        nx[i] = lines.nx[k]; ny[i] = lines.ny[k];
+    }
+}
+
+void FeatureLines::Subtract(const FeatureLines &lines, const FeatureLines &base)
+{
+    Resize(lines.count < base.count ? lines.count : base.count);
+    for (int i = 0; i < count; i++) {
+        px[i] = lines.px[i] - base.px[i]; py[i] = lines.py[i] - base.py[i];
+        qx[i] = lines.qx[i] - base.qx[i]; qy[i] = lines.qy[i] - base.qy[i];
+        dx[i] = lines.dx[i] - base.dx[i]; dy[i] = lines.dy[i] - base.dy[i];
+        nx[i] = lines.nx[i] - base.nx[i]; ny[i] = lines.ny[i] - base.ny[i];
+    }
+}
+
+MorphPlan::MorphPlan(const FeatureLines &sourceLines, const FeatureLines &targetLines,
+                     float t, float a, float b, float p)
+{
+    Build(sourceLines, targetLines, t, a, b, p);
+}
+
+void MorphPlan::Build(const FeatureLines &sourceLines, const FeatureLines &targetLines,
+                      float t, float a, float b, float p)
+{
+    this->t = t;
+    this->a = a;
+    this->b = b;
+    this->p = p;
+    source = &sourceLines;
+    target = &targetLines;
+
+    lines.Build(sourceLines, targetLines, t);
+    sourceOffsets.Subtract(sourceLines, lines);
+    targetOffsets.Subtract(targetLines, lines);
+
+    int n = lines.count;
+    invLengthSq.resize(n);
+    invLength.resize(n);
+    lengthPowP.resize(n);
+    for (int i = 0; i < n; i++) {
+        float lengthSq = lines.dx[i]*lines.dx[i] + lines.dy[i]*lines.dy[i];
+        float length = sqrtf(lengthSq);
+        invLengthSq[i] = 1.f / lengthSq;
+        invLength[i] = 1.f / length;
+        lengthPowP[i] = LengthPowP(length, p);
+    }
+}
+
+void MorphPlan::Select(const MorphPlan &plan, const int *indices, int n,
+                       FeatureLines *sourceLines, FeatureLines *targetLines)
+{
+    t = plan.t;
+    a = plan.a;
+    b = plan.b;
+    p = plan.p;
+    sourceLines->Select(*plan.source, indices, n);
+    targetLines->Select(*plan.target, indices, n);
+    source = sourceLines;
+    target = targetLines;
+
+    lines.Select(plan.lines, indices, n);
+    sourceOffsets.Select(plan.sourceOffsets, indices, n);
+    targetOffsets.Select(plan.targetOffsets, indices, n);
+    invLengthSq.resize(n);
+    invLength.resize(n);
+    lengthPowP.resize(n);
+    for (int i = 0; i < n; i++) {
+        invLengthSq[i] = plan.invLengthSq[indices[i]];
+        invLength[i] = plan.invLength[indices[i]];
+        lengthPowP[i] = plan.lengthPowP[indices[i]];
+    }
+}
@@ -0,0 +1,90 @@
+// --------------------------------------------------------------------------
+// morphPlan.h
+//
+// Precomputed, structure-of-arrays feature tables consumed by the morph
+// engines. Everything that depends only on the features (and not on the
+// pixel being evaluated) is computed here once instead of per pixel.
+//
+
+#ifndef __MORPHPLAN_H__
+#define __MORPHPLAN_H__
+
+#include "feature.h"
+
+#include <vector>
+
+// A set of feature lines stored as parallel arrays. Building one from the
+// source or target features of a morph is done once per run; the tables are
+// then shared by every frame.
+struct FeatureLines
+{
+    int count;
+    std::vector<float> px, py;      // start point P
+    std::vector<float> qx, qy;      // end point Q
+    std::vector<float> dx, dy;      // direction Q - P
+    std::vector<float> nx, ny;      // Perpendicular(Q - P) / |Q - P|
+
+    FeatureLines() : count(0) { }
+    explicit FeatureLines(const std::vector<Feature> &features);
+
+    // Fill in the table from a vector of features.
+    void Build(const std::vector<Feature> &features);
+
+    // Fill in the table with the lines interpolated between source
+    // (t = 0) and target (t = 1).
+    void Build(const FeatureLines &source, const FeatureLines &target, float t);
+
+    // Fill in the table with lines[indices[0]], ..., lines[indices[n-1]].
+    void Select(const FeatureLines &lines, const int *indices, int n);
+
+    // Fill in the table with every field of lines minus that of base.
+    void Subtract(const FeatureLines &lines, const FeatureLines &base);
+
+private:
+    void Resize(int n);
+    void Finish(int i);
+};
+
+// Everything a field warp needs for one frame: the interpolated lines the
+// output pixels are measured against, their per-line constants, and the
+// source and target lines that (u,v) coordinates are mapped back onto.
+struct MorphPlan
+{
+    float t, a, b, p;
+
+    // lines interpolated at t, the destination-space features
+    FeatureLines lines;
+    std::vector<float> invLengthSq;     // 1 / |Q - P|^2
+    std::vector<float> invLength;       // 1 / |Q - P|
+    std::vector<float> lengthPowP;      // |Q - P|^p
+
+    // per-run tables; must outlive the plan
+    const FeatureLines *source;
+    const FeatureLines *target;
+
+    // source and target lines minus the interpolated ones. The kernels map
+    // a pixel through these offsets, so that the side a frame shows alone
+    // (t = 0 or 1) maps every pixel exactly onto itself rather than within
+    // the rounding of P + u (Q - P) + v Perpendicular(Q - P) / |Q - P|.
+    FeatureLines sourceOffsets;
+    FeatureLines targetOffsets;
+
+    MorphPlan() : t(0), a(0), b(0), p(0), source(0), target(0) { }
+    MorphPlan(const FeatureLines &sourceLines, const FeatureLines &targetLines,
+              float t, float a, float b, float p);
+
+    // (Re)build the plan for a new frame.
+    void Build(const FeatureLines &sourceLines, const FeatureLines &targetLines,
+               float t, float a, float b, float p);
+
+    // (Re)build the plan from the features of plan given by indices, e.g.
+    // those left after culling (see featureBVH.h). The selected source and
+    // target lines are stored in sourceLines and targetLines, which must
+    // outlive the plan.
+    void Select(const MorphPlan &plan, const int *indices, int n,
+                FeatureLines *sourceLines, FeatureLines *targetLines);
+
+    int GetCount() const { return lines.count; }
+};
+
+#endif // __MORPHPLAN_H__
@@ -0,0 +1,179 @@
+// --------------------------------------------------------------------------
+// progressiveMorph.cpp
+//
+// Coarse-to-fine preview rendering of a morph frame.
+//
+
+#include "progressiveMorph.h"
+#include "STImage.h"
+#include "warpSimd.h"
+
+#include <algorithm>
+
+// Longest run of a level row processed at once, so that the scratch
+// buffers fit on the stack.
+const int kPreviewChunk = 256;
+
+/**
+ * Renders one level of a preview. Pixels whose position is on the grid of
+ * the coarser level take the mapped positions computed there; the others
+ * are evaluated with the point kernel at their full resolution position.
+ */
+class PreviewLevelTask : public TileTask
+{
+public:
+    PreviewLevelTask(const MorphPlan &plan, const PaddedImage &sourceImage,
+                     const PaddedImage &targetImage, const WarpKernels &kernels, int scale,
+                     const float *const coarse[4], int coarseWidth,
+                     float *const fine[4], STImage *result)
+        : mPlan(plan), mSourceImage(sourceImage), mTargetImage(targetImage)
+        , mKernels(kernels), mScale(scale), mCoarseWidth(coarseWidth), mResult(result)
+    {
+        for (int k = 0; k < 4; k++) {
+            mCoarse[k] = coarse[k];
+            mFine[k] = fine[k];
+        }
+    }
+
+    void RunTile(int x0, int y0, int x1, int y1)
+    {
+        float field[4][kPreviewChunk];
+        float pointX[kPreviewChunk], pointY[kPreviewChunk], points[4][kPreviewChunk];
+        int pointIndex[kPreviewChunk];
+        STColor4ub sourceColors[kPreviewChunk], targetColors[kPreviewChunk];
+        int width = mResult->GetWidth();
+
+        for (int y = y0; y < y1; y++) {
+            // every other pixel of the even rows was done by the coarser level
+            bool reuse = mCoarse[0] && (y & 1) == 0;
+            const float *coarseRow[4];
+            for (int k = 0; k < 4; k++)
+                coarseRow[k] = reuse ? mCoarse[k] + (y / 2) * mCoarseWidth : NULL;
+
+            for (int x = x0; x < x1; x += kPreviewChunk) {
+                int count = std::min(kPreviewChunk, x1 - x);
+                int pointCount = 0;
+                for (int i = 0; i < count; i++) {
+                    int level = x + i;
+                    if (reuse && (level & 1) == 0) {
+                        for (int k = 0; k < 4; k++)
+                            field[k][i] = coarseRow[k][level / 2];
+                    } else {
+                        pointX[pointCount] = (float)(level * mScale);
+                        pointY[pointCount] = (float)(y * mScale);
+                        pointIndex[pointCount++] = i;
+                    }
+                }
+                mKernels.fieldPoints(mPlan, pointX, pointY, pointCount,
+                                     points[0], points[1], points[2], points[3]);
+                for (int n = 0; n < pointCount; n++) {
+                    for (int k = 0; k < 4; k++)
+                        field[k][pointIndex[n]] = points[k][n];
+                }
+
+                mKernels.sampleRow(mSourceImage, field[0], field[1], count, sourceColors);
+                mKernels.sampleRow(mTargetImage, field[2], field[3], count, targetColors);
+                STImage::Pixel *row = mResult->GetPixels() + y * width + x;
+                mKernels.blendRow(sourceColors, targetColors, GetBlendWeight(mPlan.t), count,
+                                  row);
+
+                // keep the field for the next finer level
+                if (mFine[0]) {
+                    for (int k = 0; k < 4; k++)
+                        std::copy(field[k], field[k] + count, mFine[k] + y * width + x);
+                }
+            }
+        }
+    }
+
+private:
+    const MorphPlan &mPlan;
+    const PaddedImage &mSourceImage;
+    const PaddedImage &mTargetImage;
+    const WarpKernels &mKernels;
+    int mScale;
+    const float *mCoarse[4];    // field of the coarser level, or NULL
+    int mCoarseWidth;
+    float *mFine[4];            // where to keep this level's field, or NULL
+    STImage *mResult;
+};
+
+void ProgressiveMorph::LevelField::Swap(LevelField &other)
+{
+    std::swap(width, other.width);
+    std::swap(height, other.height);
+    sourceX.swap(other.sourceX);
+    sourceY.swap(other.sourceY);
+    targetX.swap(other.targetX);
+    targetY.swap(other.targetY);
+}
+
+ProgressiveMorph::ProgressiveMorph(const MorphPlan &plan, const PaddedImage &sourceImage,
+                                   const PaddedImage &targetImage, const MorphOptions &options)
+    : mPlan(plan), mSourceImage(sourceImage), mTargetImage(targetImage), mOptions(options)
+    , mScale(0), mImage(0)
+{
+    mWidth = std::min(sourceImage.GetWidth(), targetImage.GetWidth());
+    mHeight = std::min(sourceImage.GetHeight(), targetImage.GetHeight());
+
+    mFirstScale = kPreviewFirstScale;
+    while ((double)((mWidth + mFirstScale - 1) / mFirstScale) *
+           ((mHeight + mFirstScale - 1) / mFirstScale) > kPreviewFirstPixels)
+        mFirstScale *= 2;
+}
+
+ProgressiveMorph::~ProgressiveMorph()
+{
+    delete mImage;
+}
+
+STImage *ProgressiveMorph::RenderNextLevel()
+{
+    if (mScale == 1)
+        return NULL;
+    int scale = mScale ? mScale / 2 : mFirstScale;
+    int width = (mWidth + scale - 1) / scale;
+    int height = (mHeight + scale - 1) / scale;
+
+    // the full resolution field is not needed afterwards
+    bool keep = scale > 1;
+    mFine.width = width;
+    mFine.height = height;
+    std::vector<float> *fineArrays[4] = {
+        &mFine.sourceX, &mFine.sourceY, &mFine.targetX, &mFine.targetY
+    };
+    const std::vector<float> *coarseArrays[4] = {
+        &mCoarse.sourceX, &mCoarse.sourceY, &mCoarse.targetX, &mCoarse.targetY
+    };
+    float *fine[4];
+    const float *coarse[4];
+    for (int k = 0; k < 4; k++) {
+        fineArrays[k]->resize(keep ? (size_t)width * height : 0);
+        fine[k] = keep && !fineArrays[k]->empty() ? &(*fineArrays[k])[0] : NULL;
+        coarse[k] = mScale && !coarseArrays[k]->empty() ? &(*coarseArrays[k])[0] : NULL;
+    }
+
+    delete mImage;
+    mImage = new STImage(width, height);
+    WarpKernels kernels = GetWarpKernels(mOptions.simd);
+    PreviewLevelTask task(mPlan, mSourceImage, mTargetImage, kernels, scale,
+                          coarse, mCoarse.width, fine, mImage);
+    RunTiles(width, height, mOptions, task);
+
+    mScale = scale;
+    mCoarse.Swap(mFine);
+    if (!keep) {
+        LevelField().Swap(mCoarse);
+        LevelField().Swap(mFine);
+    }
+    return mImage;
+}
+
+STImage *ProgressiveMorph::Run(PreviewCallback callback)
+{
+    while (STImage *image = RenderNextLevel()) {
+        if (callback)
+            callback(image);
+    }
+    return mImage;
+}
@@ -0,0 +1,98 @@
+// --------------------------------------------------------------------------
+// progressiveMorph.h
+//
+// Coarse-to-fine rendering of a morph frame for interactive previews. The
+// frame is rendered at 1/8, 1/4, 1/2 and finally full resolution, pixel
+// (i, j) of the level with scale s standing for output pixel (s i, s j). The
+// grid of a level contains the grid of the coarser one, so every level
+// reuses the displacement samples computed before it and only evaluates the
+// field at the three quarters of its pixels that are new; rendering all the
+// levels costs little more than the full resolution frame on its own.
+//
+// For large outputs the first level is made coarser still, so that it has
+// at most kPreviewFirstPixels pixels and shows up within a few milliseconds
+// whatever the output size.
+//
+
+#ifndef __PROGRESSIVEMORPH_H__
+#define __PROGRESSIVEMORPH_H__
+
+#include "morphEngine.h"
+
+#include <vector>
+
+class STImage;
+
+// Scale of the first level of a preview, unless that level would be larger
+// than kPreviewFirstPixels.
+const int kPreviewFirstScale = 8;
+const int kPreviewFirstPixels = 128 * 128;
+
+// Receives the image of each level as soon as it is done, e.g. DisplayImage()
+// in morph.cpp. The image is only valid during the call.
+typedef void (*PreviewCallback)(STImage *image);
+
+class ProgressiveMorph
+{
+public:
+    //
+    // Prepares a preview of the morph described by plan between two padded
+    // images. The field is evaluated exactly, whatever the options' engine,
+    // and sampled bilinearly, whatever the options' filter; threading and
+    // kernel flavor are taken from options. plan and the images must outlive
+    // the preview.
+    //
+    ProgressiveMorph(const MorphPlan &plan, const PaddedImage &sourceImage,
+                     const PaddedImage &targetImage,
+                     const MorphOptions &options = MorphOptions());
+
+    ~ProgressiveMorph();
+
+    //
+    // Renders the next finer level and returns its image, of size
+    // ceil(width / scale) x ceil(height / scale). The image belongs to the
+    // preview and stays valid until the next call. Returns NULL once the
+    // full resolution level has been rendered.
+    //
+    STImage *RenderNextLevel();
+
+    //
+    // Scale of the level rendered last (1 for full resolution), or 0 before
+    // the first one.
+    //
+    int GetScale() const { return mScale; }
+
+    bool IsComplete() const { return mScale == 1; }
+
+    //
+    // Renders all remaining levels, handing each to callback, and returns
+    // the full resolution frame, which stays owned by the preview.
+    //
+    STImage *Run(PreviewCallback callback);
+
+private:
+    // Positions the field maps the pixels of one level to, row by row.
+    struct LevelField
+    {
+        int width, height;
+        std::vector<float> sourceX, sourceY, targetX, targetY;
+
+        LevelField() : width(0), height(0) { }
+        void Swap(LevelField &other);
+    };
+
+    ProgressiveMorph(const ProgressiveMorph &);
+    ProgressiveMorph &operator=(const ProgressiveMorph &);
+
+    const MorphPlan &mPlan;
+    const PaddedImage &mSourceImage;
+    const PaddedImage &mTargetImage;
+    MorphOptions mOptions;
+    int mWidth, mHeight;
+    int mFirstScale;
+    int mScale;
+    LevelField mCoarse, mFine;  // fields of the last and the next level
+    STImage *mImage;            // image of the last level
+};
+
+#endif // __PROGRESSIVEMORPH_H__
@@ -0,0 +1,78 @@
+// --------------------------------------------------------------------------
+// sampler.cpp
+//
+// Construction of padded images for the samplers, and filter metadata.
+//
+
+#include "sampler.h"
+#include "STImage.h"
+
+#include <string.h>
+#include <stdexcept>
+
+PaddedImage::PaddedImage(const STImage *image, int apron, Border border)
+    : mWidth(image->GetWidth())
+    , mHeight(image->GetHeight())
+    , mApron(apron)
+    , mStride(image->GetWidth() + 2 * apron)
+    , mPixels(NULL)
+    , mOrigin(NULL)
+{
+    if (apron < 1)
+        throw std::runtime_error("PaddedImage apron must be at least one pixel");
+
+    int paddedHeight = mHeight + 2 * mApron;
+    mPixels = new PackedPixel[mStride * paddedHeight];
+    memset(mPixels, 0, mStride * paddedHeight * sizeof(PackedPixel));
+    mOrigin = mPixels + mApron * mStride + mApron;
+
+    const PackedPixel *src = (const PackedPixel *)image->GetPixels();
+    for (int y = 0; y < mHeight; y++) {
+        PackedPixel *row = mPixels + (y + mApron) * mStride;
+        memcpy(row + mApron, src + y * mWidth, mWidth * sizeof(PackedPixel));
+        if (border == BORDER_REPLICATE) {
+            for (int x = 0; x < mApron; x++) {
+                row[x] = row[mApron];
+                row[mApron + mWidth + x] = row[mApron + mWidth - 1];
+            }
+        }
+    }
+
+    // replicate the first and last (already padded) rows into the apron
+    if (border == BORDER_REPLICATE) {
+        for (int y = 0; y < mApron; y++) {
+            memcpy(mPixels + y * mStride, mPixels + mApron * mStride,
+                   mStride * sizeof(PackedPixel));
+            memcpy(mPixels + (mApron + mHeight + y) * mStride,
+                   mPixels + (mApron + mHeight - 1) * mStride,
+                   mStride * sizeof(PackedPixel));
+        }
+    }
+}
+
+PaddedImage::~PaddedImage()
+{
+    delete [] mPixels;
+}
+
+const char *GetSampleFilterName(SampleFilter filter)
+{
+    switch (filter) {
+        case FILTER_NEAREST:  return "nearest";
+        case FILTER_BILINEAR: return "bilinear";
+        case FILTER_BICUBIC:  return "bicubic";
+        case FILTER_LANCZOS3: return "lanczos3";
+    }
+    return "unknown";
+}
+
+int GetSampleFilterApron(SampleFilter filter)
+{
+    switch (filter) {
+        case FILTER_NEAREST:  return NearestSampler::kApron;
+        case FILTER_BILINEAR: return BilinearSampler::kApron;
+        case FILTER_BICUBIC:  return BicubicSampler::kApron;
+        case FILTER_LANCZOS3: return Lanczos3Sampler::kApron;
+    }
+    return kDefaultApron;
+}
@@ -0,0 +1,291 @@
+// --------------------------------------------------------------------------
+// sampler.h
+//
+// Reconstruction filters that sample images padded with a border apron.
+//
+// A PaddedImage is a copy of an STImage surrounded by a few pixels of
+// zero (or replicated) border. Every filter tap of a position inside the
+// image then lands on readable memory, so sampling needs a single range
+// test instead of one bounds check per neighbor. Bilinear filtering uses
+// 8.8 fixed point weights and integer lerps on the packed RGBA pixels.
+//
+// The filters are also provided as sampler policies (NearestSampler,
+// BilinearSampler, BicubicSampler, Lanczos3Sampler) that the warp engines
+// take as a template parameter, so the chosen filter is inlined into their
+// pixel loops.
+//
+
+#ifndef __SAMPLER_H__
+#define __SAMPLER_H__
+
+#include <math.h>
+
+class STImage;
+
+// An RGBA pixel packed into 32 bits, in STColor4ub memory order.
+typedef unsigned int PackedPixel;
+
+// Default number of border pixels around a PaddedImage; enough for every
+// sampler policy below.
+const int kDefaultApron = 3;
+
+// Reconstruction filter used when sampling warped images.
+enum SampleFilter
+{
+    FILTER_NEAREST,     // closest pixel; for fast draft renders
+    FILTER_BILINEAR,    // 2x2 fixed-point lerp
+    FILTER_BICUBIC,     // 4x4 Catmull-Rom
+    FILTER_LANCZOS3     // 6x6 windowed sinc; sharpest, slowest
+};
+
+// Printable name of a filter ("nearest", "bilinear", ...).
+const char *GetSampleFilterName(SampleFilter filter);
+
+// Border pixels the filter's sampler policy reads around the image.
+int GetSampleFilterApron(SampleFilter filter);
+
+class PaddedImage
+{
+public:
+    enum Border
+    {
+        BORDER_ZERO,        // transparent black outside the image
+        BORDER_REPLICATE    // nearest edge pixel outside the image
+    };
+
+    //
+    // Copy image into a new buffer with apron pixels of border on all
+    // four sides.
+    //
+    PaddedImage(const STImage *image, int apron = kDefaultApron,
+                Border border = BORDER_ZERO);
+
+    ~PaddedImage();
+
+    //
+    // Size of the original image, in pixels.
+    //
+    int GetWidth() const { return mWidth; }
+    int GetHeight() const { return mHeight; }
+
+    //
+    // Number of border pixels readable around the image.
+    //
+    int GetApron() const { return mApron; }
+
+    //
+    // Distance, in pixels, between the starts of two rows.
+    //
+    int GetStride() const { return mStride; }
+
+    //
+    // Pixel (0,0) of the image. Rows are stored bottom to top like
+    // STImage, and pixels up to GetApron() away in any direction may be
+    // read through this pointer.
+    //
+    const PackedPixel *GetOrigin() const { return mOrigin; }
+
+private:
+    int mWidth, mHeight;
+    int mApron, mStride;
+    PackedPixel *mPixels;
+    const PackedPixel *mOrigin;
+
+    // not copyable
+    PaddedImage(const PaddedImage &);
+    PaddedImage &operator=(const PaddedImage &);
+};
+
+// Blend packed pixels a and b channel-wise with 8-bit weight w (0..256):
+// (a * (256 - w) + b * w) >> 8. Red/blue and green/alpha are processed two
+// channels per 32-bit multiply.
+inline PackedPixel LerpPacked(PackedPixel a, PackedPixel b, unsigned int w)
+{
+    unsigned int iw = 256 - w;
+    unsigned int rb = (((a & 0x00ff00ff) * iw + (b & 0x00ff00ff) * w) >> 8) & 0x00ff00ff;
+    unsigned int ga = ((((a >> 8) & 0x00ff00ff) * iw + ((b >> 8) & 0x00ff00ff) * w) >> 8) & 0x00ff00ff;
+    return rb | (ga << 8);
+}
+
+// Bilinearly samples image at (x,y), or returns transparent black if the
+// position lies outside of the image (also for NaN positions).
+inline PackedPixel SampleBilinear(const PaddedImage &image, float x, float y)
+{
+    if (!(x >= 0 && x < image.GetWidth() && y >= 0 && y < image.GetHeight()))
+        return 0;
+
+    // positions are non-negative, so truncation is floor
+    int xi = (int)x;
+    int yi = (int)y;
+    unsigned int fx = (unsigned int)((x - xi) * 256.f);
+    unsigned int fy = (unsigned int)((y - yi) * 256.f);
+
+    const PackedPixel *p = image.GetOrigin() + yi * image.GetStride() + xi;
+    const PackedPixel *q = p + image.GetStride();
+    return LerpPacked(LerpPacked(p[0], p[1], fx), LerpPacked(q[0], q[1], fx), fy);
+}
+
+// Position test shared by all samplers: false outside of the image and for
+// NaN positions.
+inline bool InsideImage(const PaddedImage &image, float x, float y)
+{
+    return x >= 0 && x < image.GetWidth() && y >= 0 && y < image.GetHeight();
+}
+
+// Rounds a filtered channel value and clamps it to 0..255.
+inline unsigned int ClampChannel(float c)
+{
+    int i = (int)(c + 0.5f);
+    return i < 0 ? 0 : (i > 255 ? 255 : (unsigned int)i);
+}
+
+//
+// Sampler policies. Each has the form
+//
+//     struct Sampler {
+//         static const int kApron;    // border pixels the filter reads
+//         static PackedPixel Sample(const PaddedImage &image, float x, float y);
+//     };
+//
+// Sample() returns transparent black for positions outside of the image,
+// like SampleBilinear(), so every filter agrees on the image's extent.
+// Pixel centers lie on integer coordinates.
+//
+
+struct NearestSampler
+{
+    static const int kApron = 1;
+
+    static PackedPixel Sample(const PaddedImage &image, float x, float y)
+    {
+        if (!InsideImage(image, x, y))
+            return 0;
+        // may round up to the first apron pixel, which is readable
+        int xi = (int)(x + 0.5f);
+        int yi = (int)(y + 0.5f);
+        return image.GetOrigin()[yi * image.GetStride() + xi];
+    }
+};
+
+struct BilinearSampler
+{
+    static const int kApron = 1;
+
+    static PackedPixel Sample(const PaddedImage &image, float x, float y)
+    {
+        return SampleBilinear(image, x, y);
+    }
+};
+
+// Accumulates the separable filter weights wx (taps x0..x0+n-1) and wy over
+// the image and packs the result.
+template<int n>
+inline PackedPixel FilterSeparable(const PaddedImage &image, int x0, int y0,
+                                   const float *wx, const float *wy)
+{
+    const PackedPixel *row = image.GetOrigin() + y0 * image.GetStride() + x0;
+    float r = 0, g = 0, b = 0, a = 0;
+    for (int j = 0; j < n; j++, row += image.GetStride()) {
+        float rr = 0, rg = 0, rb = 0, ra = 0;
+        for (int i = 0; i < n; i++) {
+            PackedPixel c = row[i];
+            rr += wx[i] * (float)(c & 0xff);
+            rg += wx[i] * (float)((c >> 8) & 0xff);
+            rb += wx[i] * (float)((c >> 16) & 0xff);
+            ra += wx[i] * (float)(c >> 24);
+        }
+        r += wy[j] * rr;
+        g += wy[j] * rg;
+        b += wy[j] * rb;
+        a += wy[j] * ra;
+    }
+    return ClampChannel(r) | (ClampChannel(g) << 8) |
+           (ClampChannel(b) << 16) | (ClampChannel(a) << 24);
+}
+
+struct BicubicSampler
+{
+    static const int kApron = 2;
+
+    // Catmull-Rom weights of the taps at -1, 0, 1, 2 for fraction f.
+    static void Weights(float f, float *w)
+    {
+        float f2 = f * f, f3 = f2 * f;
+        w[0] = 0.5f * (-f3 + 2.f * f2 - f);
+        w[1] = 0.5f * (3.f * f3 - 5.f * f2 + 2.f);
+        w[2] = 0.5f * (-3.f * f3 + 4.f * f2 + f);
+        w[3] = 0.5f * (f3 - f2);
+    }
+
+    static PackedPixel Sample(const PaddedImage &image, float x, float y)
+    {
+        if (!InsideImage(image, x, y))
+            return 0;
+        int xi = (int)x;
+        int yi = (int)y;
+        float wx[4], wy[4];
+        Weights(x - xi, wx);
+        Weights(y - yi, wy);
+        return FilterSeparable<4>(image, xi - 1, yi - 1, wx, wy);
+    }
+};
+
+struct Lanczos3Sampler
+{
+    static const int kApron = 3;
+
+    // Normalized Lanczos-3 weights of the taps at n = -2..3 for fraction f.
+    // The tap distance is d = f - n, so sin(pi d) = (-1)^n sin(pi f) and
+    // sin(pi d / 3) follows from the angle difference identity; only three
+    // trigonometric calls are needed per axis.
+    static void Weights(float f, float *w)
+    {
+        const float kPi = 3.14159265f;
+        const float kSin60 = 0.866025404f;
+        static const float kCosN3[6] = { -0.5f, 0.5f, 1.f, 0.5f, -0.5f, -1.f };
+        static const float kSinN3[6] = { -kSin60, -kSin60, 0.f, kSin60, kSin60, 0.f };
+
+        float s1 = sinf(kPi * f);
+        float s3 = sinf(kPi * f / 3.f);
+        float c3 = cosf(kPi * f / 3.f);
+        float sum = 0;
+        for (int i = 0; i < 6; i++) {
+            float d = f - (float)(i - 2);
+            if (fabsf(d) < 1e-5f) {
+                w[i] = 1.f;
+            } else {
+                float sinD = (i & 1) ? -s1 : s1;
+                float sinD3 = s3 * kCosN3[i] - c3 * kSinN3[i];
+                float pd = kPi * d;
+                w[i] = 3.f * sinD * sinD3 / (pd * pd);
+            }
+            sum += w[i];
+        }
+        for (int i = 0; i < 6; i++)
+            w[i] /= sum;
+    }
+
+    static PackedPixel Sample(const PaddedImage &image, float x, float y)
+    {
+        if (!InsideImage(image, x, y))
+            return 0;
+        int xi = (int)x;
+        int yi = (int)y;
+        float wx[6], wy[6];
+        Weights(x - xi, wx);
+        Weights(y - yi, wy);
+        return FilterSeparable<6>(image, xi - 2, yi - 2, wx, wy);
+    }
+};
+
+// Samples count positions (xs[i], ys[i]) of image into out with the given
+// sampler policy.
+template<class Sampler>
+inline void SampleRow(const PaddedImage &image, const float *xs, const float *ys,
+                      int count, PackedPixel *out)
+{
+    for (int i = 0; i < count; i++)
+        out[i] = Sampler::Sample(image, xs[i], ys[i]);
+}
+
+#endif // __SAMPLER_H__
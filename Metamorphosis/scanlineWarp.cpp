@@ -0,0 +1,133 @@
+// --------------------------------------------------------------------------
+// scanlineWarp.cpp
+//
+// Forward-differencing scanline evaluator for the field warp.
+//
+
+#include "scanlineWarp.h"
+#include "morphPlan.h"
+#include "weightPolicy.h"
+
+#include <math.h>
+#include <stddef.h>
+
+// Pixels accumulated per pass; keeps the accumulators on the stack.
+static const int kScanlineChunk = 64;
+
+/**
+ * Evaluates one chunk of a row feature by feature. For each feature, u and v
+ * are computed exactly at the first pixel and stepped from there by
+ * j * du = j * dx/|PQ|^2 and j * dv = j * nx, rather than by repeated adds
+ * that would carry their rounding along the chunk; the per-pixel
+ * displacement sums live in small arrays.
+ */
+template <bool kBothSides, class Weight>
+static void ScanlineChunk(const MorphPlan &plan, int x0, int count, int y,
+                          float *sourceX, float *sourceY,
+                          float *targetX, float *targetY)
+{
+    const FeatureLines &lines = plan.lines;
+    const FeatureLines &src = plan.sourceOffsets;
+    const FeatureLines &tgt = plan.targetOffsets;
+    const float a = plan.a, b = plan.b;
+
+    float sdx[kScanlineChunk], sdy[kScanlineChunk];
+    float tdx[kScanlineChunk], tdy[kScanlineChunk];
+    float weightSum[kScanlineChunk];
+    for (int j = 0; j < count; j++)
+        sdx[j] = sdy[j] = tdx[j] = tdy[j] = weightSum[j] = 0;
+
+    for (int i = 0; i < lines.count; i++) {
+        float rx = x0 - lines.px[i];
+        float ry = y - lines.py[i];
+        float ey = y - lines.qy[i];
+        float ry2 = ry * ry;
+        float ey2 = ey * ey;
+
+        float u0 = (rx * lines.dx[i] + ry * lines.dy[i]) * plan.invLengthSq[i];
+        float v0 = rx * lines.nx[i] + ry * lines.ny[i];
+        float du = lines.dx[i] * plan.invLengthSq[i];
+        float dv = lines.nx[i];
+
+        for (int j = 0; j < count; j++) {
+            float x = (float)(x0 + j);
+            float u = u0 + j * du;
+            float v = v0 + j * dv;
+            float dist;
+            if (u < 0) {
+                float ex = x - lines.px[i];
+                dist = sqrtf(ex*ex + ry2);
+            } else if (u > 1) {
+                float ex = x - lines.qx[i];
+                dist = sqrtf(ex*ex + ey2);
+            } else {
+                dist = fabsf(v);
+            }
+            float weight = Weight::Weight(plan.lengthPowP[i] / (a + dist), b);
+
+            sdx[j] += (src.px[i] + u * src.dx[i] + v * src.nx[i]) * weight;
+            sdy[j] += (src.py[i] + u * src.dy[i] + v * src.ny[i]) * weight;
+            if (kBothSides) {
+                tdx[j] += (tgt.px[i] + u * tgt.dx[i] + v * tgt.nx[i]) * weight;
+                tdy[j] += (tgt.py[i] + u * tgt.dy[i] + v * tgt.ny[i]) * weight;
+            }
+            weightSum[j] += weight;
+        }
+    }
+
+    for (int j = 0; j < count; j++) {
+        float x = (float)(x0 + j);
+        if (lines.count == 0) {
+            sourceX[j] = x;
+            sourceY[j] = y;
+            if (kBothSides) {
+                targetX[j] = x;
+                targetY[j] = y;
+            }
+            continue;
+        }
+        sourceX[j] = x + sdx[j] / weightSum[j];
+        sourceY[j] = y + sdy[j] / weightSum[j];
+        if (kBothSides) {
+            targetX[j] = x + tdx[j] / weightSum[j];
+            targetY[j] = y + tdy[j] / weightSum[j];
+        }
+    }
+}
+
+template <class Weight>
+static void ScanlineRow(const MorphPlan &plan, int x0, int count, int y,
+                        float *sourceX, float *sourceY,
+                        float *targetX, float *targetY)
+{
+    for (int j = 0; j < count; j += kScanlineChunk) {
+        int n = count - j < kScanlineChunk ? count - j : kScanlineChunk;
+        if (targetX) {
+            ScanlineChunk<true, Weight>(plan, x0 + j, n, y, sourceX + j, sourceY + j,
+                                        targetX + j, targetY + j);
+        } else {
+            ScanlineChunk<false, Weight>(plan, x0 + j, n, y, sourceX + j, sourceY + j,
+                                         NULL, NULL);
+        }
+    }
+}
+
+void FieldRowScanline(const MorphPlan &plan, int x0, int count, int y,
+                      float *sourceX, float *sourceY,
+                      float *targetX, float *targetY)
+{
+    switch (GetWeightKind(plan.b)) {
+        case WEIGHT_LINEAR:
+            ScanlineRow<WeightPolicy<WEIGHT_LINEAR> >(plan, x0, count, y,
+                                                      sourceX, sourceY, targetX, targetY);
+            break;
+        case WEIGHT_SQUARE:
+            ScanlineRow<WeightPolicy<WEIGHT_SQUARE> >(plan, x0, count, y,
+                                                      sourceX, sourceY, targetX, targetY);
+            break;
+        default:
+            ScanlineRow<WeightPolicy<WEIGHT_POW> >(plan, x0, count, y,
+                                                   sourceX, sourceY, targetX, targetY);
+            break;
+    }
+}
@@ -0,0 +1,32 @@
+// --------------------------------------------------------------------------
+// scanlineWarp.h
+//
+// Scanline evaluator for the field warp. Along a row of output pixels the
+// line coordinates u and v of every feature are affine in x, so they are
+// computed once at the start of every 64 pixels and then stepped with one
+// multiply-add each per pixel, instead of two dot products and a multiply.
+//
+// The evaluator is scalar and saves only that part of the work: the
+// distance, the weight and the mapping are computed as in the direct
+// kernel. It is therefore faster than the scalar direct kernel alone, by
+// about 12% on the sully pair at b = 1 or 2 and not at all where powf()
+// dominates, and several times slower than the SSE4.1 and AVX2 ones, which
+// evaluate 4 or 8 pixels per step. It only pays off where those are
+// unavailable, on scalar hosts or with SIMD_SCALAR; the engine ignores
+// MorphOptions::simd.
+//
+
+#ifndef __SCANLINEWARP_H__
+#define __SCANLINEWARP_H__
+
+struct MorphPlan;
+
+// FieldRowKernel (see warpSimd.h) using forward differencing of u and v.
+// Matches the scalar direct kernel within the rounding of u and v, and
+// like it maps every pixel exactly onto itself on the side a frame shows
+// alone (t = 0 or 1).
+void FieldRowScanline(const MorphPlan &plan, int x0, int count, int y,
+                      float *sourceX, float *sourceY,
+                      float *targetX, float *targetY);
+
+#endif // __SCANLINEWARP_H__
@@ -0,0 +1,184 @@
+// --------------------------------------------------------------------------
+// threadPool.cpp
+//
+// Persistent work-stealing thread pool.
+//
+
+#include "threadPool.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdexcept>
+
+ThreadPool::ThreadPool(int numThreads)
+    : mNumThreads(numThreads > 0 ? numThreads : GetCPUCount())
+    , mRanges(NULL)
+    , mTask(NULL)
+    , mGeneration(0)
+    , mBusy(0)
+    , mShutdown(false)
+{
+    pthread_mutex_init(&mLock, NULL);
+    pthread_cond_init(&mWake, NULL);
+    pthread_cond_init(&mDone, NULL);
+
+    mRanges = new WorkRange[mNumThreads];
+    for (int i = 0; i < mNumThreads; i++) {
+        pthread_mutex_init(&mRanges[i].lock, NULL);
+        mRanges[i].begin = mRanges[i].end = 0;
+    }
+
+    // worker 0 is whichever thread calls ParallelFor()
+    mThreads.resize(mNumThreads);
+    mArgs.resize(mNumThreads);
+    for (int i = 1; i < mNumThreads; i++) {
+        mArgs[i].pool = this;
+        mArgs[i].index = i;
+        if (pthread_create(&mThreads[i], NULL, WorkerMain, &mArgs[i]) != 0) {
+            fprintf(stderr, "ThreadPool::ThreadPool() - Could not start worker %d.\n", i);
+            throw std::runtime_error("Error creating ThreadPool");
+        }
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    pthread_mutex_lock(&mLock);
+    mShutdown = true;
+    pthread_cond_broadcast(&mWake);
+    pthread_mutex_unlock(&mLock);
+
+    for (int i = 1; i < mNumThreads; i++)
+        pthread_join(mThreads[i], NULL);
+
+    for (int i = 0; i < mNumThreads; i++)
+        pthread_mutex_destroy(&mRanges[i].lock);
+    delete [] mRanges;
+
+    pthread_cond_destroy(&mDone);
+    pthread_cond_destroy(&mWake);
+    pthread_mutex_destroy(&mLock);
+}
+
+int ThreadPool::GetCPUCount()
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+}
+
+void ThreadPool::ParallelFor(int count, ThreadTask *task)
+{
+    if (count <= 0)
+        return;
+
+    // nothing to share out; skip the hand-off entirely
+    if (mNumThreads == 1 || count == 1) {
+        for (int i = 0; i < count; i++)
+            task->Run(i);
+        return;
+    }
+
+    // give every worker an equal contiguous block to start from
+    for (int i = 0; i < mNumThreads; i++) {
+        pthread_mutex_lock(&mRanges[i].lock);
+        mRanges[i].begin = (int)((long long)count * i / mNumThreads);
+        mRanges[i].end = (int)((long long)count * (i + 1) / mNumThreads);
+        pthread_mutex_unlock(&mRanges[i].lock);
+    }
+
+    pthread_mutex_lock(&mLock);
+    mTask = task;
+    mBusy = mNumThreads;
+    mGeneration++;
+    pthread_cond_broadcast(&mWake);
+    pthread_mutex_unlock(&mLock);
+
+    RunWork(0, task);
+
+    pthread_mutex_lock(&mLock);
+    while (mBusy > 0)
+        pthread_cond_wait(&mDone, &mLock);
+    mTask = NULL;
+    pthread_mutex_unlock(&mLock);
+}
+
+void *ThreadPool::WorkerMain(void *args)
+{
+    WorkerArgs *workerArgs = (WorkerArgs *)args;
+    workerArgs->pool->WorkerLoop(workerArgs->index);
+    return NULL;
+}
+
+void ThreadPool::WorkerLoop(int index)
+{
+    unsigned int seen = 0;
+    for (;;) {
+        pthread_mutex_lock(&mLock);
+        while (!mShutdown && mGeneration == seen)
+            pthread_cond_wait(&mWake, &mLock);
+        if (mShutdown) {
+            pthread_mutex_unlock(&mLock);
+            return;
+        }
+        seen = mGeneration;
+        ThreadTask *task = mTask;
+        pthread_mutex_unlock(&mLock);
+
+        RunWork(index, task);
+    }
+}
+
+// Run items from our own block, then steal until no work is left anywhere.
+void ThreadPool::RunWork(int index, ThreadTask *task)
+{
+    int item;
+    while (Pop(index, &item) || Steal(index, &item))
+        task->Run(item);
+
+    pthread_mutex_lock(&mLock);
+    if (--mBusy == 0)
+        pthread_cond_signal(&mDone);
+    pthread_mutex_unlock(&mLock);
+}
+
+bool ThreadPool::Pop(int index, int *item)
+{
+    WorkRange &range = mRanges[index];
+    bool found = false;
+    pthread_mutex_lock(&range.lock);
+    if (range.begin < range.end) {
+        *item = range.begin++;
+        found = true;
+    }
+    pthread_mutex_unlock(&range.lock);
+    return found;
+}
+
+// Take the back half of the first non-empty block of another worker.
+bool ThreadPool::Steal(int index, int *item)
+{
+    for (int i = 1; i < mNumThreads; i++) {
+        WorkRange &victim = mRanges[(index + i) % mNumThreads];
+        int begin = 0, end = 0;
+
+        pthread_mutex_lock(&victim.lock);
+        int remaining = victim.end - victim.begin;
+        if (remaining > 0) {
+            begin = victim.end - (remaining + 1) / 2;
+            end = victim.end;
+            victim.end = begin;
+        }
+        pthread_mutex_unlock(&victim.lock);
+
+        if (begin < end) {
+            WorkRange &own = mRanges[index];
+            pthread_mutex_lock(&own.lock);
+            own.begin = begin + 1;
+            own.end = end;
+            pthread_mutex_unlock(&own.lock);
+            *item = begin;
+            return true;
+        }
+    }
+    return false;
+}
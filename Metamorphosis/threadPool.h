@@ -0,0 +1,98 @@
+// --------------------------------------------------------------------------
+// threadPool.h
+//
+// A small persistent pool of worker threads used to spread the per-pixel
+// work of a frame over all cores. The threads are created once and reused
+// for every ParallelFor() call, so rendering a sequence does not pay thread
+// startup per frame.
+//
+
+#ifndef __THREADPOOL_H__
+#define __THREADPOOL_H__
+
+#include <pthread.h>
+#include <vector>
+
+// A unit of work run by the pool. Run() is called once for every index of a
+// ParallelFor() range, concurrently from several threads.
+class ThreadTask
+{
+public:
+    virtual ~ThreadTask() { }
+    virtual void Run(int index) = 0;
+};
+
+class ThreadPool
+{
+public:
+    //
+    // Create a pool that runs work on numThreads threads (including the
+    // thread calling ParallelFor). A value <= 0 uses one thread per CPU.
+    //
+    explicit ThreadPool(int numThreads = 0);
+
+    //
+    // Stops and joins all worker threads.
+    //
+    ~ThreadPool();
+
+    //
+    // Number of threads work is spread over, including the caller.
+    //
+    int GetThreadCount() const { return mNumThreads; }
+
+    //
+    // Calls task->Run(i) for every i in [0, count) and returns once all of
+    // them have finished. Each thread starts on a contiguous block of
+    // indices and steals from the back of other threads' blocks once its
+    // own runs dry, so uneven work items balance out.
+    //
+    void ParallelFor(int count, ThreadTask *task);
+
+    //
+    // Number of CPUs available to the process.
+    //
+    static int GetCPUCount();
+
+private:
+    // The block of indices a worker still has to run. Padded so that
+    // workers do not share cache lines.
+    struct WorkRange
+    {
+        pthread_mutex_t lock;
+        int begin, end;
+        char pad[64];
+    };
+
+    struct WorkerArgs
+    {
+        ThreadPool *pool;
+        int index;
+    };
+
+    int mNumThreads;
+    std::vector<pthread_t> mThreads;
+    std::vector<WorkerArgs> mArgs;
+    WorkRange *mRanges;
+
+    // Job hand-off between ParallelFor() and the workers.
+    pthread_mutex_t mLock;
+    pthread_cond_t mWake;
+    pthread_cond_t mDone;
+    ThreadTask *mTask;
+    unsigned int mGeneration;
+    int mBusy;
+    bool mShutdown;
+
+    static void *WorkerMain(void *args);
+    void WorkerLoop(int index);
+    void RunWork(int index, ThreadTask *task);
+    bool Pop(int index, int *item);
+    bool Steal(int index, int *item);
+
+    // not copyable
+    ThreadPool(const ThreadPool &);
+    ThreadPool &operator=(const ThreadPool &);
+};
+
+#endif // __THREADPOOL_H__
@@ -0,0 +1,133 @@
+// --------------------------------------------------------------------------
+// tileTuner.cpp
+//
+// Startup measurement and persistence of the output tile size.
+//
+
+#include "tileTuner.h"
+#include "STImage.h"
+#include "STTimer.h"
+#include "sampler.h"
+#include "threadPool.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <sstream>
+
+// Tile edge lengths tried by the tuner. Any size gives the same pixels, but
+// tiles that are multiples of the 64-pixel row chunks (and so of the 32x32
+// field blocks) never evaluate a chunk or block that another tile shares.
+const int kTileCandidates[] = { 64, 128, 192, 256 };
+const int kTileCandidateCount = sizeof(kTileCandidates) / sizeof(kTileCandidates[0]);
+
+// Timed frames per candidate; the fastest one counts.
+const int kTuningRuns = 3;
+
+/**
+ * Size in bytes of a cache level as reported by the C library, or 0 if it
+ * is not known.
+ */
+static long GetCacheSize(int level)
+{
+#if defined(_SC_LEVEL1_DCACHE_SIZE) && defined(_SC_LEVEL2_CACHE_SIZE) && defined(_SC_LEVEL3_CACHE_SIZE)
+    int name = level == 1 ? _SC_LEVEL1_DCACHE_SIZE
+             : level == 2 ? _SC_LEVEL2_CACHE_SIZE : _SC_LEVEL3_CACHE_SIZE;
+    long size = sysconf(name);
+    return size > 0 ? size : 0;
+#else
+    (void)level;
+    return 0;
+#endif
+}
+
+std::string GetTileTuningKey(int width, int height, const MorphOptions &options)
+{
+    std::ostringstream key;
+    key << "size=" << width << "x" << height
+        << " cpus=" << ThreadPool::GetCPUCount()
+        << " threads=" << (options.pool ? options.pool->GetThreadCount() : 1)
+        << " l1d=" << GetCacheSize(1)
+        << " l2=" << GetCacheSize(2)
+        << " l3=" << GetCacheSize(3)
+        << " simd=" << GetSimdLevelName(SelectWarpKernels(options).level)
+        << " engine=" << (int)options.engine
+        << " filter=" << GetSampleFilterName(options.filter);
+    return key.str();
+}
+
+int TuneTileSize(const MorphPlan &plan, const PaddedImage &sourceImage,
+                 const PaddedImage &targetImage, const MorphOptions &options)
+{
+    int extent = std::max(sourceImage.GetWidth(), sourceImage.GetHeight());
+    int bestSize = kDefaultTileSize;
+    float bestMillis = -1;
+    for (int i = 0; i < kTileCandidateCount; i++) {
+        // larger tiles than the frame all behave the same
+        if (i > 0 && kTileCandidates[i - 1] >= extent)
+            break;
+
+        MorphOptions tuning = options;
+        tuning.tileSize = kTileCandidates[i];
+        for (int run = 0; run < kTuningRuns; run++) {
+            STTimer timer;
+            timer.Reset();
+            delete FusedMorph(plan, sourceImage, targetImage, tuning);
+            float millis = timer.GetElapsedMillis();
+            if (bestMillis < 0 || millis < bestMillis) {
+                bestMillis = millis;
+                bestSize = tuning.tileSize;
+            }
+        }
+    }
+    return bestSize;
+}
+
+bool LoadTileSize(const char *path, const std::string &key, int *tileSize)
+{
+    FILE *file = fopen(path, "r");
+    if (!file)
+        return false;
+
+    // first line: the key, second line: the tile size
+    char line[512];
+    bool found = false;
+    if (fgets(line, sizeof(line), file)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        int size;
+        if (key == line && fscanf(file, "%d", &size) == 1 && size > 0) {
+            *tileSize = size;
+            found = true;
+        }
+    }
+    fclose(file);
+    return found;
+}
+
+void SaveTileSize(const char *path, const std::string &key, int tileSize)
+{
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "Cannot write file %s\n", path);
+        return;
+    }
+    fprintf(file, "%s\n%d\n", key.c_str(), tileSize);
+    fclose(file);
+}
+
+int GetTunedTileSize(const char *path, const MorphPlan &plan,
+                     const PaddedImage &sourceImage, const PaddedImage &targetImage,
+                     const MorphOptions &options)
+{
+    int width = std::min(sourceImage.GetWidth(), targetImage.GetWidth());
+    int height = std::min(sourceImage.GetHeight(), targetImage.GetHeight());
+    std::string key = GetTileTuningKey(width, height, options);
+    int tileSize;
+    if (LoadTileSize(path, key, &tileSize))
+        return tileSize;
+
+    tileSize = TuneTileSize(plan, sourceImage, targetImage, options);
+    SaveTileSize(path, key, tileSize);
+    return tileSize;
+}
@@ -0,0 +1,44 @@
+// --------------------------------------------------------------------------
+// tileTuner.h
+//
+// Picks the output tile size used by RunTiles() for the host. Every
+// candidate size is timed on a real morph frame, and the winner is stored
+// in a small text file keyed by a description of the host (cache sizes,
+// CPU and thread count, kernel level), so later runs on the same machine
+// skip the measurement.
+//
+
+#ifndef __TILETUNER_H__
+#define __TILETUNER_H__
+
+#include "morphEngine.h"
+
+#include <string>
+
+// Default file the tuned tile size is persisted in.
+const char *const kTileSizeFile = "tilesize.txt";
+
+// Describes the host, the width x height output and the options' threading
+// and kernel settings; a stored tile size is only reused for an identical
+// key.
+std::string GetTileTuningKey(int width, int height, const MorphOptions &options);
+
+// Times FusedMorph() with every candidate tile size and returns the
+// fastest one. options provides everything but the tile size.
+int TuneTileSize(const MorphPlan &plan, const PaddedImage &sourceImage,
+                 const PaddedImage &targetImage, const MorphOptions &options);
+
+// Reads the tile size stored in path for key. Returns false if the file is
+// missing or holds an entry for a different key.
+bool LoadTileSize(const char *path, const std::string &key, int *tileSize);
+
+// Writes tileSize for key to path, replacing its previous content.
+void SaveTileSize(const char *path, const std::string &key, int tileSize);
+
+// The stored tile size for this host if there is one, otherwise tunes it
+// with TuneTileSize() and stores the result.
+int GetTunedTileSize(const char *path, const MorphPlan &plan,
+                     const PaddedImage &sourceImage, const PaddedImage &targetImage,
+                     const MorphOptions &options);
+
+#endif // __TILETUNER_H__
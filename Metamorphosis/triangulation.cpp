@@ -0,0 +1,482 @@
+// --------------------------------------------------------------------------
+// triangulation.cpp
+//
+// Incremental constrained Delaunay triangulation.
+//
+
+#include "triangulation.h"
+
+#include <math.h>
+#include <algorithm>
+
+static inline int Next(int i) { return i == 2 ? 0 : i + 1; }
+static inline int Prev(int i) { return i == 0 ? 2 : i - 1; }
+
+void Triangulation::Reset(double x0, double y0, double x1, double y1)
+{
+    mX.clear();
+    mY.clear();
+    mTriangles.clear();
+    mStack.clear();
+    mLast = 0;
+
+    const double xs[4] = { x0, x1, x1, x0 };
+    const double ys[4] = { y0, y0, y1, y1 };
+    for (int i = 0; i < 4; i++) {
+        mX.push_back(xs[i]);
+        mY.push_back(ys[i]);
+    }
+
+    Triangle lower = { { 0, 1, 2 }, { -1, 1, -1 }, { false, false, false } };
+    Triangle upper = { { 0, 2, 3 }, { -1, -1, 0 }, { false, false, false } };
+    mVertexTriangle.assign(4, 0);
+    Store(0, lower);
+    Store(1, upper);
+}
+
+/**
+ * Twice the signed area of the triangle (a, b, c): positive if it turns
+ * counterclockwise.
+ */
+double Triangulation::Orient(int a, int b, int c) const
+{
+    return Orient(a, b, mX[c], mY[c]);
+}
+
+double Triangulation::Orient(int a, int b, double x, double y) const
+{
+    return (mX[b] - mX[a]) * (y - mY[a]) - (mY[b] - mY[a]) * (x - mX[a]);
+}
+
+/**
+ * Whether d lies strictly inside the circumcircle of the counterclockwise
+ * triangle (a, b, c).
+ */
+bool Triangulation::InCircle(int a, int b, int c, int d) const
+{
+    double ax = mX[a] - mX[d], ay = mY[a] - mY[d];
+    double bx = mX[b] - mX[d], by = mY[b] - mY[d];
+    double cx = mX[c] - mX[d], cy = mY[c] - mY[d];
+    double aa = ax*ax + ay*ay, bb = bx*bx + by*by, cc = cx*cx + cy*cy;
+    double det = aa * (bx*cy - by*cx) - bb * (ax*cy - ay*cx) + cc * (ax*by - ay*bx);
+
+    // cocircular points within rounding are left alone, so that flips
+    // cannot cycle
+    double scale = std::max(aa, std::max(bb, cc));
+    return det > 1e-12 * scale * scale;
+}
+
+/**
+ * Whether the edge opposite v[i] of triangle t can be flipped: the two
+ * triangles it separates form a strictly convex quadrilateral.
+ */
+bool Triangulation::IsConvex(int t, int i) const
+{
+    const Triangle &tri = mTriangles[t];
+    int u = tri.n[i];
+    if (u < 0)
+        return false;
+    const Triangle &other = mTriangles[u];
+    int j = 0;
+    while (other.n[j] != t)
+        j++;
+    int a = tri.v[i], b = tri.v[Next(i)], c = tri.v[Prev(i)], d = other.v[j];
+    return Orient(a, b, d) > 0 && Orient(a, d, c) > 0;
+}
+
+/**
+ * Whether the segments (a, b) and (e, f) cross at a point inside both.
+ */
+bool Triangulation::Crosses(int a, int b, int e, int f) const
+{
+    if (e == a || e == b || f == a || f == b)
+        return false;
+    return Orient(a, b, e) * Orient(a, b, f) < 0 && Orient(e, f, a) * Orient(e, f, b) < 0;
+}
+
+/**
+ * Triangle containing (x, y), or -1 if it is outside the rectangle. Walks
+ * from the triangle the last walk ended in toward the point.
+ */
+int Triangulation::Locate(double x, double y) const
+{
+    int t = mLast < (int)mTriangles.size() ? mLast : 0;
+    for (size_t steps = 0; steps <= mTriangles.size(); steps++) {
+        const Triangle &tri = mTriangles[t];
+        int across = -1;
+        for (int i = 0; i < 3 && across < 0; i++) {
+            if (Orient(tri.v[Next(i)], tri.v[Prev(i)], x, y) < 0)
+                across = i;
+        }
+        if (across < 0)
+            return t;
+        t = tri.n[across];
+        if (t < 0)
+            return -1;
+    }
+
+    // the walk went around in circles on nearly degenerate triangles
+    for (size_t k = 0; k < mTriangles.size(); k++) {
+        const Triangle &tri = mTriangles[k];
+        if (Orient(tri.v[0], tri.v[1], x, y) >= 0 && Orient(tri.v[1], tri.v[2], x, y) >= 0 &&
+            Orient(tri.v[2], tri.v[0], x, y) >= 0)
+            return (int)k;
+    }
+    return -1;
+}
+
+void Triangulation::SetNeighbor(int t, int oldNeighbor, int newNeighbor)
+{
+    if (t < 0)
+        return;
+    Triangle &tri = mTriangles[t];
+    for (int i = 0; i < 3; i++) {
+        if (tri.n[i] == oldNeighbor) {
+            tri.n[i] = newNeighbor;
+            return;
+        }
+    }
+}
+
+/**
+ * Writes triangle t, appending it if t is one past the last triangle, and
+ * notes it as a triangle of each of its vertices.
+ */
+void Triangulation::Store(int t, const Triangle &tri)
+{
+    if (t == (int)mTriangles.size())
+        mTriangles.push_back(tri);
+    else
+        mTriangles[t] = tri;
+    for (int i = 0; i < 3; i++)
+        mVertexTriangle[tri.v[i]] = t;
+}
+
+/**
+ * Position of vertex v in triangle t.
+ */
+int Triangulation::IndexOf(int t, int v) const
+{
+    const Triangle &tri = mTriangles[t];
+    return tri.v[0] == v ? 0 : (tri.v[1] == v ? 1 : 2);
+}
+
+/**
+ * Collects in mAround the triangles around vertex a, in turn.
+ */
+void Triangulation::GatherAround(int a)
+{
+    // one way around a, and if that ends at the boundary, the other way
+    // from the same start
+    mAround.clear();
+    int start = mVertexTriangle[a];
+    int t = start;
+    do {
+        mAround.push_back(t);
+        t = mTriangles[t].n[Prev(IndexOf(t, a))];
+    } while (t >= 0 && t != start && mAround.size() <= mTriangles.size());
+    if (t >= 0)
+        return;
+    t = mTriangles[start].n[Next(IndexOf(start, a))];
+    while (t >= 0 && mAround.size() <= mTriangles.size()) {
+        mAround.push_back(t);
+        t = mTriangles[t].n[Next(IndexOf(t, a))];
+    }
+}
+
+/**
+ * Triangle with the edge from a to b or from b to a, and in index the
+ * position of the vertex opposite it; -1 if there is no such edge.
+ */
+int Triangulation::FindEdge(int a, int b, int *index)
+{
+    GatherAround(a);
+    for (size_t k = 0; k < mAround.size(); k++) {
+        int t = mAround[k];
+        const Triangle &tri = mTriangles[t];
+        for (int i = 0; i < 3; i++) {
+            if (tri.v[i] == b) {
+                *index = 3 - i - IndexOf(t, a);
+                return t;
+            }
+        }
+    }
+    return -1;
+}
+
+/**
+ * Replaces the edge opposite v[i] of triangle t, (b, c) with a = v[i], by
+ * the other diagonal (a, d) of the quadrilateral it splits. Afterwards t is
+ * (a, b, d) and its former neighbor is (a, d, c).
+ */
+void Triangulation::Flip(int t, int i)
+{
+    Triangle &tri = mTriangles[t];
+    int u = tri.n[i];
+    Triangle &other = mTriangles[u];
+    int j = 0;
+    while (other.n[j] != t)
+        j++;
+
+    int a = tri.v[i], b = tri.v[Next(i)], c = tri.v[Prev(i)], d = other.v[j];
+    int ab = tri.n[Prev(i)], ca = tri.n[Next(i)];
+    bool abFixed = tri.fixed[Prev(i)], caFixed = tri.fixed[Next(i)];
+    int bd = other.n[Next(j)], dc = other.n[Prev(j)];
+    bool bdFixed = other.fixed[Next(j)], dcFixed = other.fixed[Prev(j)];
+
+    Triangle first = { { a, b, d }, { bd, u, ab }, { bdFixed, false, abFixed } };
+    Triangle second = { { a, d, c }, { dc, ca, t }, { dcFixed, caFixed, false } };
+    Store(t, first);
+    Store(u, second);
+    SetNeighbor(bd, u, t);
+    SetNeighbor(ca, t, u);
+}
+
+/**
+ * Flips the edges on mStack, and the ones that come up in turn, that are
+ * not locally Delaunay. Each entry is a triangle and the index of the point
+ * just inserted in it; the edge opposite that point is checked.
+ */
+void Triangulation::Legalize()
+{
+    while (!mStack.empty()) {
+        int t = mStack.back().first, i = mStack.back().second;
+        mStack.pop_back();
+
+        const Triangle &tri = mTriangles[t];
+        int u = tri.n[i];
+        if (u < 0 || tri.fixed[i])
+            continue;
+        const Triangle &other = mTriangles[u];
+        int j = 0;
+        while (other.n[j] != t)
+            j++;
+        if (!InCircle(tri.v[0], tri.v[1], tri.v[2], other.v[j]))
+            continue;
+
+        // the inserted point ends up at index 0 of both triangles
+        Flip(t, i);
+        mStack.push_back(std::make_pair(t, 0));
+        mStack.push_back(std::make_pair(u, 0));
+    }
+}
+
+/**
+ * Splits triangle t into three around the new vertex p inside it.
+ */
+void Triangulation::SplitTriangle(int t, int p)
+{
+    Triangle tri = mTriangles[t];
+    int a = tri.v[0], b = tri.v[1], c = tri.v[2];
+    int t1 = (int)mTriangles.size(), t2 = t1 + 1;
+
+    Triangle first = { { p, a, b }, { tri.n[2], t1, t2 }, { tri.fixed[2], false, false } };
+    Triangle second = { { p, b, c }, { tri.n[0], t2, t }, { tri.fixed[0], false, false } };
+    Triangle third = { { p, c, a }, { tri.n[1], t, t1 }, { tri.fixed[1], false, false } };
+    Store(t, first);
+    Store(t1, second);
+    Store(t2, third);
+    SetNeighbor(tri.n[0], t, t1);
+    SetNeighbor(tri.n[1], t, t2);
+
+    mStack.clear();
+    mStack.push_back(std::make_pair(t, 0));
+    mStack.push_back(std::make_pair(t1, 0));
+    mStack.push_back(std::make_pair(t2, 0));
+    Legalize();
+}
+
+/**
+ * Splits the edge opposite v[i] of triangle t at the new vertex p on it,
+ * and with it the triangles on both sides.
+ */
+void Triangulation::SplitEdge(int t, int i, int p)
+{
+    Triangle tri = mTriangles[t];
+    int a = tri.v[i], b = tri.v[Next(i)], c = tri.v[Prev(i)];
+    int ab = tri.n[Prev(i)], ca = tri.n[Next(i)];
+    bool abFixed = tri.fixed[Prev(i)], caFixed = tri.fixed[Next(i)];
+    bool bcFixed = tri.fixed[i];
+    int u = tri.n[i];
+
+    int t1 = (int)mTriangles.size();
+    mStack.clear();
+    if (u < 0) {
+        Triangle first = { { p, a, b }, { ab, -1, t1 }, { abFixed, bcFixed, false } };
+        Triangle second = { { p, c, a }, { ca, t, -1 }, { caFixed, false, bcFixed } };
+        Store(t, first);
+        Store(t1, second);
+        SetNeighbor(ca, t, t1);
+        mStack.push_back(std::make_pair(t, 0));
+        mStack.push_back(std::make_pair(t1, 0));
+        Legalize();
+        return;
+    }
+
+    Triangle other = mTriangles[u];
+    int j = 0;
+    while (other.n[j] != t)
+        j++;
+    int d = other.v[j];
+    int bd = other.n[Next(j)], dc = other.n[Prev(j)];
+    bool bdFixed = other.fixed[Next(j)], dcFixed = other.fixed[Prev(j)];
+    int t3 = t1 + 1;
+
+    // (p, a, b) and (p, c, a) replace t, (p, d, c) and (p, b, d) replace u
+    Triangle first = { { p, a, b }, { ab, t3, t1 }, { abFixed, bcFixed, false } };
+    Triangle second = { { p, c, a }, { ca, t, u }, { caFixed, false, bcFixed } };
+    Triangle third = { { p, d, c }, { dc, t1, t3 }, { dcFixed, bcFixed, false } };
+    Triangle fourth = { { p, b, d }, { bd, u, t }, { bdFixed, false, bcFixed } };
+    Store(t, first);
+    Store(t1, second);
+    Store(u, third);
+    Store(t3, fourth);
+    SetNeighbor(ca, t, t1);
+    SetNeighbor(bd, u, t3);
+
+    mStack.push_back(std::make_pair(t, 0));
+    mStack.push_back(std::make_pair(t1, 0));
+    mStack.push_back(std::make_pair(u, 0));
+    mStack.push_back(std::make_pair(t3, 0));
+    Legalize();
+}
+
+int Triangulation::Insert(double x, double y)
+{
+    int t = Locate(x, y);
+    if (t < 0)
+        return -1;
+    mLast = t;
+
+    const Triangle &tri = mTriangles[t];
+    for (int i = 0; i < 3; i++) {
+        int v = tri.v[i];
+        if (fabs(mX[v] - x) <= kTriangulationEpsilon && fabs(mY[v] - y) <= kTriangulationEpsilon)
+            return v;
+    }
+
+    int p = (int)mX.size();
+    mX.push_back(x);
+    mY.push_back(y);
+    mVertexTriangle.push_back(t);
+
+    // a point on an edge would leave a flat triangle behind
+    for (int i = 0; i < 3; i++) {
+        int e = tri.v[Next(i)], f = tri.v[Prev(i)];
+        double length = sqrt((mX[f] - mX[e]) * (mX[f] - mX[e]) +
+                             (mY[f] - mY[e]) * (mY[f] - mY[e]));
+        if (Orient(e, f, p) <= kTriangulationEpsilon * length) {
+            SplitEdge(t, i, p);
+            return p;
+        }
+    }
+    SplitTriangle(t, p);
+    return p;
+}
+
+bool Triangulation::Constrain(int a, int b)
+{
+    if (a == b)
+        return false;
+    double length = sqrt((mX[b] - mX[a]) * (mX[b] - mX[a]) + (mY[b] - mY[a]) * (mY[b] - mY[a]));
+
+    // walk from a to b through the triangles the segment crosses, collecting
+    // the edges it crosses
+    std::vector<std::pair<int, int> > &crossing = mStack;
+    crossing.clear();
+    int index;
+    int t = FindEdge(a, b, &index);
+    if (t < 0) {
+        for (size_t k = 0; k < mAround.size() && t < 0; k++) {
+            int i = IndexOf(mAround[k], a);
+            const Triangle &tri = mTriangles[mAround[k]];
+            if (Crosses(a, b, tri.v[Next(i)], tri.v[Prev(i)])) {
+                t = mAround[k];
+                index = i;
+            }
+        }
+        // the segment leaves a through a vertex
+        if (t < 0)
+            return false;
+
+        for (;;) {
+            const Triangle &tri = mTriangles[t];
+            if (tri.fixed[index])
+                return false;
+            int e = tri.v[Next(index)], f = tri.v[Prev(index)];
+            crossing.push_back(std::make_pair(e, f));
+
+            int u = tri.n[index];
+            int d = mTriangles[u].v[3 - IndexOf(u, e) - IndexOf(u, f)];
+            if (d == b)
+                break;
+            if (fabs(Orient(a, b, d)) <= kTriangulationEpsilon * length)
+                return false;
+            // continue through whichever of the two far edges is crossed
+            index = Crosses(a, b, e, d) ? IndexOf(u, f) : IndexOf(u, e);
+            t = u;
+        }
+    }
+
+    // flip the crossing edges away (Sloan 1993): an edge whose quadrilateral
+    // is not convex waits for its neighbors to be flipped first, and a new
+    // diagonal that still crosses the segment goes back in the queue
+    size_t maxSteps = 8 * crossing.size() * crossing.size() + 16;
+    for (size_t head = 0; head < crossing.size() && head < maxSteps; head++) {
+        std::pair<int, int> edge = crossing[head];
+        int u = FindEdge(edge.first, edge.second, &index);
+        if (!IsConvex(u, index)) {
+            crossing.push_back(edge);
+            continue;
+        }
+        Flip(u, index);
+
+        // the new diagonal runs from v[0] to v[2] of u
+        int e = mTriangles[u].v[0], f = mTriangles[u].v[2];
+        if (Crosses(a, b, e, f))
+            crossing.push_back(std::make_pair(e, f));
+    }
+
+    t = FindEdge(a, b, &index);
+    if (t < 0)
+        return false;
+    Triangle &tri = mTriangles[t];
+    tri.fixed[index] = true;
+    if (tri.n[index] >= 0) {
+        Triangle &other = mTriangles[tri.n[index]];
+        for (int j = 0; j < 3; j++) {
+            if (other.n[j] == t)
+                other.fixed[j] = true;
+        }
+    }
+    return true;
+}
+
+void Triangulation::RestoreDelaunay()
+{
+    // every flip removes a non-Delaunay edge for good; the cap only guards
+    // against rounding
+    const int kMaxSweeps = 64;
+    for (int sweep = 0; sweep < kMaxSweeps; sweep++) {
+        bool flipped = false;
+        for (size_t t = 0; t < mTriangles.size(); t++) {
+            for (int i = 0; i < 3; i++) {
+                const Triangle &tri = mTriangles[t];
+                int u = tri.n[i];
+                if (u < 0 || tri.fixed[i])
+                    continue;
+                const Triangle &other = mTriangles[u];
+                int j = 0;
+                while (other.n[j] != (int)t)
+                    j++;
+                if (InCircle(tri.v[0], tri.v[1], tri.v[2], other.v[j]) &&
+                    IsConvex((int)t, i)) {
+                    Flip((int)t, i);
+                    flipped = true;
+                }
+            }
+        }
+        if (!flipped)
+            return;
+    }
+}
@@ -0,0 +1,97 @@
+// --------------------------------------------------------------------------
+// triangulation.h
+//
+// Constrained Delaunay triangulation of a point set in a rectangle. Points
+// are inserted one at a time and the triangulation is kept Delaunay by edge
+// flips (Lawson's algorithm). Constrained edges are then recovered by
+// flipping the edges that cross them, and the remaining edges are flipped
+// back to Delaunay without touching the constrained ones.
+//
+// Everything is computed in double precision with plain orientation and
+// in-circle tests, which is plenty for pixel coordinates; points closer
+// than kTriangulationEpsilon to a vertex are merged with it.
+//
+
+#ifndef __TRIANGULATION_H__
+#define __TRIANGULATION_H__
+
+#include <utility>
+#include <vector>
+
+// Distance, in pixels, below which an inserted point is an existing vertex.
+const double kTriangulationEpsilon = 1e-6;
+
+class Triangulation
+{
+public:
+    // Counterclockwise triangle. n[i] is the triangle across the edge
+    // opposite v[i] (from v[i+1] to v[i+2]), or -1 on the outer boundary,
+    // and fixed[i] whether that edge is constrained.
+    struct Triangle
+    {
+        int v[3];
+        int n[3];
+        bool fixed[3];
+    };
+
+    //
+    // Starts over with the rectangle [x0,x1] x [y0,y1] split in two
+    // triangles. Its corners are vertices 0 to 3, counterclockwise from
+    // (x0, y0).
+    //
+    void Reset(double x0, double y0, double x1, double y1);
+
+    //
+    // Inserts the point (x, y), which must be inside the rectangle, and
+    // returns its vertex index; a point on an existing vertex returns
+    // that vertex instead.
+    //
+    int Insert(double x, double y);
+
+    //
+    // Makes the segment between vertices a and b an edge that later flips
+    // leave in place. Returns false, leaving the triangulation as it is, if
+    // the segment crosses an earlier constrained edge or runs through a
+    // vertex.
+    //
+    bool Constrain(int a, int b);
+
+    //
+    // Flips unconstrained edges until every one of them is locally
+    // Delaunay, e.g. after Constrain().
+    //
+    void RestoreDelaunay();
+
+    int GetVertexCount() const { return (int)mX.size(); }
+    double GetX(int vertex) const { return mX[vertex]; }
+    double GetY(int vertex) const { return mY[vertex]; }
+
+    const std::vector<Triangle> &GetTriangles() const { return mTriangles; }
+
+private:
+    double Orient(int a, int b, int c) const;
+    double Orient(int a, int b, double x, double y) const;
+    bool InCircle(int a, int b, int c, int d) const;
+    bool IsConvex(int t, int i) const;
+    bool Crosses(int a, int b, int e, int f) const;
+
+    int Locate(double x, double y) const;
+    void SetNeighbor(int t, int oldNeighbor, int newNeighbor);
+    int IndexOf(int t, int v) const;
+    void Store(int t, const Triangle &tri);
+    void GatherAround(int a);
+    int FindEdge(int a, int b, int *index);
+    void Flip(int t, int i);
+    void Legalize();
+    void SplitTriangle(int t, int p);
+    void SplitEdge(int t, int i, int p);
+
+    std::vector<double> mX, mY;
+    std::vector<Triangle> mTriangles;
+    std::vector<int> mVertexTriangle;           // a triangle of each vertex
+    std::vector<int> mAround;                   // scratch of GatherAround()
+    std::vector<std::pair<int, int> > mStack;   // edges to legalize or flip
+    int mLast;                                  // where the last walk ended
+};
+
+#endif // __TRIANGULATION_H__
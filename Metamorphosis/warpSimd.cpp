@@ -0,0 +1,934 @@
+// --------------------------------------------------------------------------
+// warpSimd.cpp
+//
+// Scalar, SSE4.1 and AVX2 row kernels for the field warp, and the CPUID
+// based dispatch between them.
+//
+
+#include "warpSimd.h"
+#include "morphEngine.h"
+#include "morphPlan.h"
+#include "sampler.h"
+#include "weightPolicy.h"
+#include "STImage.h"
+
+#include <math.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define WARP_HAVE_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#define WARP_TARGET_SSE2  __attribute__((target("sse2")))
+#define WARP_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define WARP_TARGET_AVX2  __attribute__((target("avx2")))
+#endif
+
+// --------------------------------------------------------------------------
+// Scalar reference kernels
+// --------------------------------------------------------------------------
+
+/**
+ * Evaluates the field at output pixel (x,y) and returns the location it maps
+ * to under the plan's source lines (and, if kBothSides, its target lines).
+ * All per-feature invariants come precomputed from the plan, so the loop body
+ * is a handful of multiply-adds, one distance and the weight. Returns the
+ * sum of the feature weights.
+ */
+template <bool kBothSides, class Weight>
+static inline float EvaluateField(const MorphPlan &plan, float x, float y,
+                                 float &sourceX, float &sourceY,
+                                 float &targetX, float &targetY)
+{
+    if (plan.GetCount() == 0) {
+        sourceX = targetX = x;
+        sourceY = targetY = y;
+        return 0;
+    }
+
+    const FeatureLines &lines = plan.lines;
+    const FeatureLines &src = plan.sourceOffsets;
+    const FeatureLines &tgt = plan.targetOffsets;
+    const float *invLengthSq = &plan.invLengthSq[0];
+    const float *lengthPowP = &plan.lengthPowP[0];
+    const float a = plan.a, b = plan.b;
+
+    float sdx = 0, sdy = 0, tdx = 0, tdy = 0;
+    float weightSum = 0;
+    for (int i = 0; i < lines.count; i++) {
+        float rx = x - lines.px[i];
+        float ry = y - lines.py[i];
+        float u = (rx * lines.dx[i] + ry * lines.dy[i]) * invLengthSq[i];
+        float v = rx * lines.nx[i] + ry * lines.ny[i];
+
+        float dist;
+        if (u < 0) {
+            dist = sqrtf(rx*rx + ry*ry);
+        } else if (u > 1) {
+            float ex = x - lines.qx[i];
+            float ey = y - lines.qy[i];
+            dist = sqrtf(ex*ex + ey*ey);
+        } else {
+            dist = fabsf(v);
+        }
+        float weight = Weight::Weight(lengthPowP[i] / (a + dist), b);
+
+        sdx += (src.px[i] + u * src.dx[i] + v * src.nx[i]) * weight;
+        sdy += (src.py[i] + u * src.dy[i] + v * src.ny[i]) * weight;
+        if (kBothSides) {
+            tdx += (tgt.px[i] + u * tgt.dx[i] + v * tgt.nx[i]) * weight;
+            tdy += (tgt.py[i] + u * tgt.dy[i] + v * tgt.ny[i]) * weight;
+        }
+        weightSum += weight;
+    }
+    sourceX = x + sdx / weightSum;
+    sourceY = y + sdy / weightSum;
+    if (kBothSides) {
+        targetX = x + tdx / weightSum;
+        targetY = y + tdy / weightSum;
+    }
+    return weightSum;
+}
+
+template <bool kBothSides, class Weight>
+static void FieldScalarT(const MorphPlan &plan, const float *xs, const float *ys,
+                         int x0, int count, int y,
+                         float *sourceX, float *sourceY,
+                         float *targetX, float *targetY,
+                         float *weightSums)
+{
+    float unusedX, unusedY;
+    for (int i = 0; i < count; i++) {
+        float px = xs ? xs[i] : (float)(x0 + i);
+        float py = ys ? ys[i] : (float)y;
+        float weightSum = EvaluateField<kBothSides, Weight>(
+            plan, px, py, sourceX[i], sourceY[i],
+            kBothSides ? targetX[i] : unusedX, kBothSides ? targetY[i] : unusedY);
+        if (weightSums)
+            weightSums[i] = weightSum;
+    }
+}
+
+template <bool kBothSides>
+static void FieldScalarW(const MorphPlan &plan, const float *xs, const float *ys,
+                         int x0, int count, int y,
+                         float *sourceX, float *sourceY,
+                         float *targetX, float *targetY,
+                         float *weightSums)
+{
+    switch (GetWeightKind(plan.b)) {
+        case WEIGHT_LINEAR:
+            FieldScalarT<kBothSides, WeightPolicy<WEIGHT_LINEAR> >(
+                plan, xs, ys, x0, count, y, sourceX, sourceY, targetX, targetY, weightSums);
+            break;
+        case WEIGHT_SQUARE:
+            FieldScalarT<kBothSides, WeightPolicy<WEIGHT_SQUARE> >(
+                plan, xs, ys, x0, count, y, sourceX, sourceY, targetX, targetY, weightSums);
+            break;
+        default:
+            FieldScalarT<kBothSides, WeightPolicy<WEIGHT_POW> >(
+                plan, xs, ys, x0, count, y, sourceX, sourceY, targetX, targetY, weightSums);
+            break;
+    }
+}
+
+static void FieldScalar(const MorphPlan &plan, const float *xs, const float *ys,
+                        int x0, int count, int y,
+                        float *sourceX, float *sourceY,
+                        float *targetX, float *targetY,
+                        float *weightSums)
+{
+    if (targetX)
+        FieldScalarW<true>(plan, xs, ys, x0, count, y, sourceX, sourceY, targetX, targetY,
+                           weightSums);
+    else
+        FieldScalarW<false>(plan, xs, ys, x0, count, y, sourceX, sourceY, targetX, targetY,
+                            weightSums);
+}
+
+static void SampleRowScalar(const PaddedImage &image, const float *xs, const float *ys,
+                            int count, STColor4ub *out)
+{
+    PackedPixel *packed = (PackedPixel *)out;
+    for (int i = 0; i < count; i++)
+        packed[i] = SampleBilinear(image, xs[i], ys[i]);
+}
+
+/**
+ * Rounded blend of two packed pixels with 8.8 weight w (0..256), red/blue
+ * and green/alpha two channels per 32-bit operation. Every 16-bit field
+ * stays below 255 * 256 + 128, so no carries cross channels.
+ */
+static inline PackedPixel BlendPacked(PackedPixel a, PackedPixel b, unsigned int w)
+{
+    unsigned int iw = 256 - w;
+    unsigned int rb = (((a & 0x00ff00ff) * iw + (b & 0x00ff00ff) * w + 0x00800080) >> 8) & 0x00ff00ff;
+    unsigned int ga = ((((a >> 8) & 0x00ff00ff) * iw + ((b >> 8) & 0x00ff00ff) * w + 0x00800080) >> 8) & 0x00ff00ff;
+    return rb | (ga << 8);
+}
+
+static void BlendRowScalar(const STColor4ub *a, const STColor4ub *b, unsigned int w,
+                           int count, STColor4ub *out)
+{
+    const PackedPixel *pa = (const PackedPixel *)a;
+    const PackedPixel *pb = (const PackedPixel *)b;
+    PackedPixel *po = (PackedPixel *)out;
+    for (int i = 0; i < count; i++)
+        po[i] = BlendPacked(pa[i], pb[i], w);
+}
+
+#ifdef WARP_HAVE_X86
+
+// --------------------------------------------------------------------------
+// SSE2 blend (4 pixels per step)
+// --------------------------------------------------------------------------
+
+/**
+ * The blend of BlendPacked() on 16-bit lanes: bytes are widened, weighted,
+ * rounded and packed back.
+ */
+WARP_TARGET_SSE2 static void BlendRowSSE2(const STColor4ub *a, const STColor4ub *b,
+                                          unsigned int w, int count, STColor4ub *out)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i half = _mm_set1_epi16(128);
+    const __m128i wb = _mm_set1_epi16((short)w);
+    const __m128i wa = _mm_set1_epi16((short)(256 - w));
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i pa = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i pb = _mm_loadu_si128((const __m128i *)(b + i));
+        __m128i lo = _mm_add_epi16(_mm_add_epi16(
+                         _mm_mullo_epi16(_mm_unpacklo_epi8(pa, zero), wa),
+                         _mm_mullo_epi16(_mm_unpacklo_epi8(pb, zero), wb)), half);
+        __m128i hi = _mm_add_epi16(_mm_add_epi16(
+                         _mm_mullo_epi16(_mm_unpackhi_epi8(pa, zero), wa),
+                         _mm_mullo_epi16(_mm_unpackhi_epi8(pb, zero), wb)), half);
+        __m128i result = _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8));
+        _mm_storeu_si128((__m128i *)(out + i), result);
+    }
+    BlendRowScalar(a + i, b + i, w, count - i, out + i);
+}
+
+// --------------------------------------------------------------------------
+// SSE4.1 kernels (4 pixels per step)
+// --------------------------------------------------------------------------
+
+// log2(x) for x > 0; Cephes logf polynomial on the mantissa.
+WARP_TARGET_SSE41 static inline __m128 Log2SSE(__m128 x)
+{
+    const __m128i bits = _mm_castps_si128(x);
+    __m128 e = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(126)));
+    __m128 m = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x007fffff)),
+                                             _mm_set1_epi32(0x3f000000)));
+    // m in [0.5, 1); move it to [sqrt(0.5), sqrt(2)) for accuracy
+    __m128 small = _mm_cmplt_ps(m, _mm_set1_ps(0.707106781186547524f));
+    e = _mm_sub_ps(e, _mm_and_ps(small, _mm_set1_ps(1.f)));
+    __m128 f = _mm_sub_ps(_mm_add_ps(m, _mm_and_ps(small, m)), _mm_set1_ps(1.f));
+
+    __m128 z = _mm_mul_ps(f, f);
+    __m128 y = _mm_set1_ps(7.0376836292e-2f);
+    y = _mm_add_ps(_mm_mul_ps(y, f), _mm_set1_ps(-1.1514610310e-1f));
+    y = _mm_add_ps(_mm_mul_ps(y, f), _mm_set1_ps(1.1676998740e-1f));
+    y = _mm_add_ps(_mm_mul_ps(y, f), _mm_set1_ps(-1.2420140846e-1f));
+    y = _mm_add_ps(_mm_mul_ps(y, f), _mm_set1_ps(1.4249322787e-1f));
+    y = _mm_add_ps(_mm_mul_ps(y, f), _mm_set1_ps(-1.6668057665e-1f));
+    y = _mm_add_ps(_mm_mul_ps(y, f), _mm_set1_ps(2.0000714765e-1f));
+    y = _mm_add_ps(_mm_mul_ps(y, f), _mm_set1_ps(-2.4999993993e-1f));
+    y = _mm_add_ps(_mm_mul_ps(y, f), _mm_set1_ps(3.3333331174e-1f));
+    y = _mm_mul_ps(_mm_mul_ps(y, f), z);
+    y = _mm_sub_ps(y, _mm_mul_ps(z, _mm_set1_ps(0.5f)));
+    __m128 ln = _mm_add_ps(f, y);
+    return _mm_add_ps(_mm_mul_ps(ln, _mm_set1_ps(1.44269504088896341f)), e);
+}
+
+// 2^x; Cephes exp2f polynomial on the fractional part.
+WARP_TARGET_SSE41 static inline __m128 Exp2SSE(__m128 x)
+{
+    x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(-126.f)), _mm_set1_ps(127.f));
+    __m128 n = _mm_round_ps(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    x = _mm_sub_ps(x, n);
+
+    __m128 y = _mm_set1_ps(1.535336188319500e-4f);
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(1.339887440266574e-3f));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(9.618437357674640e-3f));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(5.550332471162809e-2f));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(2.402264791363012e-1f));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(6.931472028550421e-1f));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(1.f));
+
+    __m128i scale = _mm_slli_epi32(_mm_add_epi32(_mm_cvtps_epi32(n), _mm_set1_epi32(127)), 23);
+    return _mm_mul_ps(y, _mm_castsi128_ps(scale));
+}
+
+template <bool kBothSides, int kWeight>
+WARP_TARGET_SSE41 static void FieldSSE41(const MorphPlan &plan, const float *xs, const float *ys,
+                                         int x0, int count, int y,
+                                         float *sourceX, float *sourceY,
+                                         float *targetX, float *targetY,
+                                         float *weightSums)
+{
+    const FeatureLines &lines = plan.lines;
+    const FeatureLines &src = plan.sourceOffsets;
+    const FeatureLines &tgt = plan.targetOffsets;
+    const int n = lines.count;
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.f);
+    const __m128 signMask = _mm_set1_ps(-0.f);
+    const __m128 a = _mm_set1_ps(plan.a);
+    const __m128 b = _mm_set1_ps(plan.b);
+    const __m128 rowY = _mm_set1_ps((float)y);
+
+    for (int i = 0; i < count; i += 4) {
+        __m128 X, Y;
+        if (xs) {
+            // unused tail lanes evaluate (0,0) and are dropped below
+            float xBuf[4] = { 0, 0, 0, 0 }, yBuf[4] = { 0, 0, 0, 0 };
+            int lanes = count - i < 4 ? count - i : 4;
+            memcpy(xBuf, xs + i, lanes * sizeof(float));
+            memcpy(yBuf, ys + i, lanes * sizeof(float));
+            X = _mm_loadu_ps(xBuf);
+            Y = _mm_loadu_ps(yBuf);
+        } else {
+            X = _mm_add_ps(_mm_set1_ps((float)(x0 + i)), _mm_set_ps(3.f, 2.f, 1.f, 0.f));
+            Y = rowY;
+        }
+        __m128 sdx = zero, sdy = zero, tdx = zero, tdy = zero, weightSum = zero;
+
+        for (int f = 0; f < n; f++) {
+            __m128 rx = _mm_sub_ps(X, _mm_set1_ps(lines.px[f]));
+            __m128 ry = _mm_sub_ps(Y, _mm_set1_ps(lines.py[f]));
+            __m128 u = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(rx, _mm_set1_ps(lines.dx[f])),
+                                             _mm_mul_ps(ry, _mm_set1_ps(lines.dy[f]))),
+                                  _mm_set1_ps(plan.invLengthSq[f]));
+            __m128 v = _mm_add_ps(_mm_mul_ps(rx, _mm_set1_ps(lines.nx[f])),
+                                  _mm_mul_ps(ry, _mm_set1_ps(lines.ny[f])));
+
+            // distance to the segment: to P before it, to Q past it, else |v|
+            __m128 ex = _mm_sub_ps(X, _mm_set1_ps(lines.qx[f]));
+            __m128 ey = _mm_sub_ps(Y, _mm_set1_ps(lines.qy[f]));
+            __m128 distP = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(rx, rx), _mm_mul_ps(ry, ry)));
+            __m128 distQ = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(ex, ex), _mm_mul_ps(ey, ey)));
+            __m128 dist = _mm_andnot_ps(signMask, v);
+            dist = _mm_blendv_ps(dist, distQ, _mm_cmpgt_ps(u, one));
+            dist = _mm_blendv_ps(dist, distP, _mm_cmplt_ps(u, zero));
+
+            __m128 base = _mm_div_ps(_mm_set1_ps(plan.lengthPowP[f]), _mm_add_ps(a, dist));
+            __m128 weight;
+            if (kWeight == WEIGHT_LINEAR)
+                weight = base;
+            else if (kWeight == WEIGHT_SQUARE)
+                weight = _mm_mul_ps(base, base);
+            else
+                weight = Exp2SSE(_mm_mul_ps(b, Log2SSE(base)));
+
+            __m128 sx = _mm_add_ps(_mm_add_ps(_mm_set1_ps(src.px[f]),
+                                              _mm_mul_ps(u, _mm_set1_ps(src.dx[f]))),
+                                   _mm_mul_ps(v, _mm_set1_ps(src.nx[f])));
+            __m128 sy = _mm_add_ps(_mm_add_ps(_mm_set1_ps(src.py[f]),
+                                              _mm_mul_ps(u, _mm_set1_ps(src.dy[f]))),
+                                   _mm_mul_ps(v, _mm_set1_ps(src.ny[f])));
+            sdx = _mm_add_ps(sdx, _mm_mul_ps(sx, weight));
+            sdy = _mm_add_ps(sdy, _mm_mul_ps(sy, weight));
+            if (kBothSides) {
+                __m128 tx = _mm_add_ps(_mm_add_ps(_mm_set1_ps(tgt.px[f]),
+                                                  _mm_mul_ps(u, _mm_set1_ps(tgt.dx[f]))),
+                                       _mm_mul_ps(v, _mm_set1_ps(tgt.nx[f])));
+                __m128 ty = _mm_add_ps(_mm_add_ps(_mm_set1_ps(tgt.py[f]),
+                                                  _mm_mul_ps(u, _mm_set1_ps(tgt.dy[f]))),
+                                       _mm_mul_ps(v, _mm_set1_ps(tgt.ny[f])));
+                tdx = _mm_add_ps(tdx, _mm_mul_ps(tx, weight));
+                tdy = _mm_add_ps(tdy, _mm_mul_ps(ty, weight));
+            }
+            weightSum = _mm_add_ps(weightSum, weight);
+        }
+
+        float out[5][4];
+        _mm_storeu_ps(out[0], _mm_add_ps(X, _mm_div_ps(sdx, weightSum)));
+        _mm_storeu_ps(out[1], _mm_add_ps(Y, _mm_div_ps(sdy, weightSum)));
+        if (kBothSides) {
+            _mm_storeu_ps(out[2], _mm_add_ps(X, _mm_div_ps(tdx, weightSum)));
+            _mm_storeu_ps(out[3], _mm_add_ps(Y, _mm_div_ps(tdy, weightSum)));
+        }
+        _mm_storeu_ps(out[4], weightSum);
+        int lanes = count - i < 4 ? count - i : 4;
+        memcpy(sourceX + i, out[0], lanes * sizeof(float));
+        memcpy(sourceY + i, out[1], lanes * sizeof(float));
+        if (kBothSides) {
+            memcpy(targetX + i, out[2], lanes * sizeof(float));
+            memcpy(targetY + i, out[3], lanes * sizeof(float));
+        }
+        if (weightSums)
+            memcpy(weightSums + i, out[4], lanes * sizeof(float));
+    }
+}
+
+template <bool kBothSides>
+static void FieldSSE41W(const MorphPlan &plan, const float *xs, const float *ys,
+                        int x0, int count, int y,
+                        float *sourceX, float *sourceY,
+                        float *targetX, float *targetY,
+                        float *weightSums)
+{
+    switch (GetWeightKind(plan.b)) {
+        case WEIGHT_LINEAR:
+            FieldSSE41<kBothSides, WEIGHT_LINEAR>(plan, xs, ys, x0, count, y,
+                                                   sourceX, sourceY, targetX, targetY, weightSums);
+            break;
+        case WEIGHT_SQUARE:
+            FieldSSE41<kBothSides, WEIGHT_SQUARE>(plan, xs, ys, x0, count, y,
+                                                   sourceX, sourceY, targetX, targetY, weightSums);
+            break;
+        default:
+            FieldSSE41<kBothSides, WEIGHT_POW>(plan, xs, ys, x0, count, y,
+                                                sourceX, sourceY, targetX, targetY, weightSums);
+            break;
+    }
+}
+
+static void FieldSSE41Dispatch(const MorphPlan &plan, const float *xs, const float *ys,
+                               int x0, int count, int y,
+                               float *sourceX, float *sourceY,
+                               float *targetX, float *targetY,
+                               float *weightSums)
+{
+    if (plan.GetCount() == 0)
+        FieldScalar(plan, xs, ys, x0, count, y, sourceX, sourceY, targetX, targetY, weightSums);
+    else if (targetX)
+        FieldSSE41W<true>(plan, xs, ys, x0, count, y, sourceX, sourceY, targetX, targetY,
+                          weightSums);
+    else
+        FieldSSE41W<false>(plan, xs, ys, x0, count, y, sourceX, sourceY, targetX, targetY,
+                           weightSums);
+}
+
+WARP_TARGET_SSE41 static inline __m128i LerpPackedSSE(__m128i a, __m128i b, __m128i w)
+{
+    const __m128i mask = _mm_set1_epi32(0x00ff00ff);
+    __m128i iw = _mm_sub_epi16(_mm_set1_epi16(256), w);
+    __m128i rb = _mm_add_epi16(_mm_mullo_epi16(_mm_and_si128(a, mask), iw),
+                               _mm_mullo_epi16(_mm_and_si128(b, mask), w));
+    __m128i ga = _mm_add_epi16(_mm_mullo_epi16(_mm_and_si128(_mm_srli_epi32(a, 8), mask), iw),
+                               _mm_mullo_epi16(_mm_and_si128(_mm_srli_epi32(b, 8), mask), w));
+    return _mm_or_si128(_mm_and_si128(_mm_srli_epi16(rb, 8), mask),
+                        _mm_andnot_si128(mask, ga));
+}
+
+/**
+ * Fixed-point bilinear sampling of 4 positions at a time: scalar tap loads,
+ * vector weights and lerps.
+ */
+WARP_TARGET_SSE41 static void SampleRowSSE41(const PaddedImage &image, const float *xs, const float *ys,
+                                             int count, STColor4ub *out)
+{
+    const PackedPixel *origin = image.GetOrigin();
+    const int stride = image.GetStride();
+    const __m128 W = _mm_set1_ps((float)image.GetWidth());
+    const __m128 H = _mm_set1_ps((float)image.GetHeight());
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 scale = _mm_set1_ps(256.f);
+
+    for (int i = 0; i < count; i += 4) {
+        int lanes = count - i < 4 ? count - i : 4;
+        float xBuf[4] = { -1, -1, -1, -1 };
+        float yBuf[4] = { -1, -1, -1, -1 };
+        memcpy(xBuf, xs + i, lanes * sizeof(float));
+        memcpy(yBuf, ys + i, lanes * sizeof(float));
+        __m128 x = _mm_loadu_ps(xBuf);
+        __m128 y = _mm_loadu_ps(yBuf);
+
+        __m128 inside = _mm_and_ps(
+            _mm_and_ps(_mm_cmpge_ps(x, zero), _mm_cmplt_ps(x, W)),
+            _mm_and_ps(_mm_cmpge_ps(y, zero), _mm_cmplt_ps(y, H)));
+        x = _mm_and_ps(x, inside);
+        y = _mm_and_ps(y, inside);
+
+        __m128i xi = _mm_cvttps_epi32(x);
+        __m128i yi = _mm_cvttps_epi32(y);
+        __m128i fx = _mm_cvttps_epi32(_mm_mul_ps(_mm_sub_ps(x, _mm_cvtepi32_ps(xi)), scale));
+        __m128i fy = _mm_cvttps_epi32(_mm_mul_ps(_mm_sub_ps(y, _mm_cvtepi32_ps(yi)), scale));
+        fx = _mm_or_si128(fx, _mm_slli_epi32(fx, 16));
+        fy = _mm_or_si128(fy, _mm_slli_epi32(fy, 16));
+
+        int index[4];
+        _mm_storeu_si128((__m128i *)index,
+                         _mm_add_epi32(_mm_mullo_epi32(yi, _mm_set1_epi32(stride)), xi));
+        PackedPixel taps[4][4];
+        for (int j = 0; j < 4; j++) {
+            const PackedPixel *p = origin + index[j];
+            taps[0][j] = p[0];
+            taps[1][j] = p[1];
+            taps[2][j] = p[stride];
+            taps[3][j] = p[stride + 1];
+        }
+        __m128i p00 = _mm_loadu_si128((const __m128i *)taps[0]);
+        __m128i p10 = _mm_loadu_si128((const __m128i *)taps[1]);
+        __m128i p01 = _mm_loadu_si128((const __m128i *)taps[2]);
+        __m128i p11 = _mm_loadu_si128((const __m128i *)taps[3]);
+
+        __m128i result = LerpPackedSSE(LerpPackedSSE(p00, p10, fx),
+                                       LerpPackedSSE(p01, p11, fx), fy);
+        result = _mm_and_si128(result, _mm_castps_si128(inside));
+
+        int outBuf[4];
+        _mm_storeu_si128((__m128i *)outBuf, result);
+        memcpy((void *)(out + i), outBuf, lanes * sizeof(int));
+    }
+}
+
+// --------------------------------------------------------------------------
+// AVX2 kernels (8 pixels per step)
+// --------------------------------------------------------------------------
+
+WARP_TARGET_AVX2 static inline __m256 Log2AVX2(__m256 x)
+{
+    const __m256i bits = _mm256_castps_si256(x);
+    __m256 e = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23),
+                                                   _mm256_set1_epi32(126)));
+    __m256 m = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007fffff)),
+                                                   _mm256_set1_epi32(0x3f000000)));
+    __m256 small = _mm256_cmp_ps(m, _mm256_set1_ps(0.707106781186547524f), _CMP_LT_OQ);
+    e = _mm256_sub_ps(e, _mm256_and_ps(small, _mm256_set1_ps(1.f)));
+    __m256 f = _mm256_sub_ps(_mm256_add_ps(m, _mm256_and_ps(small, m)), _mm256_set1_ps(1.f));
+
+    __m256 z = _mm256_mul_ps(f, f);
+    __m256 y = _mm256_set1_ps(7.0376836292e-2f);
+    y = _mm256_add_ps(_mm256_mul_ps(y, f), _mm256_set1_ps(-1.1514610310e-1f));
+    y = _mm256_add_ps(_mm256_mul_ps(y, f), _mm256_set1_ps(1.1676998740e-1f));
+    y = _mm256_add_ps(_mm256_mul_ps(y, f), _mm256_set1_ps(-1.2420140846e-1f));
+    y = _mm256_add_ps(_mm256_mul_ps(y, f), _mm256_set1_ps(1.4249322787e-1f));
+    y = _mm256_add_ps(_mm256_mul_ps(y, f), _mm256_set1_ps(-1.6668057665e-1f));
+    y = _mm256_add_ps(_mm256_mul_ps(y, f), _mm256_set1_ps(2.0000714765e-1f));
+    y = _mm256_add_ps(_mm256_mul_ps(y, f), _mm256_set1_ps(-2.4999993993e-1f));
+    y = _mm256_add_ps(_mm256_mul_ps(y, f), _mm256_set1_ps(3.3333331174e-1f));
+    y = _mm256_mul_ps(_mm256_mul_ps(y, f), z);
+    y = _mm256_sub_ps(y, _mm256_mul_ps(z, _mm256_set1_ps(0.5f)));
+    __m256 ln = _mm256_add_ps(f, y);
+    return _mm256_add_ps(_mm256_mul_ps(ln, _mm256_set1_ps(1.44269504088896341f)), e);
+}
+
+WARP_TARGET_AVX2 static inline __m256 Exp2AVX2(__m256 x)
+{
+    x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-126.f)), _mm256_set1_ps(127.f));
+    __m256 n = _mm256_round_ps(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    x = _mm256_sub_ps(x, n);
+
+    __m256 y = _mm256_set1_ps(1.535336188319500e-4f);
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(1.339887440266574e-3f));
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(9.618437357674640e-3f));
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(5.550332471162809e-2f));
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(2.402264791363012e-1f));
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(6.931472028550421e-1f));
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(1.f));
+
+    __m256i scale = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n),
+                                                       _mm256_set1_epi32(127)), 23);
+    return _mm256_mul_ps(y, _mm256_castsi256_ps(scale));
+}
+
+template <bool kBothSides, int kWeight>
+WARP_TARGET_AVX2 static void FieldAVX2(const MorphPlan &plan, const float *xs, const float *ys,
+                                       int x0, int count, int y,
+                                       float *sourceX, float *sourceY,
+                                       float *targetX, float *targetY,
+                                       float *weightSums)
+{
+    const FeatureLines &lines = plan.lines;
+    const FeatureLines &src = plan.sourceOffsets;
+    const FeatureLines &tgt = plan.targetOffsets;
+    const int n = lines.count;
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.f);
+    const __m256 signMask = _mm256_set1_ps(-0.f);
+    const __m256 a = _mm256_set1_ps(plan.a);
+    const __m256 b = _mm256_set1_ps(plan.b);
+    const __m256 rowY = _mm256_set1_ps((float)y);
+    const __m256 laneOffsets = _mm256_set_ps(7.f, 6.f, 5.f, 4.f, 3.f, 2.f, 1.f, 0.f);
+
+    for (int i = 0; i < count; i += 8) {
+        __m256 X, Y;
+        if (xs) {
+            // unused tail lanes evaluate (0,0) and are dropped below
+            float xBuf[8] = { 0, 0, 0, 0, 0, 0, 0, 0 }, yBuf[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+            int lanes = count - i < 8 ? count - i : 8;
+            memcpy(xBuf, xs + i, lanes * sizeof(float));
+            memcpy(yBuf, ys + i, lanes * sizeof(float));
+            X = _mm256_loadu_ps(xBuf);
+            Y = _mm256_loadu_ps(yBuf);
+        } else {
+            X = _mm256_add_ps(_mm256_set1_ps((float)(x0 + i)), laneOffsets);
+            Y = rowY;
+        }
+        __m256 sdx = zero, sdy = zero, tdx = zero, tdy = zero, weightSum = zero;
+
+        for (int f = 0; f < n; f++) {
+            __m256 rx = _mm256_sub_ps(X, _mm256_set1_ps(lines.px[f]));
+            __m256 ry = _mm256_sub_ps(Y, _mm256_set1_ps(lines.py[f]));
+            __m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(rx, _mm256_set1_ps(lines.dx[f])),
+                                                   _mm256_mul_ps(ry, _mm256_set1_ps(lines.dy[f]))),
+                                     _mm256_set1_ps(plan.invLengthSq[f]));
+            __m256 v = _mm256_add_ps(_mm256_mul_ps(rx, _mm256_set1_ps(lines.nx[f])),
+                                     _mm256_mul_ps(ry, _mm256_set1_ps(lines.ny[f])));
+
+            __m256 ex = _mm256_sub_ps(X, _mm256_set1_ps(lines.qx[f]));
+            __m256 ey = _mm256_sub_ps(Y, _mm256_set1_ps(lines.qy[f]));
+            __m256 distP = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(rx, rx), _mm256_mul_ps(ry, ry)));
+            __m256 distQ = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(ex, ex), _mm256_mul_ps(ey, ey)));
+            __m256 dist = _mm256_andnot_ps(signMask, v);
+            dist = _mm256_blendv_ps(dist, distQ, _mm256_cmp_ps(u, one, _CMP_GT_OQ));
+            dist = _mm256_blendv_ps(dist, distP, _mm256_cmp_ps(u, zero, _CMP_LT_OQ));
+
+            __m256 base = _mm256_div_ps(_mm256_set1_ps(plan.lengthPowP[f]), _mm256_add_ps(a, dist));
+            __m256 weight;
+            if (kWeight == WEIGHT_LINEAR)
+                weight = base;
+            else if (kWeight == WEIGHT_SQUARE)
+                weight = _mm256_mul_ps(base, base);
+            else
+                weight = Exp2AVX2(_mm256_mul_ps(b, Log2AVX2(base)));
+
+            __m256 sx = _mm256_add_ps(_mm256_add_ps(_mm256_set1_ps(src.px[f]),
+                                                    _mm256_mul_ps(u, _mm256_set1_ps(src.dx[f]))),
+                                      _mm256_mul_ps(v, _mm256_set1_ps(src.nx[f])));
+            __m256 sy = _mm256_add_ps(_mm256_add_ps(_mm256_set1_ps(src.py[f]),
+                                                    _mm256_mul_ps(u, _mm256_set1_ps(src.dy[f]))),
+                                      _mm256_mul_ps(v, _mm256_set1_ps(src.ny[f])));
+            sdx = _mm256_add_ps(sdx, _mm256_mul_ps(sx, weight));
+            sdy = _mm256_add_ps(sdy, _mm256_mul_ps(sy, weight));
+            if (kBothSides) {
+                __m256 tx = _mm256_add_ps(_mm256_add_ps(_mm256_set1_ps(tgt.px[f]),
+                                                        _mm256_mul_ps(u, _mm256_set1_ps(tgt.dx[f]))),
+                                          _mm256_mul_ps(v, _mm256_set1_ps(tgt.nx[f])));
+                __m256 ty = _mm256_add_ps(_mm256_add_ps(_mm256_set1_ps(tgt.py[f]),
+                                                        _mm256_mul_ps(u, _mm256_set1_ps(tgt.dy[f]))),
+                                          _mm256_mul_ps(v, _mm256_set1_ps(tgt.ny[f])));
+                tdx = _mm256_add_ps(tdx, _mm256_mul_ps(tx, weight));
+                tdy = _mm256_add_ps(tdy, _mm256_mul_ps(ty, weight));
+            }
+            weightSum = _mm256_add_ps(weightSum, weight);
+        }
+
+        float out[5][8];
+        _mm256_storeu_ps(out[0], _mm256_add_ps(X, _mm256_div_ps(sdx, weightSum)));
+        _mm256_storeu_ps(out[1], _mm256_add_ps(Y, _mm256_div_ps(sdy, weightSum)));
+        if (kBothSides) {
+            _mm256_storeu_ps(out[2], _mm256_add_ps(X, _mm256_div_ps(tdx, weightSum)));
+            _mm256_storeu_ps(out[3], _mm256_add_ps(Y, _mm256_div_ps(tdy, weightSum)));
+        }
+        _mm256_storeu_ps(out[4], weightSum);
+        int lanes = count - i < 8 ? count - i : 8;
+        memcpy(sourceX + i, out[0], lanes * sizeof(float));
+        memcpy(sourceY + i, out[1], lanes * sizeof(float));
+        if (kBothSides) {
+            memcpy(targetX + i, out[2], lanes * sizeof(float));
+            memcpy(targetY + i, out[3], lanes * sizeof(float));
+        }
+        if (weightSums)
+            memcpy(weightSums + i, out[4], lanes * sizeof(float));
+    }
+}
+
+template <bool kBothSides>
+static void FieldAVX2W(const MorphPlan &plan, const float *xs, const float *ys,
+                       int x0, int count, int y,
+                       float *sourceX, float *sourceY,
+                       float *targetX, float *targetY,
+                       float *weightSums)
+{
+    switch (GetWeightKind(plan.b)) {
+        case WEIGHT_LINEAR:
+            FieldAVX2<kBothSides, WEIGHT_LINEAR>(plan, xs, ys, x0, count, y,
+                                                   sourceX, sourceY, targetX, targetY, weightSums);
+            break;
+        case WEIGHT_SQUARE:
+            FieldAVX2<kBothSides, WEIGHT_SQUARE>(plan, xs, ys, x0, count, y,
+                                                   sourceX, sourceY, targetX, targetY, weightSums);
+            break;
+        default:
+            FieldAVX2<kBothSides, WEIGHT_POW>(plan, xs, ys, x0, count, y,
+                                                sourceX, sourceY, targetX, targetY, weightSums);
+            break;
+    }
+}
+
+static void FieldAVX2Dispatch(const MorphPlan &plan, const float *xs, const float *ys,
+                              int x0, int count, int y,
+                              float *sourceX, float *sourceY,
+                              float *targetX, float *targetY,
+                              float *weightSums)
+{
+    if (plan.GetCount() == 0)
+        FieldScalar(plan, xs, ys, x0, count, y, sourceX, sourceY, targetX, targetY, weightSums);
+    else if (targetX)
+        FieldAVX2W<true>(plan, xs, ys, x0, count, y, sourceX, sourceY, targetX, targetY,
+                         weightSums);
+    else
+        FieldAVX2W<false>(plan, xs, ys, x0, count, y, sourceX, sourceY, targetX, targetY,
+                          weightSums);
+}
+
+/**
+ * Fixed-point bilinear sampling of 8 positions at a time. Thanks to the
+ * apron of the padded image the four taps are plain gathers; the lerps run
+ * on 16-bit lanes, red/blue and green/alpha two per 32-bit pixel.
+ */
+WARP_TARGET_AVX2 static inline __m256i LerpPackedAVX2(__m256i a, __m256i b, __m256i w)
+{
+    const __m256i mask = _mm256_set1_epi32(0x00ff00ff);
+    __m256i iw = _mm256_sub_epi16(_mm256_set1_epi16(256), w);
+    __m256i rb = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_and_si256(a, mask), iw),
+                                  _mm256_mullo_epi16(_mm256_and_si256(b, mask), w));
+    __m256i ga = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_and_si256(_mm256_srli_epi32(a, 8), mask), iw),
+                                  _mm256_mullo_epi16(_mm256_and_si256(_mm256_srli_epi32(b, 8), mask), w));
+    return _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(rb, 8), mask),
+                           _mm256_andnot_si256(mask, ga));
+}
+
+WARP_TARGET_AVX2 static void SampleRowAVX2(const PaddedImage &image, const float *xs, const float *ys,
+                                           int count, STColor4ub *out)
+{
+    const int *origin = (const int *)image.GetOrigin();
+    const __m256 W = _mm256_set1_ps((float)image.GetWidth());
+    const __m256 H = _mm256_set1_ps((float)image.GetHeight());
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 scale = _mm256_set1_ps(256.f);
+    const __m256i stride = _mm256_set1_epi32(image.GetStride());
+    const __m256i one = _mm256_set1_epi32(1);
+
+    for (int i = 0; i < count; i += 8) {
+        int lanes = count - i < 8 ? count - i : 8;
+        float xBuf[8] = { -1, -1, -1, -1, -1, -1, -1, -1 };
+        float yBuf[8] = { -1, -1, -1, -1, -1, -1, -1, -1 };
+        memcpy(xBuf, xs + i, lanes * sizeof(float));
+        memcpy(yBuf, ys + i, lanes * sizeof(float));
+        __m256 x = _mm256_loadu_ps(xBuf);
+        __m256 y = _mm256_loadu_ps(yBuf);
+
+        // inside the image at all (false for NaN, too); outside lanes
+        // sample pixel (0,0) and are cleared at the end
+        __m256 inside = _mm256_and_ps(
+            _mm256_and_ps(_mm256_cmp_ps(x, zero, _CMP_GE_OQ), _mm256_cmp_ps(x, W, _CMP_LT_OQ)),
+            _mm256_and_ps(_mm256_cmp_ps(y, zero, _CMP_GE_OQ), _mm256_cmp_ps(y, H, _CMP_LT_OQ)));
+        x = _mm256_and_ps(x, inside);
+        y = _mm256_and_ps(y, inside);
+
+        __m256i xi = _mm256_cvttps_epi32(x);
+        __m256i yi = _mm256_cvttps_epi32(y);
+        __m256i fx = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_sub_ps(x, _mm256_cvtepi32_ps(xi)), scale));
+        __m256i fy = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_sub_ps(y, _mm256_cvtepi32_ps(yi)), scale));
+        // the same weight in both 16-bit halves of each lane
+        fx = _mm256_or_si256(fx, _mm256_slli_epi32(fx, 16));
+        fy = _mm256_or_si256(fy, _mm256_slli_epi32(fy, 16));
+
+        __m256i index = _mm256_add_epi32(_mm256_mullo_epi32(yi, stride), xi);
+        __m256i indexUp = _mm256_add_epi32(index, stride);
+        __m256i p00 = _mm256_i32gather_epi32(origin, index, 4);
+        __m256i p10 = _mm256_i32gather_epi32(origin, _mm256_add_epi32(index, one), 4);
+        __m256i p01 = _mm256_i32gather_epi32(origin, indexUp, 4);
+        __m256i p11 = _mm256_i32gather_epi32(origin, _mm256_add_epi32(indexUp, one), 4);
+
+        __m256i result = LerpPackedAVX2(LerpPackedAVX2(p00, p10, fx),
+                                        LerpPackedAVX2(p01, p11, fx), fy);
+        result = _mm256_and_si256(result, _mm256_castps_si256(inside));
+
+        int outBuf[8];
+        _mm256_storeu_si256((__m256i *)outBuf, result);
+        memcpy((void *)(out + i), outBuf, lanes * sizeof(int));
+    }
+}
+
+/**
+ * 8 pixels per step; unpacking and packing both work within 128-bit halves,
+ * so the pixel order is preserved.
+ */
+WARP_TARGET_AVX2 static void BlendRowAVX2(const STColor4ub *a, const STColor4ub *b,
+                                          unsigned int w, int count, STColor4ub *out)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i half = _mm256_set1_epi16(128);
+    const __m256i wb = _mm256_set1_epi16((short)w);
+    const __m256i wa = _mm256_set1_epi16((short)(256 - w));
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i pa = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i pb = _mm256_loadu_si256((const __m256i *)(b + i));
+        __m256i lo = _mm256_add_epi16(_mm256_add_epi16(
+                         _mm256_mullo_epi16(_mm256_unpacklo_epi8(pa, zero), wa),
+                         _mm256_mullo_epi16(_mm256_unpacklo_epi8(pb, zero), wb)), half);
+        __m256i hi = _mm256_add_epi16(_mm256_add_epi16(
+                         _mm256_mullo_epi16(_mm256_unpackhi_epi8(pa, zero), wa),
+                         _mm256_mullo_epi16(_mm256_unpackhi_epi8(pb, zero), wb)), half);
+        __m256i result = _mm256_packus_epi16(_mm256_srli_epi16(lo, 8),
+                                             _mm256_srli_epi16(hi, 8));
+        _mm256_storeu_si256((__m256i *)(out + i), result);
+    }
+    // leave AVX state before running the legacy-SSE tail
+    _mm256_zeroupper();
+    BlendRowSSE2(a + i, b + i, w, count - i, out + i);
+}
+
+// --------------------------------------------------------------------------
+// CPU detection
+// --------------------------------------------------------------------------
+
+static SimdLevel DetectSimdLevel()
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return SIMD_SCALAR;
+    if (!(ecx & bit_SSE4_1))
+        return SIMD_SCALAR;
+
+    // AVX2 also needs the OS to save the YMM registers (XCR0 bits 1 and 2)
+    if ((ecx & bit_OSXSAVE) && (ecx & bit_AVX)) {
+        unsigned int xcr0Low, xcr0High;
+        __asm__ ("xgetbv" : "=a" (xcr0Low), "=d" (xcr0High) : "c" (0));
+        if ((xcr0Low & 6) == 6 && __get_cpuid_max(0, NULL) >= 7) {
+            __cpuid_count(7, 0, eax, ebx, ecx, edx);
+            if (ebx & bit_AVX2)
+                return SIMD_AVX2;
+        }
+    }
+    return SIMD_SSE41;
+}
+
+#else // !WARP_HAVE_X86
+
+static SimdLevel DetectSimdLevel()
+{
+    return SIMD_SCALAR;
+}
+
+#endif // WARP_HAVE_X86
+
+// --------------------------------------------------------------------------
+// Dispatch
+// --------------------------------------------------------------------------
+
+// Row and point entry points of the field evaluators above; the evaluators
+// read pixel positions from xs/ys when given, and from the row otherwise.
+
+static void FieldRowScalar(const MorphPlan &plan, int x0, int count, int y,
+                           float *sourceX, float *sourceY,
+                           float *targetX, float *targetY)
+{
+    FieldScalar(plan, NULL, NULL, x0, count, y, sourceX, sourceY, targetX, targetY,
+                NULL);
+}
+
+static void FieldPointsScalar(const MorphPlan &plan, const float *xs, const float *ys,
+                              int count, float *sourceX, float *sourceY,
+                              float *targetX, float *targetY)
+{
+    FieldScalar(plan, xs, ys, 0, count, 0, sourceX, sourceY, targetX, targetY,
+                NULL);
+}
+
+static void FieldRowWeightedScalar(const MorphPlan &plan, int x0, int count, int y,
+                                   float *sourceX, float *sourceY,
+                                   float *targetX, float *targetY, float *weightSums)
+{
+    FieldScalar(plan, NULL, NULL, x0, count, y, sourceX, sourceY, targetX, targetY,
+                weightSums);
+}
+
+#ifdef WARP_HAVE_X86
+
+static void FieldRowSSE41(const MorphPlan &plan, int x0, int count, int y,
+                          float *sourceX, float *sourceY,
+                          float *targetX, float *targetY)
+{
+    FieldSSE41Dispatch(plan, NULL, NULL, x0, count, y, sourceX, sourceY, targetX, targetY,
+                       NULL);
+}
+
+static void FieldPointsSSE41(const MorphPlan &plan, const float *xs, const float *ys,
+                             int count, float *sourceX, float *sourceY,
+                             float *targetX, float *targetY)
+{
+    FieldSSE41Dispatch(plan, xs, ys, 0, count, 0, sourceX, sourceY, targetX, targetY,
+                       NULL);
+}
+
+static void FieldRowWeightedSSE41(const MorphPlan &plan, int x0, int count, int y,
+                                  float *sourceX, float *sourceY,
+                                  float *targetX, float *targetY, float *weightSums)
+{
+    FieldSSE41Dispatch(plan, NULL, NULL, x0, count, y, sourceX, sourceY, targetX, targetY,
+                       weightSums);
+}
+
+static void FieldRowAVX2(const MorphPlan &plan, int x0, int count, int y,
+                         float *sourceX, float *sourceY,
+                         float *targetX, float *targetY)
+{
+    FieldAVX2Dispatch(plan, NULL, NULL, x0, count, y, sourceX, sourceY, targetX, targetY,
+                      NULL);
+}
+
+static void FieldPointsAVX2(const MorphPlan &plan, const float *xs, const float *ys,
+                            int count, float *sourceX, float *sourceY,
+                            float *targetX, float *targetY)
+{
+    FieldAVX2Dispatch(plan, xs, ys, 0, count, 0, sourceX, sourceY, targetX, targetY,
+                      NULL);
+}
+
+static void FieldRowWeightedAVX2(const MorphPlan &plan, int x0, int count, int y,
+                                 float *sourceX, float *sourceY,
+                                 float *targetX, float *targetY, float *weightSums)
+{
+    FieldAVX2Dispatch(plan, NULL, NULL, x0, count, y, sourceX, sourceY, targetX, targetY,
+                      weightSums);
+}
+
+#endif // WARP_HAVE_X86
+
+SimdLevel GetCPUSimdLevel()
+{
+    static SimdLevel level = DetectSimdLevel();
+    return level;
+}
+
+const char *GetSimdLevelName(SimdLevel level)
+{
+    switch (level) {
+        case SIMD_SCALAR: return "scalar";
+        case SIMD_SSE41: return "SSE4.1";
+        case SIMD_AVX2: return "AVX2";
+        default: return "auto";
+    }
+}
+
+WarpKernels GetWarpKernels(SimdLevel level)
+{
+    SimdLevel supported = GetCPUSimdLevel();
+    if (level == SIMD_AUTO || level > supported)
+        level = supported;
+
+    WarpKernels kernels;
+    kernels.level = level;
+    kernels.fieldRow = FieldRowScalar;
+    kernels.fieldPoints = FieldPointsScalar;
+    kernels.fieldRowWeighted = FieldRowWeightedScalar;
+    kernels.sampleRow = SampleRowScalar;
+    kernels.blendRow = BlendRowScalar;
+#ifdef WARP_HAVE_X86
+    if (level == SIMD_SSE41) {
+        kernels.fieldRow = FieldRowSSE41;
+        kernels.fieldPoints = FieldPointsSSE41;
+        kernels.fieldRowWeighted = FieldRowWeightedSSE41;
+        kernels.sampleRow = SampleRowSSE41;
+        kernels.blendRow = BlendRowSSE2;
+    } else if (level == SIMD_AVX2) {
+        kernels.fieldRow = FieldRowAVX2;
+        kernels.fieldPoints = FieldPointsAVX2;
+        kernels.fieldRowWeighted = FieldRowWeightedAVX2;
+        kernels.sampleRow = SampleRowAVX2;
+        kernels.blendRow = BlendRowAVX2;
+    }
+#endif
+    return kernels;
+}
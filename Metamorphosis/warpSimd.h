@@ -0,0 +1,88 @@
+// --------------------------------------------------------------------------
+// warpSimd.h
+//
+// Row kernels for the field warp, in scalar, SSE4.1 and AVX2 flavors. The
+// vector kernels evaluate 4 (SSE4.1) or 8 (AVX2) horizontally adjacent
+// pixels at once against the structure-of-arrays tables of a MorphPlan; the
+// best flavor the CPU supports is picked at runtime via CPUID. The
+// cross-dissolve row kernel is part of the same set; its SSE4.1 level only
+// needs SSE2.
+//
+// Tolerance: the vector kernels replace powf() by a polynomial
+// exp2(b * log2(x)) with a relative error below 1e-6, so mapped positions
+// agree with the scalar kernel to within 1e-3 pixels. Sampled colors are
+// bit-exact for identical positions; in practice channels differ by at most
+// 1 except for the rare pixel whose mapped position sits right on an image
+// border, where the in/out-of-bounds test may flip. With b = 1 or b = 2 no
+// approximation is involved (see weightPolicy.h).
+//
+
+#ifndef __WARPSIMD_H__
+#define __WARPSIMD_H__
+
+#include "STColor4ub.h"
+
+class PaddedImage;
+struct MorphPlan;
+
+// Instruction sets the warp kernels are available for.
+enum SimdLevel
+{
+    SIMD_AUTO = -1,     // best level supported by the CPU
+    SIMD_SCALAR = 0,
+    SIMD_SSE41,
+    SIMD_AVX2
+};
+
+// Highest SimdLevel the CPU (and OS) supports. CPUID is only queried once.
+SimdLevel GetCPUSimdLevel();
+
+// Human readable name of a SimdLevel, e.g. for logging.
+const char *GetSimdLevelName(SimdLevel level);
+
+// Computes where the count pixels (x0, y) ... (x0+count-1, y) map to under
+// the plan's source lines and, if targetX is not NULL, its target lines.
+typedef void (*FieldRowKernel)(const MorphPlan &plan, int x0, int count, int y,
+                               float *sourceX, float *sourceY,
+                               float *targetX, float *targetY);
+
+// FieldRowKernel for count arbitrary pixel positions (xs[i], ys[i]).
+typedef void (*FieldPointsKernel)(const MorphPlan &plan, const float *xs, const float *ys,
+                                  int count, float *sourceX, float *sourceY,
+                                  float *targetX, float *targetY);
+
+// FieldRowKernel that also stores the sum of the feature weights at each
+// pixel in weightSums, so that further weighted terms can be merged into the
+// normalized result (see clusterWarp.h). The sum is 0 for an empty plan.
+typedef void (*FieldRowWeightedKernel)(const MorphPlan &plan, int x0, int count, int y,
+                                       float *sourceX, float *sourceY,
+                                       float *targetX, float *targetY, float *weightSums);
+
+// Samples image at count positions with the semantics of SampleBilinear():
+// fixed-point bilinear filtering, transparent black outside of the image.
+// All flavors produce identical pixels.
+typedef void (*SampleRowKernel)(const PaddedImage &image, const float *xs, const float *ys,
+                                int count, STColor4ub *out);
+
+// Cross-dissolves count RGBA pixels, alpha included:
+// out = (a * (256 - w) + b * w + 128) >> 8 per channel, with the 8.8 fixed
+// point weight w in 0..256 computed in 16-bit lanes. All flavors produce
+// identical pixels, and out may alias a or b.
+typedef void (*BlendRowKernel)(const STColor4ub *a, const STColor4ub *b, unsigned int w,
+                               int count, STColor4ub *out);
+
+struct WarpKernels
+{
+    SimdLevel level;            // level actually in use
+    FieldRowKernel fieldRow;
+    FieldPointsKernel fieldPoints;
+    FieldRowWeightedKernel fieldRowWeighted;
+    SampleRowKernel sampleRow;
+    BlendRowKernel blendRow;
+};
+
+// Kernels for the requested level. Requests above what the CPU supports
+// (and SIMD_AUTO) get the best supported level.
+WarpKernels GetWarpKernels(SimdLevel level = SIMD_AUTO);
+
+#endif // __WARPSIMD_H__
@@ -0,0 +1,63 @@
+// --------------------------------------------------------------------------
+// weightPolicy.h
+//
+// Compile-time policies for the Beier & Neely feature weight
+//
+//     weight = (|PQ|^p / (a + dist))^b
+//
+// |PQ|^p is evaluated once per feature and frame by the MorphPlan; the
+// per-pixel power by b is what the policies specialize. For the common
+// b = 1 and b = 2 it reduces to the base itself or a multiply; any other b
+// falls back to powf(). Kernels are instantiated once per policy and the
+// instantiation is picked from the runtime b when a row is dispatched.
+//
+
+#ifndef __WEIGHTPOLICY_H__
+#define __WEIGHTPOLICY_H__
+
+#include <math.h>
+
+enum WeightKind
+{
+    WEIGHT_POW,         // generic powf(base, b)
+    WEIGHT_LINEAR,      // b == 1
+    WEIGHT_SQUARE       // b == 2
+};
+
+// The specialization to use for a runtime exponent b.
+inline WeightKind GetWeightKind(float b)
+{
+    if (b == 1.f) return WEIGHT_LINEAR;
+    if (b == 2.f) return WEIGHT_SQUARE;
+    return WEIGHT_POW;
+}
+
+template <int kKind>
+struct WeightPolicy
+{
+    static inline float Weight(float base, float b) { return powf(base, b); }
+};
+
+template <>
+struct WeightPolicy<WEIGHT_LINEAR>
+{
+    static inline float Weight(float base, float) { return base; }
+};
+
+template <>
+struct WeightPolicy<WEIGHT_SQUARE>
+{
+    static inline float Weight(float base, float) { return base * base; }
+};
+
+// |PQ|^p with the common exponents p = 0, 1/2 and 1 reduced to a constant,
+// a square root and the length itself.
+inline float LengthPowP(float length, float p)
+{
+    if (p == 0.f) return 1.f;
+    if (p == 0.5f) return sqrtf(length);
+    if (p == 1.f) return length;
+    return powf(length, p);
+}
+
+#endif // __WEIGHTPOLICY_H__
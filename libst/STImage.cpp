@@ -9,8 +9,8 @@
 #include <string>
 
 //
-// Load a new image from an image file (PPM, JPEG
-// and PNG formats are supported).
+// Load a new image from an image file (PPM/PGM/PAM,
+// JPEG and PNG formats are supported).
 // Returns NULL on failure.
 //
 STImage::STImage(const std::string& filename)
@@ -23,7 +23,8 @@ STImage::STImage(const std::string& filename)
     // The format-specific subroutines are each implemented in
     // a different file.
     std::string ext = STGetExtension( filename );
-    if (ext.compare("PPM") == 0) {
+    if (ext.compare("PPM") == 0 || ext.compare("PGM") == 0 ||
+        ext.compare("PNM") == 0 || ext.compare("PAM") == 0) {
         LoadPPM(filename);
     }
     else if (ext.compare("PNG") == 0) {
@@ -80,25 +81,27 @@ STImage::~STImage()
 }
 
 //
-// Save the image to a file (PPM, JPEG and PNG
-// formats are supported).
+// Save the image to a file (PPM/PGM/PAM, JPEG and
+// PNG formats are supported).
 // Returns a non-zero value on error.
 //
-STStatus STImage::Save(const std::string& filename) const
+STStatus STImage::Save(const std::string& filename,
+                       const SaveOptions& options) const
 {
     // Determine the right routine based on the file's extension.
     // The format-specific subroutines are each implemented in
     // a different file.
     std::string ext = STGetExtension( filename );
 
-    if (ext.compare("PPM") == 0 ) {
+    if (ext.compare("PPM") == 0 || ext.compare("PGM") == 0 ||
+        ext.compare("PNM") == 0 || ext.compare("PAM") == 0) {
         return SavePPM(filename);
     }
     else if (ext.compare("PNG") == 0) {
-        return SavePNG(filename);
+        return SavePNG(filename, options);
     }
     else if (ext.compare("JPG") == 0) {
-        return SaveJPG(filename);
+        return SaveJPG(filename, options);
     }
     else {
         fprintf(stderr,
@@ -109,6 +112,27 @@ STStatus STImage::Save(const std::string& filename) const
     } 
 }
 
+//
+// Encoder settings of a preset.
+//
+STImage::SaveOptions::SaveOptions(SavePreset preset)
+    : pngCompression(-1)
+    , pngFilter(PNG_ROW_FILTER_ADAPTIVE)
+    , jpgQuality(90)
+    , jpgTransform(JPG_DCT_INTEGER)
+    , jpgOptimizeCoding(false)
+{
+    if (preset == SAVE_FASTEST) {
+        pngCompression = 1;
+        pngFilter = PNG_ROW_FILTER_SUB;
+        jpgTransform = JPG_DCT_FAST_INTEGER;
+    }
+    else if (preset == SAVE_SMALLEST) {
+        pngCompression = 9;
+        jpgOptimizeCoding = true;
+    }
+}
+
 //
 // Draw the image to the OpenGL window using glDrawPixels.
 // The bottom-left of the image will align with (0.0, 0.0)
@@ -119,7 +119,7 @@ void STImage::LoadJPG(const std::string& filename)
 // Create a JPEG file from the pixel contents of the STImage, using libjpeg.
 //
 STStatus
-STImage::SaveJPG(const std::string& filename) const
+STImage::SaveJPG(const std::string& filename, const SaveOptions& options) const
 {
     // Open image file.
     FILE* imgFile = fopen(filename.c_str(), "wb");
@@ -150,7 +150,12 @@ STImage::SaveJPG(const std::string& filename) const
     cinfo.in_color_space = JCS_RGB;     
 
     jpeg_set_defaults(&cinfo);
-    jpeg_set_quality(&cinfo, 90, TRUE);
+    jpeg_set_quality(&cinfo, options.jpgQuality, TRUE);
+    if (options.jpgTransform == JPG_DCT_FAST_INTEGER)
+        cinfo.dct_method = JDCT_IFAST;
+    else if (options.jpgTransform == JPG_DCT_FLOAT)
+        cinfo.dct_method = JDCT_FLOAT;
+    cinfo.optimize_coding = options.jpgOptimizeCoding ? TRUE : FALSE;
     jpeg_start_compress(&cinfo, TRUE);
 
     int rowStride = mWidth * 3;
@@ -66,6 +66,8 @@ void STImage::LoadPNG(const std::string& filename)
     if (setjmp(png_jmpbuf(pngPtr))) {
         fprintf(stderr, "STImage::LoadPNG() - Error reading '%s'.\n",
                 filename.c_str());
+        delete [] mPixels;
+        mPixels = NULL;
         png_destroy_read_struct(&pngPtr, &infoPtr, (png_infopp)NULL);
         fclose(imgFile);
         throw std::runtime_error("Error in LoadPNG");
@@ -74,91 +76,58 @@ void STImage::LoadPNG(const std::string& filename)
     png_init_io(pngPtr, imgFile);
     png_set_sig_bytes(pngPtr, 8);
 
-    // The following code used the libpng high level interface
-    // to read data from the file into the array of STColor4ub structs
-    // representing an image in this class.  Format conversion into 8-bit
-    // RGBA as currently required by this class, requires an additional
-    // buffer copy.  Using the libpng **low-level interface** this buffer
-    // copy and the associated buffer double allocation could be avoided.
-    // The code would be complicated slightly with additional libpng
-    // transform calls, so I will leave this for later if performance or
-    // memory footprint becomes an issue.
-
-    // These transforms get us very close to 8 bit per channel RGBA, but
-    // not quite (won't extend from 1 or 3 components to 4.  Must use low
-    // level interface to do this.
-    int transforms =            
-            PNG_TRANSFORM_PACKING |
-            PNG_TRANSFORM_PACKSWAP |
-            PNG_TRANSFORM_EXPAND |
-            PNG_TRANSFORM_SHIFT;
-
-    
-    // Tell libpng to load the image into memory
-    png_read_png(pngPtr, infoPtr, transforms, NULL);
-
-    
-    // libpng exposes the data as an array of arrays of bytes
-    png_bytepp pngRowPointers = png_get_rows(pngPtr, infoPtr);
+    // The following code uses the libpng low level interface, so that
+    // libpng decodes each row straight into the STImage class' pixel
+    // array: its transforms produce 8-bit RGBA from any PNG, and there is
+    // neither a second copy of the image nor a conversion pass.
+    png_read_info(pngPtr, infoPtr);
 
     int width = png_get_image_width(pngPtr, infoPtr);
     int height = png_get_image_height(pngPtr, infoPtr);
-    Initialize(width, height);
-    STColor4ub* pixels = mPixels;
+    int bitDepth = png_get_bit_depth(pngPtr, infoPtr);
+    int colorType = png_get_color_type(pngPtr, infoPtr);
+    bool hasTransparency = png_get_valid(pngPtr, infoPtr, PNG_INFO_tRNS) != 0;
 
-    int numChannels = png_get_channels(pngPtr, infoPtr);
+    // Palette images become RGB, gray images of less than 8 bits are
+    // widened to 8, and a transparent color key becomes an alpha channel.
+    if (colorType == PNG_COLOR_TYPE_PALETTE || bitDepth < 8 || hasTransparency)
+        png_set_expand(pngPtr);
+
+    // 16-bit channels keep their most significant byte
+    if (bitDepth == 16)
+        png_set_strip_16(pngPtr);
+
+    // monochrome is replicated into red, green and blue
+    if (colorType == PNG_COLOR_TYPE_GRAY || colorType == PNG_COLOR_TYPE_GRAY_ALPHA)
+        png_set_gray_to_rgb(pngPtr);
+
+    // images without an alpha channel get an opaque one
+    if (!(colorType & PNG_COLOR_MASK_ALPHA) && !hasTransparency)
+        png_set_filler(pngPtr, 0xff, PNG_FILLER_AFTER);
+
+    // interlaced images are decoded pass by pass into the same rows
+    int numPasses = png_set_interlace_handling(pngPtr);
+    png_read_update_info(pngPtr, infoPtr);
+
+    if (png_get_rowbytes(pngPtr, infoPtr) != (png_uint_32)width * sizeof(STColor4ub)) {
+        fprintf(stderr, "STImage::LoadPNG() - Could not convert '%s' to RGBA.\n",
+                filename.c_str());
+        png_destroy_read_struct(&pngPtr, &infoPtr, (png_infopp)NULL);
+        fclose(imgFile);
+        throw std::runtime_error("Error in LoadPNG");
+    }
+
+    Initialize(width, height);
 
-    // Now copy the data read by libpng into the STImage class'
-    // contiguous allocation of pixel data.  In doing so, explode
-    // single channel images or images without an alpha channle
-    // into full RGBA pixels.  
-    //
     // We also need to flip the order of the rows of data.  Data in
     // the png file begins with the topmost row of the image.  The
     // STImage class stores data bottom row first to be consistent
     // with OpenGL pixel formats
-    for (int i = 0; i < height; ++i) {
-
-        png_bytep srcPtr = pngRowPointers[height-i-1]; 
-        STColor4ub* curPixel = &pixels[ i*width ];
-
-        for (int j = 0; j < width; ++j) {
-
-            switch (numChannels) {
-
-            // monochrome, no alpha
-            case 1:
-                curPixel->r = curPixel->g = curPixel->b = *srcPtr++;
-                curPixel->a = 255;
-                break;
-
-            // monochrome, with alpha
-            case 2:
-                curPixel->r = curPixel->g = curPixel->b = *srcPtr++;
-                curPixel->a = *srcPtr++;
-                break;
-
-            // RGB, no alpha
-            case 3:
-                curPixel->r = *srcPtr++;
-                curPixel->g = *srcPtr++;
-                curPixel->b = *srcPtr++;
-                curPixel->a = 255;
-                break;
-                
-            // RGBA
-            case 4:
-                curPixel->r = *srcPtr++;
-                curPixel->g = *srcPtr++;
-                curPixel->b = *srcPtr++;
-                curPixel->a = *srcPtr++;
-                break;
-            }
-
-            curPixel++;
-        }
+    for (int pass = 0; pass < numPasses; ++pass) {
+        for (int i = 0; i < height; ++i)
+            png_read_row(pngPtr, (png_bytep)(mPixels + (height-i-1)*width), NULL);
     }
-
+    png_read_end(pngPtr, NULL);
 
     // Clean up libpng.
     png_destroy_read_struct(&pngPtr, &infoPtr, (png_infopp)NULL);
@@ -169,7 +138,7 @@ void STImage::LoadPNG(const std::string& filename)
 // Creates a PNG file from the pixel contents of the STImage using libpng.
 //
 STStatus
-STImage::SavePNG(const std::string& filename) const
+STImage::SavePNG(const std::string& filename, const SaveOptions& options) const
 {
     FILE* imgFile = fopen(filename.c_str(), "wb");
     
@@ -210,6 +179,14 @@ STImage::SavePNG(const std::string& filename) const
 
     png_init_io(pngPtr, imgFile);
 
+    // encoder speed versus file size
+    if (options.pngCompression >= 0)
+        png_set_compression_level(pngPtr, options.pngCompression);
+    if (options.pngFilter == PNG_ROW_FILTER_SUB)
+        png_set_filter(pngPtr, PNG_FILTER_TYPE_BASE, PNG_FILTER_SUB);
+    else if (options.pngFilter == PNG_ROW_FILTER_NONE)
+        png_set_filter(pngPtr, PNG_FILTER_TYPE_BASE, PNG_FILTER_NONE);
+
     png_set_IHDR(pngPtr, infoPtr, mWidth, mHeight, 8,
         PNG_COLOR_TYPE_RGB_ALPHA,
         PNG_INTERLACE_NONE,
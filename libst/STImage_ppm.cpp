@@ -3,135 +3,355 @@
 
 #include "st.h"
 
+#include <limits.h>
 #include <string.h>
 #include <stdio.h>
+#include <vector>
 
-// The PPM format guarantees no line in the file is longer
-// than 70 characters. We are a little conservative here.
-static const int MAX_PPM_LINE = 80;
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 //
-// Pulls the next line of a PPM file out of the file stream and
-// strips out any comments.
+// The contents of an image file, read-only. Where mmap is available the
+// file is mapped rather than read, so the loaders copy pixels straight
+// from the page cache into the image.
 //
-static int
-PPMNextLine(FILE* ppmFile, char* line)
+class PNMFileData
 {
-    if (fgets(line, MAX_PPM_LINE, ppmFile) != NULL ) {
-        char* commentChar = strchr(line, '#');
-        if (commentChar)
-            *commentChar = '\0';
-            return 1;
-    } else {
-        return 0;
+public:
+    PNMFileData(const std::string& filename)
+        : mData(NULL)
+        , mSize(0)
+        , mMapped(false)
+    {
+#ifndef _WIN32
+        int file = open(filename.c_str(), O_RDONLY);
+        if (file >= 0) {
+            struct stat status;
+            if (fstat(file, &status) == 0 && status.st_size > 0) {
+                void* data = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+                if (data != MAP_FAILED) {
+                    mData = (const unsigned char*)data;
+                    mSize = status.st_size;
+                    mMapped = true;
+                }
+            }
+            close(file);
+            if (mMapped)
+                return;
+        }
+#endif
+        // fall back on reading the whole file
+        FILE* imgFile = fopen(filename.c_str(), "rb");
+        if (!imgFile)
+            return;
+        unsigned char chunk[65536];
+        size_t count;
+        while ((count = fread(chunk, 1, sizeof(chunk), imgFile)) > 0)
+            mBuffer.insert(mBuffer.end(), chunk, chunk + count);
+        fclose(imgFile);
+        mData = mBuffer.empty() ? NULL : &mBuffer[0];
+        mSize = mBuffer.size();
+    }
+
+    ~PNMFileData()
+    {
+#ifndef _WIN32
+        if (mMapped)
+            munmap((void*)mData, mSize);
+#endif
+    }
+
+    const unsigned char* GetData() const { return mData; }
+    size_t GetSize() const { return mSize; }
+
+private:
+    const unsigned char* mData;
+    size_t mSize;
+    bool mMapped;
+    std::vector<unsigned char> mBuffer;
+
+    PNMFileData(const PNMFileData&);
+    PNMFileData& operator=(const PNMFileData&);
+};
+
+//
+// Cursor over the text parts of a PNM file: the header, and the samples
+// of a plain (P3) file. Comments run from '#' to the end of the line.
+//
+struct PNMReader
+{
+    const unsigned char* pos;
+    const unsigned char* end;
+
+    static bool IsSpace(unsigned char c)
+    {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
     }
+
+    void SkipSpace()
+    {
+        while (pos < end) {
+            if (*pos == '#') {
+                while (pos < end && *pos != '\n')
+                    pos++;
+            } else if (IsSpace(*pos)) {
+                pos++;
+            } else {
+                break;
+            }
+        }
+    }
+
+    //
+    // Parses the next decimal number. Returns false at the end of the
+    // data or on anything but a digit.
+    //
+    bool ReadInt(int* value)
+    {
+        SkipSpace();
+        if (pos == end || *pos < '0' || *pos > '9')
+            return false;
+        int v = 0;
+        while (pos < end && *pos >= '0' && *pos <= '9') {
+            if (v > 100000000)
+                return false;
+            v = v * 10 + (*pos++ - '0');
+        }
+        *value = v;
+        return true;
+    }
+
+    //
+    // The next whitespace separated word, e.g. a PAM header token.
+    //
+    std::string ReadWord()
+    {
+        SkipSpace();
+        const unsigned char* start = pos;
+        while (pos < end && !IsSpace(*pos))
+            pos++;
+        return std::string((const char*)start, pos - start);
+    }
+};
+
+static inline void StorePixel(STColor4ub& pixel, unsigned char r, unsigned char g,
+                              unsigned char b, unsigned char a)
+{
+    pixel.r = r;
+    pixel.g = g;
+    pixel.b = b;
+    pixel.a = a;
+}
+
+static void PNMError(const std::string& filename, const char* message)
+{
+    fprintf(stderr, "STImage::LoadPPM() - Could not read '%s': %s.\n",
+            filename.c_str(), message);
+    throw std::runtime_error("Error in LoadPPM");
 }
 
 //
-// Creates an STImage from the contents of a PPM file
+// Creates an STImage from the contents of a PNM file: plain (P3) or raw
+// (P6) PPM, raw PGM (P5), or PAM (P7) with 1 to 4 channels. Samples wider
+// than 8 bits, or with another maximum than 255, are scaled to 0..255.
 //
 void STImage::LoadPPM(const std::string& filename)
 {
-    FILE* imgFile = fopen(filename.c_str(), "r");
-    if (!imgFile) {
+    PNMFileData file(filename);
+    if (!file.GetData()) {
         fprintf(stderr, "STImage::LoadPPM() - Could not open '%s'.\n",
                 filename.c_str());
         throw std::runtime_error("Error in LoadPPM");
     }
 
-    // Read the PPM header, it should begin with the characters 'P3'.
-    // If it doesn't, complain about an invalid format
-    char line[MAX_PPM_LINE];
-    fgets(line, 3, imgFile);
-
-    if (strcmp(line, "P3") != 0) {
-        fprintf(stderr, "Invalid PPM file format.\n");
-        throw std::runtime_error("Error in LoadPPM");
-    }
+    PNMReader reader;
+    reader.pos = file.GetData();
+    reader.end = file.GetData() + file.GetSize();
+    if (file.GetSize() < 2 || reader.pos[0] != 'P')
+        PNMError(filename, "not a PNM file");
+    char format = reader.pos[1];
+    reader.pos += 2;
 
-    // Parse the width, height and maximum pixel value from the header.
-    // These may appear on a single line or multiple lines, so we
-    // parse until we have read all three.
-    int pos = 0;
-    int header[3];
-    while (pos < 3 && PPMNextLine(imgFile, line)) {
-        char* tok = strtok(line, " \t\n");
-        while (tok) {
-            int val = 0;
-            sscanf(tok, "%d", &val);
-            header[pos++] = val;
-            tok = strtok(NULL, " \t\n");
-        } 
+    // Parse the header. PAM names its fields; the others list width,
+    // height and the maximum sample value.
+    int width = 0, height = 0, maxVal = 0, channels = 0;
+    if (format == '7') {
+        for (;;) {
+            std::string token = reader.ReadWord();
+            if (token == "ENDHDR")
+                break;
+            else if (token == "WIDTH")
+                reader.ReadInt(&width);
+            else if (token == "HEIGHT")
+                reader.ReadInt(&height);
+            else if (token == "DEPTH")
+                reader.ReadInt(&channels);
+            else if (token == "MAXVAL")
+                reader.ReadInt(&maxVal);
+            else if (token == "TUPLTYPE")
+                reader.ReadWord();
+            else
+                PNMError(filename, "bad PAM header");
+        }
+        // ENDHDR is followed by a newline
+        if (reader.pos < reader.end)
+            reader.pos++;
+    } else if (format == '3' || format == '5' || format == '6') {
+        channels = (format == '5') ? 1 : 3;
+        if (!reader.ReadInt(&width) || !reader.ReadInt(&height) || !reader.ReadInt(&maxVal))
+            PNMError(filename, "bad header");
+        // a single whitespace character precedes raw samples
+        if (format != '3' && reader.pos < reader.end)
+            reader.pos++;
+    } else {
+        PNMError(filename, "unsupported PNM format");
     }
+    if (width <= 0 || height <= 0 || maxVal <= 0 || maxVal > 65535 ||
+        channels < 1 || channels > 4)
+        PNMError(filename, "bad header");
 
-    int width = header[0];
-    int height = header[1];
-    int maxVal = header[2];
+    // the samples, and so the pixels, must be countable in an int
+    if ((INT_MAX / channels) / height < width)
+        PNMError(filename, "image too large");
 
-    int numPixels = width * height;
-    int curComponent = 0;
+    // plain samples take at least a digit and a separator each, raw ones
+    // exactly their bytes
+    int bytesPerSample = (maxVal > 255) ? 2 : 1;
+    size_t rowBytes = (size_t)width * channels * bytesPerSample;
+    size_t available = reader.end - reader.pos;
+    if (format == '3') {
+        if ((available + 1) / 2 < (size_t)width * height * channels)
+            PNMError(filename, "truncated data");
+    } else if (available / rowBytes < (size_t)height) {
+        PNMError(filename, "truncated data");
+    }
 
     Initialize(width, height);
-    STColor4ub* pixels = mPixels;
-
-    int pixelValues[3];
-
-    pos = 0;
 
-    while ( pos < numPixels && PPMNextLine(imgFile, line)) {
+    // Sample values scaled to 0..255 (as maxVal scales to 255).
+    std::vector<unsigned char> scale(maxVal + 1);
+    for (int v = 0; v <= maxVal; ++v)
+        scale[v] = (unsigned char)(v * 255 / maxVal);
 
-        char* tok = strtok(line, " \t\n");
+    // Rows are stored top row first, while STImage keeps the bottom row
+    // first, so every row goes into its flipped destination.
+    std::vector<int> samples(width * channels);
+    for (int y = 0; y < height; ++y) {
+        STColor4ub* row = mPixels + (size_t)(height - 1 - y) * width;
 
-        while (tok) {
-            int val = 0;
-            sscanf(tok, "%d", &val); 
-            //printf("Scanned: %d\n", val);
-            pixelValues[curComponent] = val;
-            
-            if (curComponent == 2) {
-                // done with this pixel, store the pixel and move to next
-                pixels[pos].r = pixelValues[0] * 255 / maxVal;
-                pixels[pos].g = pixelValues[1] * 255 / maxVal;
-                pixels[pos].b = pixelValues[2] * 255 / maxVal;
-                pixels[pos].a = 255;
+        if (format == '3') {
+            for (int i = 0; i < width * channels; ++i) {
+                if (!reader.ReadInt(&samples[i]) || samples[i] > maxVal) {
+                    delete [] mPixels;
+                    mPixels = NULL;
+                    PNMError(filename, "bad or missing sample");
+                }
+            }
+        } else {
+            const unsigned char* src = reader.pos;
+            reader.pos += rowBytes;
 
-                curComponent = 0;
-                pos++;
+            // the common cases go straight from the file into the image
+            if (channels == 4 && maxVal == 255) {
+                memcpy((void *)row, src, rowBytes);
+                continue;
+            }
+            if (channels == 3 && maxVal == 255) {
+                for (int x = 0; x < width; ++x, src += 3)
+                    StorePixel(row[x], src[0], src[1], src[2], 255);
+                continue;
             }
-            else {
-                curComponent++;
+            for (int i = 0; i < width * channels; ++i) {
+                int v = (bytesPerSample == 2) ? (src[2*i] << 8) | src[2*i + 1] : src[i];
+                samples[i] = (v > maxVal) ? maxVal : v;
             }
+        }
 
-            tok = strtok(NULL, " \t\n");
-        } 
+        const int* s = &samples[0];
+        for (int x = 0; x < width; ++x, s += channels) {
+            switch (channels) {
+            case 1:
+                StorePixel(row[x], scale[s[0]], scale[s[0]], scale[s[0]], 255);
+                break;
+            case 2:
+                StorePixel(row[x], scale[s[0]], scale[s[0]], scale[s[0]], scale[s[1]]);
+                break;
+            case 3:
+                StorePixel(row[x], scale[s[0]], scale[s[1]], scale[s[2]], 255);
+                break;
+            default:
+                StorePixel(row[x], scale[s[0]], scale[s[1]], scale[s[2]], scale[s[3]]);
+                break;
+            }
+        }
     }
-    
-    fclose(imgFile);
 }
 
 //
-// Create a PPM file from the pixel contents of the STImage
+// Create a PNM file from the pixel contents of the STImage: raw PGM (P5,
+// luminance only) for a .pgm file name, PAM (P7, with alpha) for .pam,
+// and raw PPM (P6) otherwise. The file is assembled in memory and written
+// with a single call.
 //
 STStatus
 STImage::SavePPM(const std::string& filename) const
 {
-    FILE* imgFile = fopen(filename.c_str(), "w");
+    std::string ext = STGetExtension(filename);
+    int channels = 3;
+    char header[128];
+    if (ext.compare("PGM") == 0) {
+        channels = 1;
+        sprintf(header, "P5\n%d %d\n255\n", mWidth, mHeight);
+    } else if (ext.compare("PAM") == 0) {
+        channels = 4;
+        sprintf(header, "P7\nWIDTH %d\nHEIGHT %d\nDEPTH 4\nMAXVAL 255\n"
+                "TUPLTYPE RGB_ALPHA\nENDHDR\n", mWidth, mHeight);
+    } else {
+        sprintf(header, "P6\n%d %d\n255\n", mWidth, mHeight);
+    }
+
+    size_t headerBytes = strlen(header);
+    std::vector<unsigned char> data(headerBytes + (size_t)mWidth * mHeight * channels);
+    memcpy(&data[0], header, headerBytes);
+    unsigned char* dst = &data[headerBytes];
+
+    // top row first
+    for (int y = mHeight - 1; y >= 0; --y) {
+        const STColor4ub* row = mPixels + (size_t)y * mWidth;
+        if (channels == 4) {
+            memcpy(dst, row, (size_t)mWidth * 4);
+            dst += (size_t)mWidth * 4;
+        } else if (channels == 3) {
+            for (int x = 0; x < mWidth; ++x) {
+                *dst++ = row[x].r;
+                *dst++ = row[x].g;
+                *dst++ = row[x].b;
+            }
+        } else {
+            // Rec. 601 luma in 8.8 fixed point
+            for (int x = 0; x < mWidth; ++x)
+                *dst++ = (unsigned char)((77 * row[x].r + 150 * row[x].g +
+                                          29 * row[x].b + 128) >> 8);
+        }
+    }
+
+    FILE* imgFile = fopen(filename.c_str(), "wb");
     if (!imgFile) {
         fprintf(stderr, "STImage::SavePPM() - Could not open '%s'.\n",
                 filename.c_str());
         return ST_ERROR;
     }
-
-    fprintf(imgFile, "P3\n");
-    fprintf(imgFile, "%d %d\n", mWidth, mHeight);
-    fprintf(imgFile, "255\n");
-
-    int numPixels = mWidth * mHeight;
-    for (int ii = 0; ii < numPixels; ++ii) {
-        STColor4ub pixel = mPixels[ii];
-        fprintf(imgFile,"%d %d %d\n", pixel.r, pixel.g, pixel.b);
+    bool written = fwrite(&data[0], 1, data.size(), imgFile) == data.size();
+    if (fclose(imgFile) != 0 || !written) {
+        fprintf(stderr, "STImage::SavePPM() - Could not write '%s'.\n",
+                filename.c_str());
+        return ST_ERROR;
     }
-    fclose(imgFile);
 
     return ST_OK;
 }
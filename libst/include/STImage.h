@@ -45,8 +45,51 @@ public:
     typedef STColor4ub Pixel;
 
     //
-    // Load a new image from an image file (PPM, JPEG
-    // and PNG formats are supported).
+    // Encoder settings for Save(), which trade file size for
+    // encoding speed. Each format uses only its own fields.
+    // The presets are:
+    //
+    //   SAVE_FASTEST   zlib level 1 and the SUB filter on every
+    //                  row for PNG, the fast integer DCT for JPEG;
+    //                  for intermediate files
+    //   SAVE_BALANCED  the library defaults (and what Save() did
+    //                  before presets existed)
+    //   SAVE_SMALLEST  zlib level 9 for PNG, optimized Huffman
+    //                  tables for JPEG; same pixels, smaller files
+    //
+    enum SavePreset {
+        SAVE_FASTEST,
+        SAVE_BALANCED,
+        SAVE_SMALLEST
+    };
+
+    enum PNGRowFilter {
+        PNG_ROW_FILTER_ADAPTIVE,    // best filter picked per row
+        PNG_ROW_FILTER_NONE,
+        PNG_ROW_FILTER_SUB
+    };
+
+    enum JPGTransform {
+        JPG_DCT_INTEGER,            // accurate integer DCT
+        JPG_DCT_FAST_INTEGER,       // faster, slightly less accurate
+        JPG_DCT_FLOAT
+    };
+
+    struct SaveOptions {
+        int pngCompression;         // zlib level 0-9, -1 for default
+        PNGRowFilter pngFilter;
+        int jpgQuality;             // 0-100
+        JPGTransform jpgTransform;
+        bool jpgOptimizeCoding;     // compute optimal Huffman tables
+
+        SaveOptions(SavePreset preset = SAVE_BALANCED);
+    };
+
+    //
+    // Load a new image from an image file (PPM/PGM/PAM,
+    // JPEG and PNG formats are supported). Plain and
+    // raw PPM, raw PGM and PAM files are read by
+    // mapping them into memory.
     // Returns NULL on failure.
     //
     STImage(const std::string& filename);
@@ -63,11 +106,14 @@ public:
     ~STImage();
 
     //
-    // Save the image to a file (PPM, JPEG and PNG
-    // formats are supported).
+    // Save the image to a file (PPM/PGM/PAM, JPEG and
+    // PNG formats are supported). PPM and PNM files are
+    // raw PPM (P6), PGM files hold the luminance and PAM
+    // files keep the alpha channel.
     // Returns a non-zero value on error.
     //
-    STStatus Save(const std::string& filename) const;
+    STStatus Save(const std::string& filename,
+                  const SaveOptions& options = SaveOptions()) const;
 
     //
     // Draw the image to the OpenGL window using glDrawPixels.
@@ -141,10 +187,12 @@ private:
     STStatus  SavePPM(const std::string& filename) const;
 
     void LoadPNG(const std::string& filename);
-    STStatus  SavePNG(const std::string& filename) const;
+    STStatus  SavePNG(const std::string& filename,
+                      const SaveOptions& options) const;
 
     void LoadJPG(const std::string& filename);
-    STStatus  SaveJPG(const std::string& filename) const;
+    STStatus  SaveJPG(const std::string& filename,
+                      const SaveOptions& options) const;
 };
 
 #endif // __STIMAGE_H__